@@ -0,0 +1,444 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#if defined(__linux__)
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "controlgroup.h"
+
+#define LOG_TAG "ControlGroup"
+#include "logging.h"
+
+/* where the cgroup of the calling process is found */
+#define CONTROL_GROUP_SELF          "/proc/self/cgroup"
+#define CONTROL_GROUP_MOUNTINFO     "/proc/self/mountinfo"
+/* how long destroy waits for a group to empty, attempts times delay (ms) */
+#define CONTROL_GROUP_REMOVE_ATTEMPTS   100
+#define CONTROL_GROUP_REMOVE_DELAY      10L
+
+static unsigned long ControlGroup_nextName = 0;
+
+static
+char* ControlGroup_join(char const *dir, char const *file) {
+    size_t len = strlen(dir) + strlen(file) + 2;
+    char *path = (char*) malloc(len);
+
+    if (path)
+        snprintf(path, len, "%s/%s", dir, file);
+    return path;
+}
+
+/* write text to file of the group at dir, returns 0 and sets errno on failure */
+static
+int ControlGroup_write(char const *dir, char const *file, char const *text) {
+    int rc = 0;
+    int fd = -1;
+    int saved = 0;
+    size_t len = strlen(text);
+    char *path = NULL;
+
+    path = ControlGroup_join(dir, file);
+    if (!path)
+        goto failure;
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        goto failure;
+    /* cgroup files take a value in one write or not at all */
+    if (write(fd, text, len) != (ssize_t) len)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    saved = errno;
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    free(path);
+    errno = saved;
+    goto exit;
+}
+
+/* the value of key in a flat keyed file ("key value" lines), -1 if missing */
+static
+long ControlGroup_readKey(char const *dir, char const *file, char const *key) {
+    long r = -1;
+    long value = 0;
+    char name[64];
+    char *path = NULL;
+    FILE *fp = NULL;
+
+    path = ControlGroup_join(dir, file);
+    if (!path)
+        goto exit;
+    fp = fopen(path, "re");
+    if (!fp)
+        goto exit;
+    while (fscanf(fp, "%63s %ld", &name[0], &value) == 2) {
+        if (strcmp(&name[0], key) == 0) {
+            r = value;
+            break;
+        }
+    }
+exit:
+    if (fp)
+        fclose(fp);
+    free(path);
+    return r;
+}
+
+/* the number in file of the group at dir, -1 if there is none */
+static
+long ControlGroup_readNumber(char const *dir, char const *file) {
+    long value = -1;
+    char *path = NULL;
+    FILE *fp = NULL;
+
+    path = ControlGroup_join(dir, file);
+    if (!path)
+        return -1;
+    fp = fopen(path, "re");
+    if (fp) {
+        if (fscanf(fp, "%ld", &value) != 1)
+            value = -1;
+        fclose(fp);
+    }
+    free(path);
+    return value;
+}
+
+/*
+ * Directory of the group of the calling process: its "0::" entry in
+ * /proc/self/cgroup below the mount point of cgroup2.
+ */
+static
+char* ControlGroup_findSelf() {
+    char *r = NULL;
+    char *line = NULL;
+    char *group = NULL;
+    char *mount = NULL;
+    char *sep = NULL;
+    size_t size = 0;
+    FILE *fp = NULL;
+
+    fp = fopen(CONTROL_GROUP_SELF, "re");
+    if (!fp)
+        goto failure;
+    while (getline(&line, &size, fp) != -1) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            group = strdup(line + 3);
+            break;
+        }
+    }
+    fclose(fp);
+    fp = NULL;
+    if (!group)
+        goto failure;
+
+    fp = fopen(CONTROL_GROUP_MOUNTINFO, "re");
+    if (!fp)
+        goto failure;
+    while (getline(&line, &size, fp) != -1) {
+        /* "id parent dev root mountpoint options ... - fstype source ..." */
+        sep = strstr(line, " - ");
+        if (!sep || strncmp(sep + 3, "cgroup2 ", 8) != 0)
+            continue;
+        if (sscanf(line, "%*s %*s %*s %*s %ms", &mount) == 1)
+            break;
+    }
+    if (!mount)
+        goto failure;
+    r = (char*) malloc(strlen(mount) + strlen(group) + 1);
+    if (!r)
+        goto failure;
+    strcpy(r, mount);
+    /* the root group is "/", no need for a trailing slash */
+    if (strcmp(group, "/") != 0)
+        strcat(r, group);
+
+    goto exit;
+exit:
+    if (fp)
+        fclose(fp);
+    free(line);
+    free(group);
+    free(mount);
+    return r;
+failure:
+    LOGE("no cgroup2 group of this process found");
+    goto exit;
+}
+
+static
+char const* ControlGroup_getPath(ControlGroup const *me) {
+    return me->data._M_path;
+}
+
+/*
+ * Hand the memory and cpu controllers of the group at dir on to its
+ * children. Only done for groups about to get children, a group with a
+ * controller in its subtree_control can not take processes itself (no
+ * internal processes rule, EBUSY on cgroup.procs).
+ */
+static
+void ControlGroup_delegate(char const *dir) {
+    size_t i = 0;
+    /* one by one, either may be missing */
+    char const *controllers[] = { "+memory", "+cpu" };
+
+    /* missing in the parent, limits of the children fail later on instead */
+    for (i = 0; i < sizeof(controllers) / sizeof(controllers[0]); ++i) {
+        if (!ControlGroup_write(dir, "cgroup.subtree_control", controllers[i]))
+            LOGD("no %s below %s: %s", controllers[i] + 1, dir, strerror(errno));
+    }
+}
+
+static
+ControlGroup* ControlGroup_createChild(ControlGroup const *me, char const *name) {
+    ControlGroup_delegate(me->data._M_path);
+    return ControlGroup_create(me->data._M_path, name);
+}
+
+static
+ControlGroup* ControlGroup_setMemoryMax(ControlGroup *me, long bytes) {
+    char text[32];
+
+    if (bytes < -1)
+        return NULL;
+    if (bytes == -1)
+        snprintf(&text[0], sizeof(text), "max");
+    else
+        snprintf(&text[0], sizeof(text), "%ld", bytes);
+    if (!ControlGroup_write(me->data._M_path, "memory.max", &text[0])) {
+        LOGE("memory.max %s of %s failed: %s", &text[0], me->data._M_path,
+                strerror(errno));
+        return NULL;
+    }
+    return me;
+}
+
+static
+ControlGroup* ControlGroup_setCPUMax(ControlGroup *me, long quota_us, long period_us) {
+    char text[64];
+
+    if (quota_us < -1 || quota_us == 0 || period_us <= 0)
+        return NULL;
+    if (quota_us == -1)
+        snprintf(&text[0], sizeof(text), "max %ld", period_us);
+    else
+        snprintf(&text[0], sizeof(text), "%ld %ld", quota_us, period_us);
+    if (!ControlGroup_write(me->data._M_path, "cpu.max", &text[0])) {
+        LOGE("cpu.max %s of %s failed: %s", &text[0], me->data._M_path,
+                strerror(errno));
+        return NULL;
+    }
+    return me;
+}
+
+/* SIGKILL to the processes of the group at dir and of every group below */
+static
+int ControlGroup_killTree(char const *dir) {
+    int rc = 1;
+    int pid = 0;
+    char *path = NULL;
+    FILE *fp = NULL;
+    DIR *d = NULL;
+    struct dirent *entry = NULL;
+
+    path = ControlGroup_join(dir, "cgroup.procs");
+    if (!path)
+        return 0;
+    fp = fopen(path, "re");
+    free(path);
+    if (!fp)
+        return 0;
+    while (fscanf(fp, "%d", &pid) == 1) {
+        if (kill((pid_t) pid, SIGKILL) == -1 && errno != ESRCH)
+            rc = 0;
+    }
+    fclose(fp);
+
+    d = opendir(dir);
+    if (!d)
+        return 0;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0
+                || strcmp(entry->d_name, "..") == 0)
+            continue;
+        path = ControlGroup_join(dir, entry->d_name);
+        if (!path || !ControlGroup_killTree(path))
+            rc = 0;
+        free(path);
+    }
+    closedir(d);
+    return rc;
+}
+
+static
+int ControlGroup_kill(ControlGroup *me) {
+    if (ControlGroup_write(me->data._M_path, "cgroup.kill", "1"))
+        return 1;
+    /* no cgroup.kill before Linux 5.14 */
+    if (errno != ENOENT) {
+        LOGE("cgroup.kill of %s failed: %s", me->data._M_path, strerror(errno));
+        return 0;
+    }
+    return ControlGroup_killTree(me->data._M_path);
+}
+
+static
+long ControlGroup_getMemoryCurrent(ControlGroup const *me) {
+    return ControlGroup_readNumber(me->data._M_path, "memory.current");
+}
+
+static
+long ControlGroup_getCPUUsage(ControlGroup const *me) {
+    /* cpu.stat has usage_usec with or without the cpu controller */
+    return ControlGroup_readKey(me->data._M_path, "cpu.stat", "usage_usec");
+}
+
+static
+long ControlGroup_getProcessCount(ControlGroup const *me) {
+    long count = 0;
+    int pid = 0;
+    char *path = NULL;
+    FILE *fp = NULL;
+
+    path = ControlGroup_join(me->data._M_path, "cgroup.procs");
+    if (!path)
+        return -1;
+    fp = fopen(path, "re");
+    free(path);
+    if (!fp)
+        return -1;
+    while (fscanf(fp, "%d", &pid) == 1)
+        ++count;
+    fclose(fp);
+    return count;
+}
+
+/* remove the group at dir after the groups below it, once they are empty */
+static
+void ControlGroup_remove(char const *dir) {
+    int attempt = 0;
+    char *path = NULL;
+    DIR *d = NULL;
+    struct dirent *entry = NULL;
+    struct timespec delay;
+
+    d = opendir(dir);
+    if (d) {
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0
+                    || strcmp(entry->d_name, "..") == 0)
+                continue;
+            path = ControlGroup_join(dir, entry->d_name);
+            if (path)
+                ControlGroup_remove(path);
+            free(path);
+        }
+        closedir(d);
+    }
+    /* processes just killed leave the group a moment later */
+    delay.tv_sec = 0;
+    delay.tv_nsec = CONTROL_GROUP_REMOVE_DELAY * 1000000L;
+    while (rmdir(dir) != 0) {
+        if (errno != EBUSY || ++attempt >= CONTROL_GROUP_REMOVE_ATTEMPTS) {
+            LOGE("removing %s failed: %s", dir, strerror(errno));
+            break;
+        }
+        nanosleep(&delay, NULL);
+    }
+}
+
+void ControlGroup_destroy(ControlGroup *me) {
+    if (me) {
+        if (me->data._M_path) {
+            ControlGroup_remove(me->data._M_path);
+            free(me->data._M_path);
+            me->data._M_path = NULL;
+        }
+        free(me);
+    }
+}
+
+ControlGroup* ControlGroup_create(char const *parent, char const *name) {
+    ControlGroup *r = NULL;
+    ControlGroup *instance = NULL;
+    char *self = NULL;
+    char generated[64];
+
+    if (!parent) {
+        self = ControlGroup_findSelf();
+        if (!self)
+            goto failure;
+        parent = self;
+    }
+    if (!name) {
+        snprintf(&generated[0], sizeof(generated), "procs-%d-%lu", (int) getpid(),
+                __sync_fetch_and_add(&ControlGroup_nextName, 1));
+        name = &generated[0];
+    }
+    if (!*name || strchr(name, '/'))
+        goto failure;
+
+    instance = (ControlGroup*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->data._M_path = ControlGroup_join(parent, name);
+    if (!instance->data._M_path)
+        goto failure;
+    if (mkdir(instance->data._M_path, 0755) != 0) {
+        LOGE("creating %s failed: %s", instance->data._M_path, strerror(errno));
+        free(instance->data._M_path);
+        instance->data._M_path = NULL;
+        goto failure;
+    }
+    instance->calls.getPath = &ControlGroup_getPath;
+    instance->calls.createChild = &ControlGroup_createChild;
+    instance->calls.setMemoryMax = &ControlGroup_setMemoryMax;
+    instance->calls.setCPUMax = &ControlGroup_setCPUMax;
+    instance->calls.kill = &ControlGroup_kill;
+    instance->calls.getMemoryCurrent = &ControlGroup_getMemoryCurrent;
+    instance->calls.getCPUUsage = &ControlGroup_getCPUUsage;
+    instance->calls.getProcessCount = &ControlGroup_getProcessCount;
+
+    goto success;
+exit:
+    free(self);
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        ControlGroup_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
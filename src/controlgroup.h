@@ -0,0 +1,76 @@
+#ifndef CONTROLGROUP_H_INCLUDED
+#define CONTROLGROUP_H_INCLUDED
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * A cgroup v2 group created for the processes of a test run.
+     *
+     * Processes started into a group (ProcessBuilder setControlGroup) stay
+     * in it along with everything they fork, so the whole subtree can be
+     * killed at once and its memory and cpu usage is read from one place,
+     * however many processes are in there. Limits apply to the group and
+     * everything below it. Linux only, needs the unified hierarchy mounted
+     * and write access to the parent group.
+     */
+
+    struct tagControlGroup;
+
+    typedef struct tagControlGroup ControlGroup;
+
+    struct tagControlGroup {
+        struct {
+            /* directory of the group, it is cgroup.procs in there processes join */
+            char const*     (*getPath)          (ControlGroup const*);
+            /*
+             * New group below this one, NULL name for a generated unique
+             * one. Hands the memory and cpu controllers on to the children
+             * of this group first, where it has them; this group can not
+             * take processes of its own from then on, its children can.
+             */
+            ControlGroup*   (*createChild)      (ControlGroup const*, char const *name);
+            /* memory.max in bytes, -1 for no limit; NULL if refused */
+            ControlGroup*   (*setMemoryMax)     (ControlGroup*, long bytes);
+            /* cpu.max, quota_us of cpu time per period_us, quota -1 for no limit */
+            ControlGroup*   (*setCPUMax)        (ControlGroup*, long quota_us, long period_us);
+            /*
+             * SIGKILL to every process of the group and its children in
+             * one write (cgroup.kill, Linux 5.14), one by one on older
+             * kernels. Returns 1 on success.
+             */
+            int             (*kill)             (ControlGroup*);
+            /* memory.current in bytes, -1 without the memory controller */
+            long            (*getMemoryCurrent) (ControlGroup const*);
+            /* cpu time used by the processes of the group in us, -1 on failure */
+            long            (*getCPUUsage)      (ControlGroup const*);
+            /* processes of the group itself, not of its children, -1 on failure */
+            long            (*getProcessCount)  (ControlGroup const*);
+        } calls;
+
+        struct {
+            char   *_M_path;
+        } data;
+    };
+
+    /*
+     * Create the group name below the group at parent, a directory in the
+     * cgroup2 mount. NULL parent for the group of the calling process,
+     * NULL name for a generated unique one. No controllers are enabled
+     * below the new group, processes can join it (see createChild).
+     */
+    extern ControlGroup*    ControlGroup_create(char const *parent, char const *name);
+    /*
+     * Remove the group along with the groups below it, a crashed run may
+     * have left some. They have to be empty (killed) by then.
+     */
+    extern void             ControlGroup_destroy(ControlGroup*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTROLGROUP_H_INCLUDED */
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "latencyhistogram.h"
+
+/* buckets per power of two once values outgrow the linear range */
+#define LATENCY_HISTOGRAM_SUB_BUCKETS   (1L << LATENCY_HISTOGRAM_PRECISION)
+
+static
+int LatencyHistogram_log2(unsigned long value) {
+    int n = 0;
+    while (value >>= 1)
+        ++n;
+    return n;
+}
+
+/*
+ * Values below 2 * SUB_BUCKETS map to themselves. A value with its top
+ * bit at PRECISION + k (k >= 1) is shifted right by k, which leaves it in
+ * [SUB_BUCKETS, 2 * SUB_BUCKETS), and lands in the k-th block above that.
+ */
+static
+size_t LatencyHistogram_index(long value) {
+    int shift = 0;
+
+    if (value < 2 * LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return (size_t) value;
+    shift = LatencyHistogram_log2((unsigned long) value) - LATENCY_HISTOGRAM_PRECISION;
+    return (size_t) (shift * LATENCY_HISTOGRAM_SUB_BUCKETS + (value >> shift));
+}
+
+/* largest value that falls into bucket index */
+static
+long LatencyHistogram_highest(size_t index) {
+    long shift = 0;
+
+    if (index < 2 * LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return (long) index;
+    shift = (long) index / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+    return (((long) index - shift * LATENCY_HISTOGRAM_SUB_BUCKETS) << shift)
+        + (1L << shift) - 1;
+}
+
+static
+void LatencyHistogram_record(LatencyHistogram *me, long value) {
+    if (value < 0)
+        value = 0;
+    if (value > LATENCY_HISTOGRAM_MAX)
+        value = LATENCY_HISTOGRAM_MAX;
+    ++me->data._M_counts[LatencyHistogram_index(value)];
+    if (me->data._M_count == 0 || value < me->data._M_min)
+        me->data._M_min = value;
+    if (value > me->data._M_max)
+        me->data._M_max = value;
+    me->data._M_sum += value;
+    ++me->data._M_count;
+}
+
+static
+void LatencyHistogram_merge(LatencyHistogram *me, LatencyHistogram const *other) {
+    size_t i = 0;
+
+    if (!other || other->data._M_count == 0)
+        return;
+    for (i = 0; i < me->data._M_nbuckets; ++i)
+        me->data._M_counts[i] += other->data._M_counts[i];
+    if (me->data._M_count == 0 || other->data._M_min < me->data._M_min)
+        me->data._M_min = other->data._M_min;
+    if (other->data._M_max > me->data._M_max)
+        me->data._M_max = other->data._M_max;
+    me->data._M_sum += other->data._M_sum;
+    me->data._M_count += other->data._M_count;
+}
+
+static
+void LatencyHistogram_reset(LatencyHistogram *me) {
+    memset(me->data._M_counts, 0,
+            me->data._M_nbuckets * sizeof(*me->data._M_counts));
+    me->data._M_count = 0;
+    me->data._M_min = 0;
+    me->data._M_max = 0;
+    me->data._M_sum = 0;
+}
+
+static
+long LatencyHistogram_getCount(LatencyHistogram const *me) {
+    return me->data._M_count;
+}
+
+static
+long LatencyHistogram_getMin(LatencyHistogram const *me) {
+    return me->data._M_min;
+}
+
+static
+long LatencyHistogram_getMax(LatencyHistogram const *me) {
+    return me->data._M_max;
+}
+
+static
+double LatencyHistogram_getMean(LatencyHistogram const *me) {
+    return me->data._M_count > 0 ? me->data._M_sum / me->data._M_count : 0;
+}
+
+static
+long LatencyHistogram_getPercentile(LatencyHistogram const *me, double percentile) {
+    size_t i = 0;
+    long seen = 0;
+    long rank = 0;
+    long value = 0;
+
+    if (me->data._M_count == 0)
+        return 0;
+    if (percentile < 0)
+        percentile = 0;
+    if (percentile > 100)
+        percentile = 100;
+    rank = (long) (percentile / 100.0 * me->data._M_count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < me->data._M_nbuckets; ++i) {
+        seen += me->data._M_counts[i];
+        if (seen >= rank) {
+            value = LatencyHistogram_highest(i);
+            break;
+        }
+    }
+    /* the bucket bound may overshoot what was actually recorded */
+    return value > me->data._M_max ? me->data._M_max : value;
+}
+
+void LatencyHistogram_destroy(LatencyHistogram *me) {
+    if (me) {
+        if (me->data._M_counts) {
+            free(me->data._M_counts);
+            me->data._M_counts = NULL;
+        }
+        free(me);
+    }
+}
+
+LatencyHistogram* LatencyHistogram_create() {
+    LatencyHistogram *r = NULL;
+    LatencyHistogram *instance = NULL;
+
+    instance = (LatencyHistogram*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.record = &LatencyHistogram_record;
+    instance->calls.merge = &LatencyHistogram_merge;
+    instance->calls.reset = &LatencyHistogram_reset;
+    instance->calls.getCount = &LatencyHistogram_getCount;
+    instance->calls.getMin = &LatencyHistogram_getMin;
+    instance->calls.getMax = &LatencyHistogram_getMax;
+    instance->calls.getMean = &LatencyHistogram_getMean;
+    instance->calls.getPercentile = &LatencyHistogram_getPercentile;
+
+    instance->data._M_nbuckets = LatencyHistogram_index(LATENCY_HISTOGRAM_MAX) + 1;
+    instance->data._M_counts = (long*) calloc(instance->data._M_nbuckets,
+            sizeof(*instance->data._M_counts));
+    if (!instance->data._M_counts)
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        LatencyHistogram_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
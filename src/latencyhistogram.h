@@ -0,0 +1,64 @@
+#ifndef LATENCYHISTOGRAM_H_INCLUDED
+#define LATENCYHISTOGRAM_H_INCLUDED
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * HDR style histogram of non negative values (latencies, in whatever
+     * unit the caller records).
+     *
+     * Values below 2^(LATENCY_HISTOGRAM_PRECISION + 1) get a bucket of
+     * their own, above that every power of two is split into
+     * 2^LATENCY_HISTOGRAM_PRECISION buckets, so any reported value is
+     * within 1% of a recorded one while the whole range up to
+     * LATENCY_HISTOGRAM_MAX costs a fixed 32KB. Larger values are clamped.
+     * Recording is a couple of shifts and an increment and never
+     * allocates. Not thread safe, keep one per thread and merge.
+     */
+
+    struct tagLatencyHistogram;
+
+    typedef struct tagLatencyHistogram LatencyHistogram;
+
+#define LATENCY_HISTOGRAM_PRECISION 7
+#define LATENCY_HISTOGRAM_MAX       ((1L << 36) - 1)
+
+    struct tagLatencyHistogram {
+        struct {
+            void    (*record)       (LatencyHistogram*, long value);
+            /* add every value recorded by other */
+            void    (*merge)        (LatencyHistogram*, LatencyHistogram const *other);
+            void    (*reset)        (LatencyHistogram*);
+            long    (*getCount)     (LatencyHistogram const*);
+            long    (*getMin)       (LatencyHistogram const*);
+            long    (*getMax)       (LatencyHistogram const*);
+            double  (*getMean)      (LatencyHistogram const*);
+            /*
+             * Smallest value that percentile (0-100) of the recorded values
+             * do not exceed, up to the bucket resolution. 0 when empty.
+             */
+            long    (*getPercentile)(LatencyHistogram const*, double percentile);
+        } calls;
+
+        struct {
+            long   *_M_counts;
+            size_t  _M_nbuckets;
+            long    _M_count;
+            long    _M_min;
+            long    _M_max;
+            double  _M_sum;
+        } data;
+    };
+
+    extern LatencyHistogram*    LatencyHistogram_create();
+    extern void                 LatencyHistogram_destroy(LatencyHistogram*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCYHISTOGRAM_H_INCLUDED */
@@ -0,0 +1,18 @@
+#include <signal.h>
+#include <pthread.h>
+
+#include "librarythread.h"
+
+int LibraryThread_create(pthread_t *thread, pthread_attr_t const *attr,
+        void* (*run)(void*), void *arg) {
+    int error = 0;
+    sigset_t all;
+    sigset_t old;
+
+    /* the new thread inherits the mask in effect while it is created */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    error = pthread_create(thread, attr, run, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return error;
+}
@@ -0,0 +1,26 @@
+#ifndef LIBRARYTHREAD_H_INCLUDED
+#define LIBRARYTHREAD_H_INCLUDED
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * pthread_create for the threads the library runs on its own (output
+     * reader, resource sampler, pool refill, load workers). They start
+     * with every signal blocked, so a signal meant for the process, e.g.
+     * SIGCHLD or SIGINT of the test program, is handled by one of its own
+     * threads and never interrupts or runs a handler on ours. The mask
+     * of the calling thread is left as it was. Returns 0 or the error
+     * number of pthread_create.
+     */
+    extern int  LibraryThread_create(pthread_t *thread, pthread_attr_t const *attr,
+            void* (*run)(void*), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBRARYTHREAD_H_INCLUDED */
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lifecyclestats.h"
+
+long LifecycleStats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+char const* LifecycleStats_getSpanName(int span) {
+    switch (span) {
+        case LIFECYCLE_SPAN_LOOKUP:
+            return "lookup";
+        case LIFECYCLE_SPAN_FORK:
+            return "fork";
+        case LIFECYCLE_SPAN_EXEC:
+            return "exec";
+        case LIFECYCLE_SPAN_READY:
+            return "ready";
+        case LIFECYCLE_SPAN_TERMINATE:
+            return "terminate";
+        case LIFECYCLE_SPAN_REAP:
+            return "reap";
+        default:
+            break;
+    }
+    return "<UNKNOWN>";
+}
+
+static
+void LifecycleStats_record(LifecycleStats *me, int span, long elapsed_us) {
+    LifecycleHook hook = NULL;
+    void *context = NULL;
+
+    if (span < 0 || span >= LIFECYCLE_SPANS)
+        return;
+    pthread_mutex_lock(&me->data._M_mutex);
+    me->data._M_spans[span]->calls.record(me->data._M_spans[span], elapsed_us);
+    hook = me->data._M_hook;
+    context = me->data._M_context;
+    pthread_mutex_unlock(&me->data._M_mutex);
+    /* outside the lock, the hook may well look at the stats itself */
+    if (hook)
+        hook(context, span, elapsed_us);
+}
+
+static
+int LifecycleStats_snapshot(LifecycleStats *me, int span, LatencyHistogram *out) {
+    if (span < 0 || span >= LIFECYCLE_SPANS || !out)
+        return 0;
+    out->calls.reset(out);
+    pthread_mutex_lock(&me->data._M_mutex);
+    out->calls.merge(out, me->data._M_spans[span]);
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return 1;
+}
+
+static
+void LifecycleStats_setHook(LifecycleStats *me, LifecycleHook hook, void *context) {
+    pthread_mutex_lock(&me->data._M_mutex);
+    me->data._M_hook = hook;
+    me->data._M_context = context;
+    pthread_mutex_unlock(&me->data._M_mutex);
+}
+
+static
+void LifecycleStats_reset(LifecycleStats *me) {
+    int i = 0;
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    for (i = 0; i < LIFECYCLE_SPANS; ++i)
+        me->data._M_spans[i]->calls.reset(me->data._M_spans[i]);
+    pthread_mutex_unlock(&me->data._M_mutex);
+}
+
+void LifecycleStats_destroy(LifecycleStats *me) {
+    int i = 0;
+    if (me) {
+        for (i = 0; i < LIFECYCLE_SPANS; ++i) {
+            LatencyHistogram_destroy(me->data._M_spans[i]);
+            me->data._M_spans[i] = NULL;
+        }
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me);
+    }
+}
+
+LifecycleStats* LifecycleStats_create() {
+    LifecycleStats *r = NULL;
+    LifecycleStats *instance = NULL;
+    int i = 0;
+
+    instance = (LifecycleStats*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    pthread_mutex_init(&instance->data._M_mutex, NULL);
+    instance->calls.record = &LifecycleStats_record;
+    instance->calls.snapshot = &LifecycleStats_snapshot;
+    instance->calls.setHook = &LifecycleStats_setHook;
+    instance->calls.reset = &LifecycleStats_reset;
+    for (i = 0; i < LIFECYCLE_SPANS; ++i) {
+        instance->data._M_spans[i] = LatencyHistogram_create();
+        if (!instance->data._M_spans[i])
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        LifecycleStats_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
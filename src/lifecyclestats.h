@@ -0,0 +1,75 @@
+#ifndef LIFECYCLESTATS_H_INCLUDED
+#define LIFECYCLESTATS_H_INCLUDED
+
+#include <pthread.h>
+
+#include "latencyhistogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Where the time of a server's life goes.
+     *
+     * Builders given a LifecycleStats (setStats) time every step of a
+     * launch and of the shutdown with the monotonic clock and add the span
+     * to one histogram per step. Nothing is measured without one. Spans
+     * are recorded in microseconds and an optional hook sees each one as it
+     * happens. Thread safe, one instance may be shared by several builders.
+     */
+
+    struct tagLifecycleStats;
+
+    typedef struct tagLifecycleStats LifecycleStats;
+
+    enum {
+        /* search of PATH for the executable */
+        LIFECYCLE_SPAN_LOOKUP = 0,
+        /*
+         * fork, vfork, clone or posix_spawn in the parent. All but fork
+         * return only once the child exec'ed, for them the exec is in here.
+         */
+        LIFECYCLE_SPAN_FORK,
+        /* fork returned until the child exec'ed */
+        LIFECYCLE_SPAN_EXEC,
+        /* exec until the server answered PING */
+        LIFECYCLE_SPAN_READY,
+        /* SIGTERM until the child exited */
+        LIFECYCLE_SPAN_TERMINATE,
+        /* exit until waitpid collected the status */
+        LIFECYCLE_SPAN_REAP,
+        LIFECYCLE_SPANS
+    };
+
+    /* called with every span right after it was recorded, on any thread */
+    typedef void (*LifecycleHook)(void *context, int span, long elapsed_us);
+
+    struct tagLifecycleStats {
+        struct {
+            void    (*record)   (LifecycleStats*, int span, long elapsed_us);
+            /* copy the histogram of span into out, returns 0 for bad spans */
+            int     (*snapshot) (LifecycleStats*, int span, LatencyHistogram *out);
+            void    (*setHook)  (LifecycleStats*, LifecycleHook, void *context);
+            void    (*reset)    (LifecycleStats*);
+        } calls;
+
+        struct {
+            LatencyHistogram   *_M_spans[LIFECYCLE_SPANS];
+            LifecycleHook       _M_hook;
+            void               *_M_context;
+            pthread_mutex_t     _M_mutex;
+        } data;
+    };
+
+    extern LifecycleStats*  LifecycleStats_create();
+    extern void             LifecycleStats_destroy(LifecycleStats*);
+    extern char const*      LifecycleStats_getSpanName(int span);
+    /* the clock spans are taken with, monotonic microseconds */
+    extern long             LifecycleStats_now();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIFECYCLESTATS_H_INCLUDED */
@@ -0,0 +1,49 @@
+#ifndef LOGGING_H_INCLUDED
+#define LOGGING_H_INCLUDED
+
+#include <stdio.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+/*
+ * Level gated logging to stderr, internal to the library.
+ *
+ * A source file defines LOG_TAG before including this header and logs
+ * with LOGE, LOGI and LOGD. Messages above LOG_LEVEL (picked with
+ * ./configure --enable-logging[=error|info|debug]) are compiled out, the
+ * arguments are still type checked but never evaluated. Logging is off by
+ * default. Defining LOGE, LOGI or LOGD up front replaces the sink.
+ */
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#   define LOG_LEVEL LOG_LEVEL_NONE
+#endif
+
+#ifndef LOG_TAG
+#   define LOG_TAG "procs"
+#endif
+
+#define LOG_AT(level, letter, fmt, ...)                                        \
+    do {                                                                       \
+        if ((level) <= LOG_LEVEL)                                              \
+            fprintf(stderr, "[" LOG_TAG "][" letter "] " fmt "\n", ##__VA_ARGS__); \
+    } while (0)
+
+#ifndef LOGE
+#   define LOGE(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, "E", fmt, ##__VA_ARGS__)
+#endif
+#ifndef LOGI
+#   define LOGI(fmt, ...) LOG_AT(LOG_LEVEL_INFO, "I", fmt, ##__VA_ARGS__)
+#endif
+#ifndef LOGD
+#   define LOGD(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, "D", fmt, ##__VA_ARGS__)
+#endif
+
+#endif /* LOGGING_H_INCLUDED */
@@ -0,0 +1,392 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+#include "outputlog.h"
+#include "librarythread.h"
+
+#define LOG_TAG "OutputLog"
+#include "logging.h"
+
+#define OUTPUT_LOG_MIN_CAPACITY     1024
+/* read size of the reader thread */
+#define OUTPUT_LOG_CHUNK            4096
+
+/*
+ * The reader thread and the logs attached to it. The thread holds the
+ * mutex while it reads and runs hooks, so a log detached under it is
+ * never touched again.
+ */
+static pthread_once_t OutputLog_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t OutputLog_mutex = PTHREAD_MUTEX_INITIALIZER;
+static OutputLog **OutputLog_attached = NULL;
+static size_t OutputLog_count = 0;
+static size_t OutputLog_capacity = 0;
+/* self pipe telling the reader to pick up a changed set, -1 if none */
+static int OutputLog_wakeup[2] = { -1, -1 };
+static int OutputLog_started = 0;
+
+/* append data to the ring, dropping the oldest bytes beyond capacity */
+static
+void OutputLog_store(OutputLog *me, char const *data, size_t len) {
+    size_t offset = 0;
+    size_t n = 0;
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    if (len > me->data._M_capacity) {
+        me->data._M_size += len - me->data._M_capacity;
+        data += len - me->data._M_capacity;
+        len = me->data._M_capacity;
+    }
+    while (len > 0) {
+        offset = me->data._M_size % me->data._M_capacity;
+        n = me->data._M_capacity - offset;
+        n = n < len ? n : len;
+        memcpy(me->data._M_ring + offset, data, n);
+        me->data._M_size += n;
+        data += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+}
+
+/* hand complete lines of data to the hook, called with OutputLog_mutex held */
+static
+void OutputLog_split(OutputLog *me, char const *data, size_t len) {
+    size_t n = 0;
+    char const *newline = NULL;
+
+    while (len > 0) {
+        newline = (char const*) memchr(data, '\n', len);
+        n = newline ? (size_t) (newline - data) : len;
+        if (n > OUTPUT_LOG_MAX_LINE - me->data._M_line_len) {
+            n = OUTPUT_LOG_MAX_LINE - me->data._M_line_len;
+            newline = NULL;
+        }
+        memcpy(&me->data._M_line[me->data._M_line_len], data, n);
+        me->data._M_line_len += n;
+        data += n;
+        len -= n;
+        if (newline) {
+            ++data;
+            --len;
+        } else if (me->data._M_line_len < OUTPUT_LOG_MAX_LINE) {
+            /* the rest of it comes with the next read */
+            break;
+        }
+        me->data._M_line[me->data._M_line_len] = '\0';
+        me->data._M_hook(me->data._M_context, me, &me->data._M_line[0],
+                me->data._M_line_len);
+        me->data._M_line_len = 0;
+    }
+}
+
+/* remove a log from the attached set and close its pipe, mutex held */
+static
+void OutputLog_unlink(OutputLog *me) {
+    size_t i = 0;
+
+    for (i = 0; i < OutputLog_count; ++i) {
+        if (OutputLog_attached[i] == me) {
+            OutputLog_attached[i] = OutputLog_attached[--OutputLog_count];
+            break;
+        }
+    }
+    if (me->data._M_fd != -1) {
+        close(me->data._M_fd);
+        me->data._M_fd = -1;
+    }
+}
+
+/* read whatever the pipe of an attached log holds, mutex held */
+static
+void OutputLog_pump(OutputLog *me) {
+    ssize_t n = 0;
+    char buffer[OUTPUT_LOG_CHUNK];
+
+    for (;;) {
+        n = read(me->data._M_fd, &buffer[0], sizeof(buffer));
+        if (n > 0) {
+            OutputLog_store(me, &buffer[0], (size_t) n);
+            if (me->data._M_hook)
+                OutputLog_split(me, &buffer[0], (size_t) n);
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        break;
+    }
+    /* EOF or a broken pipe, a last partial line still goes to the hook */
+    if (me->data._M_hook && me->data._M_line_len > 0) {
+        me->data._M_line[me->data._M_line_len] = '\0';
+        me->data._M_hook(me->data._M_context, me, &me->data._M_line[0],
+                me->data._M_line_len);
+        me->data._M_line_len = 0;
+    }
+    pthread_mutex_lock(&me->data._M_mutex);
+    me->data._M_closed = 1;
+    pthread_mutex_unlock(&me->data._M_mutex);
+    OutputLog_unlink(me);
+}
+
+static
+void OutputLog_wake() {
+    char c = 0;
+    ssize_t unused = 0;
+
+    unused = write(OutputLog_wakeup[1], &c, 1);
+    (void) unused;
+}
+
+/* poll every attached pipe, forever */
+static
+void* OutputLog_run(void *arg) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    size_t capacity = 0;
+    char drain[64];
+    ssize_t unused = 0;
+    struct pollfd *pfds = NULL;
+    struct pollfd *p = NULL;
+    OutputLog **polled = NULL;
+    OutputLog **q = NULL;
+
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&OutputLog_mutex);
+        n = OutputLog_count;
+        if (n + 1 > capacity) {
+            p = (struct pollfd*) realloc(pfds, (n + 1) * sizeof(*pfds));
+            if (p)
+                pfds = p;
+            q = (OutputLog**) realloc(polled, (n + 1) * sizeof(*polled));
+            if (q)
+                polled = q;
+            if (p && q)
+                capacity = n + 1;
+            else
+                n = capacity > 0 ? capacity - 1 : 0;
+        }
+        for (i = 0; i < n; ++i) {
+            polled[i] = OutputLog_attached[i];
+            pfds[i + 1].fd = OutputLog_attached[i]->data._M_fd;
+            pfds[i + 1].events = POLLIN;
+            pfds[i + 1].revents = 0;
+        }
+        pthread_mutex_unlock(&OutputLog_mutex);
+        if (!pfds) {
+            /* no memory for even the wakeup entry, try again later */
+            usleep(10000);
+            continue;
+        }
+        pfds[0].fd = OutputLog_wakeup[0];
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+
+        if (poll(pfds, n + 1, -1) == -1)
+            continue;
+        if (pfds[0].revents)
+            unused = read(OutputLog_wakeup[0], &drain[0], sizeof(drain));
+        (void) unused;
+        pthread_mutex_lock(&OutputLog_mutex);
+        for (i = 0; i < n; ++i) {
+            if (!pfds[i + 1].revents)
+                continue;
+            /* skip logs detached in the meantime */
+            for (j = 0; j < OutputLog_count; ++j) {
+                if (OutputLog_attached[j] == polled[i]
+                        && polled[i]->data._M_fd == pfds[i + 1].fd)
+                    break;
+            }
+            if (j < OutputLog_count)
+                OutputLog_pump(polled[i]);
+        }
+        pthread_mutex_unlock(&OutputLog_mutex);
+    }
+    return NULL;
+}
+
+static
+void OutputLog_start() {
+    int rc = 0;
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if (pipe2(&OutputLog_wakeup[0], O_CLOEXEC | O_NONBLOCK) == -1) {
+        LOGE("wakeup pipe failed: %s", strerror(errno));
+        return;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = LibraryThread_create(&thread, &attr, &OutputLog_run, NULL);
+    if (rc != 0) {
+        LOGE("starting the reader thread failed");
+        close(OutputLog_wakeup[0]);
+        close(OutputLog_wakeup[1]);
+        OutputLog_wakeup[0] = OutputLog_wakeup[1] = -1;
+    } else {
+        OutputLog_started = 1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int OutputLog_attach(OutputLog *me, int fd) {
+    int rc = 0;
+    int flags = 0;
+    OutputLog **attached = NULL;
+
+    pthread_once(&OutputLog_once, &OutputLog_start);
+    pthread_mutex_lock(&OutputLog_mutex);
+    if (!OutputLog_started || me->data._M_fd != -1)
+        goto failure;
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        goto failure;
+    if (OutputLog_count == OutputLog_capacity) {
+        attached = (OutputLog**) realloc(OutputLog_attached,
+                (OutputLog_capacity * 2 + 8) * sizeof(*attached));
+        if (!attached)
+            goto failure;
+        OutputLog_attached = attached;
+        OutputLog_capacity = OutputLog_capacity * 2 + 8;
+    }
+    OutputLog_attached[OutputLog_count++] = me;
+    me->data._M_fd = fd;
+    fd = -1;
+    OutputLog_wake();
+
+    goto success;
+exit:
+    pthread_mutex_unlock(&OutputLog_mutex);
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    goto exit;
+}
+
+static
+char* OutputLog_tail(OutputLog const *me, size_t lines) {
+    char *r = NULL;
+    size_t start = 0;
+    size_t end = 0;
+    size_t i = 0;
+    size_t found = 0;
+    size_t n = 0;
+    OutputLog *self = (OutputLog*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    end = me->data._M_size;
+    start = end > me->data._M_capacity ? end - me->data._M_capacity : 0;
+    /* a newline ending the output does not start another line */
+    i = end;
+    if (i > start && me->data._M_ring[(i - 1) % me->data._M_capacity] == '\n')
+        --i;
+    for (; i > start && lines > 0; --i) {
+        if (me->data._M_ring[(i - 1) % me->data._M_capacity] == '\n'
+                && ++found == lines)
+            break;
+    }
+    if (lines == 0)
+        i = end;
+    r = (char*) malloc(end - i + 1);
+    if (r) {
+        for (n = 0; i < end; ++i, ++n)
+            r[n] = me->data._M_ring[i % me->data._M_capacity];
+        r[n] = '\0';
+    }
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+static
+void OutputLog_setHook(OutputLog *me, OutputLogHook hook, void *context) {
+    /* the reader runs hooks under this one */
+    pthread_mutex_lock(&OutputLog_mutex);
+    me->data._M_hook = hook;
+    me->data._M_context = context;
+    me->data._M_line_len = 0;
+    pthread_mutex_unlock(&OutputLog_mutex);
+}
+
+static
+size_t OutputLog_getSize(OutputLog const *me) {
+    size_t r = 0;
+    OutputLog *self = (OutputLog*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    r = me->data._M_size;
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+static
+int OutputLog_isClosed(OutputLog const *me) {
+    int r = 0;
+    OutputLog *self = (OutputLog*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    r = me->data._M_closed;
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+void OutputLog_destroy(OutputLog *me) {
+    if (me) {
+        pthread_mutex_lock(&OutputLog_mutex);
+        OutputLog_unlink(me);
+        if (OutputLog_started)
+            OutputLog_wake();
+        pthread_mutex_unlock(&OutputLog_mutex);
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me->data._M_ring);
+        me->data._M_ring = NULL;
+        free(me);
+    }
+}
+
+OutputLog* OutputLog_create(size_t capacity) {
+    OutputLog *instance = NULL;
+
+    instance = (OutputLog*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    if (capacity < OUTPUT_LOG_MIN_CAPACITY)
+        capacity = OUTPUT_LOG_MIN_CAPACITY;
+    instance->data._M_ring = (char*) malloc(capacity);
+    if (!instance->data._M_ring) {
+        free(instance);
+        return NULL;
+    }
+    instance->data._M_capacity = capacity;
+    instance->data._M_fd = -1;
+    pthread_mutex_init(&instance->data._M_mutex, NULL);
+    instance->calls.tail = &OutputLog_tail;
+    instance->calls.setHook = &OutputLog_setHook;
+    instance->calls.getSize = &OutputLog_getSize;
+    instance->calls.isClosed = &OutputLog_isClosed;
+    return instance;
+}
@@ -0,0 +1,83 @@
+#ifndef OUTPUTLOG_H_INCLUDED
+#define OUTPUTLOG_H_INCLUDED
+
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * The last output of a child process, captured through a pipe.
+     *
+     * Once attached to the read end of a pipe, a log is drained by one
+     * process wide reader thread that polls every attached pipe, so a
+     * child never blocks on a full pipe however many there are and nobody
+     * has to call anything to keep it going. The log keeps the last
+     * capacity bytes in a ring, older output is dropped. An optional hook
+     * sees every line as it is read, on the reader thread.
+     */
+
+    struct tagOutputLog;
+
+    typedef struct tagOutputLog OutputLog;
+
+    /*
+     * Called with every line of log, without its newline and NUL
+     * terminated, on the reader thread. Lines longer than
+     * OUTPUT_LOG_MAX_LINE come in pieces. It must not block for long nor
+     * destroy the log.
+     */
+    typedef void (*OutputLogHook)(void *context, OutputLog const *log,
+            char const *line, size_t len);
+
+    /* longest line a hook sees in one piece */
+#define OUTPUT_LOG_MAX_LINE 4096
+
+    struct tagOutputLog {
+        struct {
+            /*
+             * The last lines lines of output (a partial last line counts),
+             * a NUL terminated copy to free. NULL on allocation failure.
+             */
+            char*       (*tail)         (OutputLog const*, size_t lines);
+            void        (*setHook)      (OutputLog*, OutputLogHook, void *context);
+            /* bytes read so far, the dropped ones included */
+            size_t      (*getSize)      (OutputLog const*);
+            /* 1 once the writers closed the pipe and everything was read */
+            int         (*isClosed)     (OutputLog const*);
+        } calls;
+
+        struct {
+            /* ring of the last _M_capacity bytes, _M_size bytes went in */
+            char           *_M_ring;
+            size_t          _M_capacity;
+            size_t          _M_size;
+            /* line being assembled for the hook */
+            char            _M_line[OUTPUT_LOG_MAX_LINE + 1];
+            size_t          _M_line_len;
+            OutputLogHook   _M_hook;
+            void           *_M_context;
+            /* read end of the pipe while attached, -1 after */
+            int             _M_fd;
+            int             _M_closed;
+            /* guards the ring, tail may run on any thread */
+            pthread_mutex_t _M_mutex;
+        } data;
+    };
+
+    extern OutputLog*   OutputLog_create(size_t capacity);
+    /* detaches the log first, no hook runs once this returns */
+    extern void         OutputLog_destroy(OutputLog*);
+    /*
+     * Hand the read end of a pipe to the reader thread, the log owns fd
+     * from then on, whether this succeeds or not. Returns 1 on success.
+     */
+    extern int          OutputLog_attach(OutputLog*, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OUTPUTLOG_H_INCLUDED */
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/file.h>
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "portallocator.h"
+
+#define LOG_TAG "PortAllocator"
+#include "logging.h"
+
+#define PORT_ALLOCATOR_DEFAULT_FIRST    20000
+#define PORT_ALLOCATOR_DEFAULT_LAST     32767
+
+static pthread_once_t PortAllocator_once = PTHREAD_ONCE_INIT;
+static PortAllocator *PortAllocator_default = NULL;
+
+int PortAllocator_isFree(int port) {
+    int rc = 0;
+    int fd = -1;
+    int on = 1;
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        goto failure;
+    /* redis-server binds with SO_REUSEADDR as well, TIME_WAIT is no obstacle */
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short) port);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    goto exit;
+}
+
+void PortAllocator_release(int lease) {
+    if (lease != -1)
+        close(lease);
+}
+
+/* try to lease one port, returns the lock descriptor or -1 */
+static
+int PortAllocator_tryLease(PortAllocator const *me, int port) {
+    int fd = -1;
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%d.lock", me->data._M_lockdir, port);
+    fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        LOGE("open %s failed: %s", path, strerror(errno));
+        return -1;
+    }
+    /*
+     * read only is enough for flock and works on files created by other
+     * users, the lock belongs to the open file so threads conflict too
+     */
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1
+            || !PortAllocator_isFree(port)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static
+int PortAllocator_acquire(PortAllocator *me, int *lease) {
+    int port = 0;
+    int candidate = 0;
+    int fd = -1;
+    int i = 0;
+    int count = me->data._M_last - me->data._M_first + 1;
+
+    for (i = 0; i < count && fd == -1; ++i) {
+        pthread_mutex_lock(&me->data._M_mutex);
+        candidate = me->data._M_next;
+        me->data._M_next = candidate < me->data._M_last
+            ? candidate + 1
+            : me->data._M_first;
+        pthread_mutex_unlock(&me->data._M_mutex);
+        fd = PortAllocator_tryLease(me, candidate);
+    }
+    if (fd == -1) {
+        LOGE("no free port in %d-%d", me->data._M_first, me->data._M_last);
+        return 0;
+    }
+    port = candidate;
+    if (lease)
+        *lease = fd;
+    else
+        close(fd);
+    return port;
+}
+
+static
+int PortAllocator_lease(PortAllocator *me, int port, int *lease) {
+    int fd = -1;
+
+    if (port < 1 || port > 65535)
+        return 0;
+    fd = PortAllocator_tryLease(me, port);
+    if (fd == -1)
+        return 0;
+    if (lease)
+        *lease = fd;
+    else
+        close(fd);
+    return 1;
+}
+
+static
+char const* PortAllocator_getLockDir(PortAllocator const *me) {
+    return me->data._M_lockdir;
+}
+
+void PortAllocator_destroy(PortAllocator *me) {
+    if (me) {
+        if (me->data._M_lockdir) {
+            free(me->data._M_lockdir);
+            me->data._M_lockdir = NULL;
+        }
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me);
+    }
+}
+
+PortAllocator* PortAllocator_create(int first, int last, char const *lockdir) {
+    PortAllocator *r = NULL;
+    PortAllocator *allocator = NULL;
+    char const *base = NULL;
+    size_t size = 0;
+
+    if (first < 1 || last > 65535 || first > last)
+        goto failure;
+    allocator = (PortAllocator*) calloc(1, sizeof(*allocator));
+    if (!allocator)
+        goto failure;
+    pthread_mutex_init(&allocator->data._M_mutex, NULL);
+    allocator->calls.acquire = &PortAllocator_acquire;
+    allocator->calls.lease = &PortAllocator_lease;
+    allocator->calls.getLockDir = &PortAllocator_getLockDir;
+    allocator->data._M_first = first;
+    allocator->data._M_last = last;
+    /* spread processes over the range instead of all fighting for first */
+    allocator->data._M_next = first + (int) (getpid() % (last - first + 1));
+
+    if (lockdir) {
+        allocator->data._M_lockdir = strdup(lockdir);
+    } else {
+        base = getenv("TMPDIR");
+        if (!base || !*base)
+            base = "/tmp";
+        size = strlen(base) + sizeof("/redis-port-locks");
+        allocator->data._M_lockdir = (char*) malloc(size);
+        if (allocator->data._M_lockdir)
+            snprintf(allocator->data._M_lockdir, size, "%s/redis-port-locks", base);
+    }
+    if (!allocator->data._M_lockdir)
+        goto failure;
+    /* shared between users, sticky like /tmp itself */
+    if (mkdir(allocator->data._M_lockdir, 01777) == 0)
+        chmod(allocator->data._M_lockdir, 01777);
+    else if (errno != EEXIST) {
+        LOGE("mkdir %s failed: %s", allocator->data._M_lockdir, strerror(errno));
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = allocator;
+    allocator = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (allocator) {
+        PortAllocator_destroy(allocator);
+        allocator = NULL;
+    }
+    goto exit;
+}
+
+static
+void PortAllocator_createDefault() {
+    PortAllocator_default = PortAllocator_create(PORT_ALLOCATOR_DEFAULT_FIRST,
+            PORT_ALLOCATOR_DEFAULT_LAST, NULL);
+}
+
+PortAllocator* PortAllocator_getDefault() {
+    pthread_once(&PortAllocator_once, &PortAllocator_createDefault);
+    return PortAllocator_default;
+}
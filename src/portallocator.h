@@ -0,0 +1,68 @@
+#ifndef PORTALLOCATOR_H_INCLUDED
+#define PORTALLOCATOR_H_INCLUDED
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Hands out TCP ports that no other allocator on the same host holds.
+     *
+     * Every port of the range is guarded by a lock file in a shared
+     * directory. A port is leased by taking an exclusive flock on its
+     * file and bind-probing it, so concurrent harness processes never
+     * pick the same port and ports used by anybody else are skipped.
+     * A lease is a file descriptor, closing it (or exiting) frees the
+     * port again. Lock files are left in place on purpose, unlinking
+     * them would race with other processes locking them.
+     */
+
+    struct tagPortAllocator;
+
+    typedef struct tagPortAllocator PortAllocator;
+
+    struct tagPortAllocator {
+        struct {
+            /*
+             * Lease a free port, *lease receives the descriptor to pass
+             * to PortAllocator_release. Returns 0 when the range is
+             * exhausted. Thread safe.
+             */
+            int         (*acquire)      (PortAllocator*, int *lease);
+            /*
+             * Lease one given port, which may lie outside the range, e.g.
+             * the cluster bus port of an acquired one. Returns 1 on success.
+             */
+            int         (*lease)        (PortAllocator*, int port, int *lease);
+            char const* (*getLockDir)   (PortAllocator const*);
+        } calls;
+
+        struct {
+            int             _M_first;
+            int             _M_last;
+            /* next candidate, processes start at different offsets */
+            int             _M_next;
+            char           *_M_lockdir;
+            pthread_mutex_t _M_mutex;
+        } data;
+    };
+
+    /* lockdir NULL means $TMPDIR/redis-port-locks (or /tmp) */
+    extern PortAllocator*   PortAllocator_create(int first, int last, char const *lockdir);
+    extern void             PortAllocator_destroy(PortAllocator*);
+    /*
+     * Process wide allocator over 20000-32767, below the usual ephemeral
+     * range so that outgoing connections never occupy these ports.
+     */
+    extern PortAllocator*   PortAllocator_getDefault();
+    extern void             PortAllocator_release(int lease);
+    /* 1 if nobody listens on or binds port right now */
+    extern int              PortAllocator_isFree(int port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PORTALLOCATOR_H_INCLUDED */
@@ -1,33 +1,102 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
 
 #if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
 #   include <sys/types.h>
 #   include <sys/wait.h>
+#   include <sys/mman.h>
 #   include <unistd.h>
+#   include <spawn.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#   include <poll.h>
+#   include <time.h>
+#   include <sys/syscall.h>
+#   include <sys/prctl.h>
+#endif
+
+/* posix_spawn_file_actions_addchdir_np appeared in glibc 2.29 */
+#if defined(__GLIBC__) \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#   define PROCESS_HAVE_SPAWN_CHDIR 1
 #endif
 
+#define PROCESS_CLONE_STACK_SIZE (64 * 1024)
+/* MPOL_BIND of <linux/mempolicy.h>, stable kernel ABI */
+#define PROCESS_MPOL_BIND 2
+
 #include "processbuilder.h"
 
 extern char** environ;
 
-#ifndef LOGI
-#   define LOGI(fmt, ...)                                                      \
-    do {                                                                       \
-        fprintf(stderr, "[ProcessBuilder][I] " fmt "\n", ##__VA_ARGS__);        \
-    } while (0)
-#endif
+#define LOG_TAG "ProcessBuilder"
+#include "logging.h"
 
 static
 int Process_getPID(Process const *me) {
     return me->data._M_pid;
 }
 
+static
+int Process_getPidFD(Process const *me) {
+    return me->data._M_pidfd;
+}
+
+static
+int Process_getExitCode(Process const *me) {
+    return me->data._M_exitcode;
+}
+
+static
+int Process_getTermSignal(Process const *me) {
+    return me->data._M_signal;
+}
+
+static
+OutputLog* Process_getOutput(Process const *me) {
+    return me->data._M_output;
+}
+
+static
+int Process_getUsage(Process const *me, struct rusage *usage) {
+    if (!me->data._M_reaped)
+        return 0;
+    *usage = me->data._M_usage;
+    return 1;
+}
+
+static
+void Process_closePidFD(Process *me) {
+    if (me->data._M_pidfd != -1) {
+        close(me->data._M_pidfd);
+        me->data._M_pidfd = -1;
+    }
+}
+
 static
 Process* Process_setPID(Process *me, int value) {
+    Process_closePidFD(me);
     me->data._M_pid = value;
+    me->data._M_exitcode = -1;
+    me->data._M_signal = 0;
+    me->data._M_reaped = 0;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    /* race free: the child can not be reaped by anybody but us */
+    if (value > 0)
+        me->data._M_pidfd = (int) syscall(SYS_pidfd_open, (pid_t) value, 0);
+#endif
     return me;
 }
 
@@ -40,12 +109,10 @@ int Process_kill0(Process *me, int sig) {
         goto success;
 
     retcode = kill((pid_t) me->data._M_pid, sig);
-    LOGI("kill(pid = %d, sig = %ld) = %d",
+    LOGD("kill(pid = %d, sig = %ld) = %d",
             me->data._M_pid, (long) sig, retcode);
     if (retcode == -1)
         goto failure;
-    if (sig == SIGKILL)
-        me->data._M_pid = -1;
 
     goto success;
 exit:
@@ -70,29 +137,38 @@ int Process_wait0(Process *me, int options, int *exitcode) {
     int rc = 0;
     int status = 0;
     pid_t pid = -1;
+    struct rusage usage;
 
     if (me->data._M_pid < 0)
         goto success;
 
     do {
-        pid = waitpid((pid_t) me->data._M_pid, &status, options);
-        LOGI("waitpid(pid = %d, status = %p (%d), options = %d) = %d",
+        /* waitpid that also tells what the child cost */
+        pid = wait4((pid_t) me->data._M_pid, &status, options, &usage);
+        LOGD("wait4(pid = %d, status = %p (%d), options = %d) = %d",
                 (int) me->data._M_pid,
                 &status, status,
                 options,
                 pid);
         if ((int) pid == -1) {
-            perror("waitpid");
+            LOGE("wait4(pid = %d) failed: %s", (int) me->data._M_pid,
+                    strerror(errno));
             goto failure;
         }
     } while (!WIFEXITED(status) && !WIFSIGNALED(status));
 
     if (!((options & WNOHANG) == WNOHANG && pid == 0)) {
         if (WIFEXITED(status)) {
+            me->data._M_exitcode = WEXITSTATUS(status);
             if (exitcode)
                 *exitcode = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            me->data._M_signal = WTERMSIG(status);
         }
+        me->data._M_usage = usage;
+        me->data._M_reaped = 1;
         me->data._M_pid = -1;
+        Process_closePidFD(me);
     } else
         goto failure;
 
@@ -115,10 +191,65 @@ int Process_wait(Process *me, int *exitcode) {
     return Process_wait0(me, 0, exitcode);
 }
 
+static
+long Process_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static
+int Process_waitFor(Process *me, long timeout_ms, int *exitcode) {
+    long deadline = 0;
+    long remaining = 0;
+    long delay = 1;
+    struct pollfd pfd;
+    struct timespec ts;
+    int n = 0;
+
+    if (me->data._M_pid < 0 || timeout_ms < 0)
+        return Process_wait0(me, 0, exitcode);
+
+    deadline = Process_now() + timeout_ms;
+    if (me->data._M_pidfd != -1) {
+        /* the pidfd becomes readable once the child terminated */
+        pfd.fd = me->data._M_pidfd;
+        pfd.events = POLLIN;
+        do {
+            remaining = deadline - Process_now();
+            pfd.revents = 0;
+            n = poll(&pfd, 1, (int) (remaining > 0 ? remaining : 0));
+        } while (n == -1 && errno == EINTR);
+        if (n != 1)
+            return 0;
+        return Process_wait0(me, 0, exitcode);
+    }
+
+    /* no pidfd (old kernel), poll with backoff */
+    for (;;) {
+        if (Process_wait0(me, WNOHANG, exitcode))
+            return 1;
+        remaining = deadline - Process_now();
+        if (remaining <= 0)
+            return 0;
+        if (delay > remaining)
+            delay = remaining;
+        ts.tv_sec = delay / 1000L;
+        ts.tv_nsec = (delay % 1000L) * 1000000L;
+        nanosleep(&ts, NULL);
+        delay = delay * 2 < 50 ? delay * 2 : 50;
+    }
+}
+
 void Process_destroy(Process *me) {
     if (me) {
         me->calls.kill(me);
         me->calls.wait(me, NULL);
+        Process_closePidFD(me);
+        if (me->data._M_output) {
+            OutputLog_destroy(me->data._M_output);
+            me->data._M_output = NULL;
+        }
         free(me);
         me = NULL;
     }
@@ -132,8 +263,18 @@ Process* Process_create() {
     if (!instance)
         goto failure;
 
+    instance->data._M_pid = -1;
+    instance->data._M_pidfd = -1;
+    instance->data._M_exitcode = -1;
+
     instance->calls.getPID = &Process_getPID;
     instance->calls.setPID = &Process_setPID;
+    instance->calls.getPidFD = &Process_getPidFD;
+    instance->calls.getExitCode = &Process_getExitCode;
+    instance->calls.getTermSignal = &Process_getTermSignal;
+    instance->calls.getOutput = &Process_getOutput;
+    instance->calls.getUsage = &Process_getUsage;
+    instance->calls.waitFor = &Process_waitFor;
     instance->calls.kill0 = &Process_kill0;
     instance->calls.kill = &Process_kill;
     instance->calls.wait0 = &Process_wait0;
@@ -156,6 +297,54 @@ cleanup:
     goto exit;
 }
 
+char const* ProcessBuilder_getStepString(int step) {
+    switch (step) {
+        case PROCESS_STEP_NONE:
+            return "none";
+        case PROCESS_STEP_SPAWN:
+            return "spawn";
+        case PROCESS_STEP_GROUP:
+            return "group";
+        case PROCESS_STEP_REDIRECT:
+            return "redirect";
+        case PROCESS_STEP_PLACEMENT:
+            return "placement";
+        case PROCESS_STEP_CHDIR:
+            return "chdir";
+        case PROCESS_STEP_EXEC:
+            return "execve";
+        default:
+            break;
+    }
+    return "<UNKNOWN>";
+}
+
+static
+ProcessBuilder* ProcessBuilder_setSpawnMode(ProcessBuilder *me, int mode) {
+    switch (mode) {
+        case PROCESS_SPAWN_FORK:
+        case PROCESS_SPAWN_VFORK:
+        case PROCESS_SPAWN_POSIX_SPAWN:
+        case PROCESS_SPAWN_CLONE:
+            me->data._M_spawn_mode = mode;
+            return me;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+static
+int ProcessBuilder_getSpawnMode(ProcessBuilder const *me) {
+    return me->data._M_spawn_mode;
+}
+
+static
+ProcessBuilder* ProcessBuilder_setStats(ProcessBuilder *me, LifecycleStats *stats) {
+    me->data._M_stats = stats;
+    return me;
+}
+
 static
 char const* ProcessBuilder_getPath(ProcessBuilder const *me) {
     return me->data._M_path;
@@ -168,12 +357,15 @@ char const* ProcessBuilder_getFile(ProcessBuilder const *me) {
 
 static
 char const** ProcessBuilder_getArguments(ProcessBuilder const *me) {
-    return (char const**) me->data._M_arguments;
+    /* behind argv[0] */
+    return me->data._M_argv->calls.getArray(me->data._M_argv) + 1;
 }
 
 static
 char const** ProcessBuilder_getEnvironments(ProcessBuilder const *me) {
-    return (char const**) me->data._M_environments;
+    if (!me->data._M_envp)
+        return NULL;
+    return me->data._M_envp->calls.getArray(me->data._M_envp);
 }
 
 static
@@ -218,6 +410,9 @@ ProcessBuilder* ProcessBuilder_setFile(ProcessBuilder *me, char const *value) {
     if (!value)
         goto failure;
 
+    /* argv[0] first, nothing changes if that fails */
+    if (!me->data._M_argv->calls.replace(me->data._M_argv, 0, value, len))
+        goto failure;
     p = (char*) realloc(me->data._M_file, len + 1);
     if (!p)
         goto failure;
@@ -242,64 +437,161 @@ cleanup:
     goto exit;
 }
 
-static
-size_t ProcessBuilder_countof(char const **values) {
-    size_t n = 0;
-    if (values) {
-        for (; *values; ++values)
-            ++n;
-    }
-    return n;
+size_t ProcessBuilder_getArgumentsCount(ProcessBuilder const *me) {
+    return me->data._M_argv->calls.getCount(me->data._M_argv) - 1;
 }
 
+size_t ProcessBuilder_getEnvironmentsCount(ProcessBuilder const *me) {
+    if (!me->data._M_envp)
+        return 0;
+    return me->data._M_envp->calls.getCount(me->data._M_envp);
+}
+
+/* replace everything but argv[0] */
 static
-void ProcessBuilder_freeValues(char **values) {
-    char **p = NULL;
-    for (p = values; *p; ++p)
-        free((void*) *p);
-    free(values);
+ProcessBuilder* ProcessBuilder_setArguments(ProcessBuilder *me, char const **values) {
+    StringArena *argv = me->data._M_argv;
+
+    while (argv->calls.getCount(argv) > 1)
+        argv->calls.remove(argv, argv->calls.getCount(argv) - 1);
+    for (; values && *values; ++values) {
+        if (!argv->calls.append(argv, *values, strlen(*values)))
+            return NULL;
+    }
+    return me;
 }
 
-size_t ProcessBuilder_getArgumentsCount(ProcessBuilder const *me) {
-    return ProcessBuilder_countof((char const**) me->data._M_arguments);
+static
+ProcessBuilder* ProcessBuilder_addArgument(ProcessBuilder *me, char const *value) {
+    if (!value || !me->data._M_argv->calls.append(me->data._M_argv, value,
+                strlen(value)))
+        return NULL;
+    return me;
 }
 
-size_t ProcessBuilder_getEnvironmentsCount(ProcessBuilder const *me) {
-    return ProcessBuilder_countof((char const**) me->data._M_environments);
+static
+ProcessBuilder* ProcessBuilder_setEnvironments(ProcessBuilder *me, char const **values) {
+    if (!values) {
+        StringArena_destroy(me->data._M_envp);
+        me->data._M_envp = NULL;
+        return me;
+    }
+    if (!me->data._M_envp) {
+        me->data._M_envp = StringArena_create();
+        if (!me->data._M_envp)
+            return NULL;
+    }
+    me->data._M_envp->calls.clear(me->data._M_envp);
+    for (; *values; ++values) {
+        if (!me->data._M_envp->calls.append(me->data._M_envp, *values,
+                    strlen(*values)))
+            return NULL;
+    }
+    return me;
 }
 
 static
-ProcessBuilder* ProcessBuilder_setArguments(ProcessBuilder *me, char const **values) {
-    ProcessBuilder *r = NULL;
+ProcessBuilder* ProcessBuilder_putEnvironment(ProcessBuilder *me,
+        char const *name, char const *value) {
     size_t i = 0;
     size_t n = 0;
     size_t len = 0;
+    char const *entry = NULL;
+    StringArena *envp = NULL;
+
+    if (!name || !*name || strchr(name, '='))
+        return NULL;
+    /* the first change starts from the inherited environment */
+    if (!me->data._M_envp
+            && !ProcessBuilder_setEnvironments(me, (char const**) environ))
+        return NULL;
+    envp = me->data._M_envp;
+    len = strlen(name);
+    n = envp->calls.getCount(envp);
+    for (i = 0; i < n; ++i) {
+        entry = envp->calls.get(envp, i);
+        if (strncmp(entry, name, len) == 0 && entry[len] == '=')
+            break;
+    }
+    /* a changed variable moves to the end, the order does not matter */
+    if (i < n)
+        envp->calls.remove(envp, i);
+    if (value && !envp->calls.concat(envp, name, "=", value, NULL))
+        return NULL;
+    return me;
+}
 
-    size_t count = 0;
-    char **args = NULL;
-    char *val = NULL;
-
-    count = ProcessBuilder_countof(values);
+int ProcessBuilder_parseCPUList(char const *list, int *cpus, int n) {
+    int count = 0;
+    long first = 0;
+    long last = 0;
+    char *end = NULL;
+
+    if (!list)
+        return -1;
+    for (;;) {
+        if (*list < '0' || *list > '9')
+            return -1;
+        first = strtol(list, &end, 10);
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            if (*list < '0' || *list > '9')
+                return -1;
+            last = strtol(list, &end, 10);
+        }
+        if (first > last || last >= PROCESS_MAX_CPUS)
+            return -1;
+        for (; first <= last; ++first, ++count) {
+            if (count < n)
+                cpus[count] = (int) first;
+        }
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            return -1;
+        list = end + 1;
+    }
+    return count;
+}
 
-    /* FIXME TODO Should the first element be empty? */
-    args = (char**) realloc(me->data._M_arguments, sizeof(*args) * (count + 1));
-    if (!args)
-        goto failure;
-    me->data._M_arguments = NULL;
-    memset(args, 0, sizeof(*args) * (count + 1));
+static
+ProcessBuilder* ProcessBuilder_setAffinity(ProcessBuilder *me, char const *cpulist) {
+#if defined(__linux__)
+    int i = 0;
+    int n = 0;
+    int max = 0;
+    int *cpus = NULL;
+    cpu_set_t *set = NULL;
+    ProcessBuilder *r = NULL;
 
-    for (i = 0, n = count; i < n; ++i) {
-        len = strlen(values[i]);
-        val = (char*) realloc(args[i], len + 1);
-        if (!val)
-            goto failure;
-        strncpy(val, values[i], len + 1);
-        args[i] = val;
-        val = NULL;
+    if (!cpulist) {
+        if (me->data._M_cpuset)
+            CPU_FREE((cpu_set_t*) me->data._M_cpuset);
+        me->data._M_cpuset = NULL;
+        me->data._M_cpuset_size = 0;
+        return me;
     }
-
-    me->data._M_arguments = args;
-    args = NULL;
+    n = ProcessBuilder_parseCPUList(cpulist, NULL, 0);
+    if (n < 1)
+        goto failure;
+    cpus = (int*) malloc(n * sizeof(*cpus));
+    if (!cpus)
+        goto failure;
+    ProcessBuilder_parseCPUList(cpulist, cpus, n);
+    for (i = 0; i < n; ++i)
+        max = cpus[i] > max ? cpus[i] : max;
+    set = CPU_ALLOC(max + 1);
+    if (!set)
+        goto failure;
+    CPU_ZERO_S(CPU_ALLOC_SIZE(max + 1), set);
+    for (i = 0; i < n; ++i)
+        CPU_SET_S(cpus[i], CPU_ALLOC_SIZE(max + 1), set);
+    if (me->data._M_cpuset)
+        CPU_FREE((cpu_set_t*) me->data._M_cpuset);
+    me->data._M_cpuset = set;
+    me->data._M_cpuset_size = CPU_ALLOC_SIZE(max + 1);
+    set = NULL;
 
     goto success;
 exit:
@@ -308,154 +600,574 @@ success:
     r = me;
     goto cleanup;
 failure:
+    LOGE("invalid cpu list %s", cpulist);
     goto cleanup;
 cleanup:
-    if (args) {
-        ProcessBuilder_freeValues(args);
-        args = NULL;
+    if (set) {
+        CPU_FREE(set);
+        set = NULL;
+    }
+    if (cpus) {
+        free(cpus);
+        cpus = NULL;
     }
     goto exit;
+#else
+    return cpulist ? NULL : me;
+#endif
 }
 
 static
-ProcessBuilder* ProcessBuilder_setEnvironments(ProcessBuilder *me, char const **values) {
-    ProcessBuilder *r = NULL;
-    size_t i = 0;
-    size_t n = 0;
+ProcessBuilder* ProcessBuilder_setMemoryNode(ProcessBuilder *me, int node) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    if (node < -1 || node >= PROCESS_MAX_NODES)
+        return NULL;
+    me->data._M_memory_node = node;
+    return me;
+#else
+    return node == -1 ? me : NULL;
+#endif
+}
+
+static
+ProcessBuilder* ProcessBuilder_setProcessGroup(ProcessBuilder *me, int pgid) {
+    if (pgid < -1)
+        return NULL;
+    me->data._M_pgid = pgid;
+    return me;
+}
+
+static
+ProcessBuilder* ProcessBuilder_setParentDeathSignal(ProcessBuilder *me, int sig) {
+#if defined(__linux__)
+    if (sig < 0 || sig >= NSIG)
+        return NULL;
+    me->data._M_death_signal = sig;
+    return me;
+#else
+    return sig == 0 ? me : NULL;
+#endif
+}
+
+static
+ProcessBuilder* ProcessBuilder_setControlGroup(ProcessBuilder *me, char const *dir) {
+#if defined(__linux__)
     size_t len = 0;
+    char *p = NULL;
 
-    size_t count = 0;
-    char **args = NULL;
-    char *val = NULL;
+    if (!dir) {
+        free(me->data._M_cgroup_procs);
+        me->data._M_cgroup_procs = NULL;
+        return me;
+    }
+    len = strlen(dir) + sizeof("/cgroup.procs");
+    p = (char*) malloc(len);
+    if (!p)
+        return NULL;
+    snprintf(p, len, "%s/cgroup.procs", dir);
+    free(me->data._M_cgroup_procs);
+    me->data._M_cgroup_procs = p;
+    return me;
+#else
+    return dir ? NULL : me;
+#endif
+}
 
-    count = ProcessBuilder_countof(values);
+static
+ProcessBuilder* ProcessBuilder_setOutput(ProcessBuilder *me, int mode, char const *path) {
+    char *p = NULL;
 
-    /* FIXME TODO Should the first element be empty? */
-    args = (char**) realloc(me->data._M_environments, sizeof(char*) * count + 1);
-    if (!args)
-        goto failure;
-    memset(args, 0, sizeof(*args) * (count + 1));
+    switch (mode) {
+        case PROCESS_OUTPUT_INHERIT:
+        case PROCESS_OUTPUT_NULL:
+        case PROCESS_OUTPUT_CAPTURE:
+            break;
+        case PROCESS_OUTPUT_FILE:
+            if (!path || !*path)
+                return NULL;
+            p = strdup(path);
+            if (!p)
+                return NULL;
+            break;
+        default:
+            return NULL;
+    }
+    free(me->data._M_output_path);
+    me->data._M_output_path = p;
+    me->data._M_output = mode;
+    return me;
+}
 
-    for (i = 0, n = count; i < n; ++i) {
-        len = strlen(values[i]);
-        val = (char*) realloc(args[i], len + 1);
-        if (!val)
-            goto failure;
-        strncpy(val, values[i], len + 1);
-        args[i] = val;
-        val = NULL;
+static
+ProcessBuilder* ProcessBuilder_setOutputHook(ProcessBuilder *me,
+        OutputLogHook hook, void *context) {
+    me->data._M_output_hook = hook;
+    me->data._M_output_context = context;
+    return me;
+}
+
+/*
+ * Open what stdout and stderr of the child go to, *fd receives the end the
+ * child writes to and *capture the read end of a capture pipe.
+ */
+static
+int ProcessBuilder_openOutput(ProcessBuilder const *me, int *fd, int *capture) {
+    int fds[2] = { -1, -1 };
+    size_t len = 0;
+    char *path = NULL;
+    char const *file = me->data._M_output_path;
+
+    switch (me->data._M_output) {
+        case PROCESS_OUTPUT_NULL:
+            *fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+            return *fd != -1;
+        case PROCESS_OUTPUT_FILE:
+            /* relative to the child's working directory, as it would open it */
+            if (file[0] != '/' && me->data._M_path) {
+                len = strlen(me->data._M_path) + strlen(file) + 2;
+                path = (char*) malloc(len);
+                if (!path)
+                    return 0;
+                snprintf(path, len, "%s/%s", me->data._M_path, file);
+                file = path;
+            }
+            *fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            free(path);
+            return *fd != -1;
+        case PROCESS_OUTPUT_CAPTURE:
+            if (pipe2(&fds[0], O_CLOEXEC) == -1)
+                return 0;
+            *capture = fds[0];
+            *fd = fds[1];
+            return 1;
+        default:
+            break;
     }
+    return 1;
+}
 
-    me->data._M_environments = args;
-    args = NULL;
+/*
+ * Everything the child needs between spawn and exec. It lives on the
+ * parent's stack, the vfork and clone backends share it with the child.
+ */
+typedef struct tagProcessSpawn {
+    char const *pwd;
+    char      **args;
+    char      **envs;
+    /* placement, applied to the child before exec */
+    void const *cpuset;
+    size_t      cpuset_size;
+    int         node;
+    /* process group to join, -1 for none */
+    int         pgid;
+    int         death_signal;
+    /* the parent, a child with a death signal outliving it must not exec */
+    pid_t       parent;
+    /* cgroup.procs of the group to join, opened by the parent, -1 for none */
+    int         cgroupfd;
+    /* what stdout and stderr become, -1 to keep ours */
+    int         outfd;
+    sigset_t    oldmask;
+    /* write end of the CLOEXEC error pipe, -1 if there is none */
+    int         errfd;
+    /* failure reported by the backend itself (posix_spawn) */
+    int         step;
+    int         error;
+} ProcessSpawn;
+
+/* what a failing child writes into the error pipe */
+typedef struct tagProcessSpawnError {
+    int step;
+    int error;
+} ProcessSpawnError;
 
-    goto success;
-exit:
-    return r;
-success:
-    r = me;
-    goto cleanup;
-failure:
-    goto cleanup;
-cleanup:
-    if (args) {
-        ProcessBuilder_freeValues(args);
-        args = NULL;
+static
+void ProcessBuilder_childFail(ProcessSpawn *spawn, int step) {
+    /* only async-signal-safe calls here, memory may be shared with parent */
+    ProcessSpawnError report;
+    ssize_t unused = 0;
+
+    report.step = step;
+    report.error = errno;
+    if (spawn->errfd != -1)
+        unused = write(spawn->errfd, &report, sizeof(report));
+    (void) unused;
+    _exit(1);
+}
+
+/* bind the memory of the calling thread to node, inherited over exec */
+static
+int ProcessBuilder_bindMemory(int node) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    unsigned long mask[PROCESS_MAX_NODES / (8 * sizeof(unsigned long))];
+
+    memset(&mask[0], 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    /* the kernel reads maxnode - 1 bits */
+    return (int) syscall(SYS_set_mempolicy, PROCESS_MPOL_BIND, &mask[0],
+            sizeof(mask) * 8 + 1);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* runs in the child, never returns */
+static
+int ProcessBuilder_exec(void *arg) {
+    ProcessSpawn *spawn = (ProcessSpawn*) arg;
+    struct sigaction sa;
+    int sig = 0;
+
+    /* handlers of the parent must not run in a child sharing its memory */
+    memset(&sa, 0, sizeof(sa));
+    for (sig = 1; sig < NSIG; ++sig) {
+        if (sigaction(sig, NULL, &sa) == 0
+                && sa.sa_handler != SIG_IGN
+                && sa.sa_handler != SIG_DFL) {
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, NULL);
+        }
     }
-    goto exit;
+    sigprocmask(SIG_SETMASK, &spawn->oldmask, NULL);
+
+#if defined(__linux__)
+    /* "0" moves the writer, first thing so all it allocates is charged there */
+    if (spawn->cgroupfd != -1 && write(spawn->cgroupfd, "0", 1) != 1)
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_GROUP);
+    if (spawn->death_signal) {
+        if (prctl(PR_SET_PDEATHSIG, (unsigned long) spawn->death_signal) != 0)
+            ProcessBuilder_childFail(spawn, PROCESS_STEP_GROUP);
+        /* a parent gone before prctl never sends it, nobody would reap us */
+        if (getppid() != spawn->parent)
+            _exit(1);
+    }
+#endif
+    if (spawn->pgid != -1 && setpgid(0, (pid_t) spawn->pgid) != 0)
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_GROUP);
+    /* dup2 clears CLOEXEC of the copies, the original goes with exec */
+    if (spawn->outfd != -1 && (dup2(spawn->outfd, STDOUT_FILENO) == -1
+                || dup2(spawn->outfd, STDERR_FILENO) == -1))
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_REDIRECT);
+#if defined(__linux__)
+    /* the child is a task of its own even when it shares our memory */
+    if (spawn->cpuset && sched_setaffinity(0, spawn->cpuset_size,
+                (cpu_set_t const*) spawn->cpuset) != 0)
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_PLACEMENT);
+#endif
+    if (spawn->node != -1 && ProcessBuilder_bindMemory(spawn->node) != 0)
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_PLACEMENT);
+    if (spawn->pwd && chdir(spawn->pwd) != 0)
+        ProcessBuilder_childFail(spawn, PROCESS_STEP_CHDIR);
+    execve(spawn->args[0], spawn->args, spawn->envs);
+    ProcessBuilder_childFail(spawn, PROCESS_STEP_EXEC);
+    return 1;
+}
+
+static
+pid_t ProcessBuilder_spawnFork(ProcessSpawn *spawn) {
+    pid_t pid = fork();
+    if (pid == 0)
+        ProcessBuilder_exec(spawn);
+    else if (pid == -1)
+        spawn->error = errno;
+    return pid;
+}
+
+static
+pid_t ProcessBuilder_spawnVFork(ProcessSpawn *spawn) {
+    pid_t pid = vfork();
+    if (pid == 0)
+        ProcessBuilder_exec(spawn);
+    else if (pid == -1)
+        spawn->error = errno;
+    return pid;
+}
+
+/* 1 if posix_spawn can set up the child, placement and cgroups it can not */
+static
+int ProcessBuilder_canSpawnPosix(ProcessSpawn const *spawn) {
+    return !spawn->cpuset && spawn->node == -1 && !spawn->death_signal
+        && spawn->cgroupfd == -1;
+}
+
+static
+pid_t ProcessBuilder_spawnPosix(ProcessSpawn *spawn) {
+    pid_t pid = -1;
+    int error = 0;
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+
+    if (!ProcessBuilder_canSpawnPosix(spawn))
+        return ProcessBuilder_spawnVFork(spawn);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &spawn->oldmask);
+    if (spawn->pgid != -1) {
+        posix_spawnattr_setpgroup(&attr, (pid_t) spawn->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    if (spawn->outfd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, spawn->outfd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, spawn->outfd, STDERR_FILENO);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    if (spawn->pwd) {
+#if defined(PROCESS_HAVE_SPAWN_CHDIR)
+        posix_spawn_file_actions_addchdir_np(&actions, spawn->pwd);
+#else
+        /* no way to chdir between spawn and exec, take the vfork path */
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        return ProcessBuilder_spawnVFork(spawn);
+#endif
+    }
+    /* glibc reports chdir and execve failures of the child right here */
+    error = posix_spawn(&pid, spawn->args[0], &actions, &attr,
+            spawn->args, spawn->envs);
+    if (error != 0) {
+        spawn->step = PROCESS_STEP_EXEC;
+        spawn->error = error;
+        pid = -1;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+static
+pid_t ProcessBuilder_spawnClone(ProcessSpawn *spawn) {
+#if defined(__linux__)
+    pid_t pid = -1;
+    void *stack = NULL;
+
+    /* the child only runs chdir and execve on it */
+    stack = mmap(NULL, PROCESS_CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        spawn->error = errno;
+        return -1;
+    }
+    /* CLONE_VFORK suspends us until the child has exec'ed or exited */
+    pid = clone(&ProcessBuilder_exec,
+            (char*) stack + PROCESS_CLONE_STACK_SIZE,
+            CLONE_VM | CLONE_VFORK | SIGCHLD, spawn);
+    if (pid == -1)
+        spawn->error = errno;
+    munmap(stack, PROCESS_CLONE_STACK_SIZE);
+    return pid;
+#else
+    return ProcessBuilder_spawnVFork(spawn);
+#endif
+}
+
+/*
+ * Wait for the child to exec. The write end of the error pipe is closed by
+ * a successful execve (CLOEXEC), so EOF means success and a report means
+ * the child failed before exec.
+ */
+static
+int ProcessBuilder_readReport(int fd, ProcessSpawnError *report) {
+    ssize_t n = 0;
+    size_t got = 0;
+
+    while (got < sizeof(*report)) {
+        n = read(fd, (char*) report + got, sizeof(*report) - got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += (size_t) n;
+    }
+    return got == sizeof(*report);
 }
 
 static
-pid_t ProcessBuilder_runProcess(char const *pwd, char **args, char **envs) {
+pid_t ProcessBuilder_runProcess(ProcessBuilder const *me, char **args,
+        char **envs, int *output, int *step, int *error) {
     pid_t pid = -1;
-    int exitcode = 0;
     char **p = NULL;
     char* empty[] = { NULL };
+    char const *pwd = me->data._M_path;
+    int fds[2] = { -1, -1 };
+    int capture = -1;
+    int status = 0;
+    long started = 0;
+    long spawned = 0;
+    LifecycleStats *stats = me->data._M_stats;
+    ProcessSpawn spawn;
+    ProcessSpawnError report;
+    sigset_t all;
 
     /* eliminate NULL pointers which may failed on platforms other than linux */
     args = args ? args : empty;
     envs = envs ? envs : environ;
     char cwd[FILENAME_MAX + 1];
 
-    if (!getcwd(&cwd[0], sizeof(cwd)))
+    memset(&spawn, 0, sizeof(spawn));
+    spawn.pwd = pwd;
+    spawn.args = args;
+    spawn.envs = envs;
+    spawn.cpuset = me->data._M_cpuset;
+    spawn.cpuset_size = me->data._M_cpuset_size;
+    spawn.node = me->data._M_memory_node;
+    spawn.pgid = me->data._M_pgid;
+    spawn.death_signal = me->data._M_death_signal;
+    spawn.parent = getpid();
+    spawn.cgroupfd = -1;
+    spawn.outfd = -1;
+    spawn.errfd = -1;
+    spawn.step = PROCESS_STEP_SPAWN;
+
+    if (!getcwd(&cwd[0], sizeof(cwd))) {
+        spawn.error = errno;
         goto failure;
-    LOGI("running %s in %s with options as following", args[0], pwd ? pwd : cwd);
+    }
+    LOGD("running %s in %s with options as following", args[0], pwd ? pwd : cwd);
     for (p = args; *p; ++p)
-        LOGI("arguments[%d] = %s", (int) (p - args), *p);
+        LOGD("arguments[%d] = %s", (int) (p - args), *p);
     for (p = envs; *p; ++p)
-        LOGI("environments[%d] = %s", (int) (p - envs), *p);
-    pid = fork();
-    if ((int) pid == 0) {
-        /* running in child process */
-        if (pwd) {
-            if (chdir(pwd) != 0) {
-                /* FIXME TODO Notify parent process chdir failed */
-                perror("chdir");
-                goto failure;
-            }
+        LOGD("environments[%d] = %s", (int) (p - envs), *p);
+
+    if (me->data._M_cgroup_procs) {
+        spawn.cgroupfd = open(me->data._M_cgroup_procs, O_WRONLY | O_CLOEXEC);
+        if (spawn.cgroupfd == -1) {
+            spawn.step = PROCESS_STEP_GROUP;
+            spawn.error = errno;
+            goto failure;
         }
-        if (execve(args[0], args, envs) == -1) {
-            perror("execve");
+    }
+    if (!ProcessBuilder_openOutput(me, &spawn.outfd, &capture)) {
+        spawn.step = PROCESS_STEP_REDIRECT;
+        spawn.error = errno;
+        goto failure;
+    }
+    /* posix_spawn with a placement or a cgroup takes the vfork path */
+    if (me->data._M_spawn_mode != PROCESS_SPAWN_POSIX_SPAWN
+            || !ProcessBuilder_canSpawnPosix(&spawn)) {
+        if (pipe2(&fds[0], O_CLOEXEC) == -1) {
+            spawn.error = errno;
             goto failure;
         }
-    } else if (pid == -1) {
-        perror("fork");
+        spawn.errfd = fds[1];
+    }
+
+    /* no signal handler may run in the child before exec */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &spawn.oldmask);
+    if (stats)
+        started = LifecycleStats_now();
+    switch (me->data._M_spawn_mode) {
+        case PROCESS_SPAWN_VFORK:
+            pid = ProcessBuilder_spawnVFork(&spawn);
+            break;
+        case PROCESS_SPAWN_POSIX_SPAWN:
+            pid = ProcessBuilder_spawnPosix(&spawn);
+            break;
+        case PROCESS_SPAWN_CLONE:
+            pid = ProcessBuilder_spawnClone(&spawn);
+            break;
+        case PROCESS_SPAWN_FORK:
+        default:
+            pid = ProcessBuilder_spawnFork(&spawn);
+            break;
+    }
+    if (stats)
+        spawned = LifecycleStats_now();
+    pthread_sigmask(SIG_SETMASK, &spawn.oldmask, NULL);
+    if (pid == -1)
         goto failure;
+    if (stats)
+        stats->calls.record(stats, LIFECYCLE_SPAN_FORK, spawned - started);
+
+    if (fds[1] != -1) {
+        close(fds[1]);
+        fds[1] = -1;
+        if (ProcessBuilder_readReport(fds[0], &report)) {
+            spawn.step = report.step;
+            spawn.error = report.error;
+            /* the child is already gone, reap it */
+            while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+                ;
+            pid = -1;
+            goto failure;
+        }
+        /* the other backends are past exec once they return */
+        if (stats && me->data._M_spawn_mode == PROCESS_SPAWN_FORK)
+            stats->calls.record(stats, LIFECYCLE_SPAN_EXEC,
+                    LifecycleStats_now() - spawned);
     }
 
     goto success;
 exit:
-    if (pid == 0)
-        _exit(exitcode);
+    if (fds[0] != -1) {
+        close(fds[0]);
+        fds[0] = -1;
+    }
+    if (fds[1] != -1) {
+        close(fds[1]);
+        fds[1] = -1;
+    }
+    if (spawn.cgroupfd != -1) {
+        close(spawn.cgroupfd);
+        spawn.cgroupfd = -1;
+    }
+    if (spawn.outfd != -1) {
+        close(spawn.outfd);
+        spawn.outfd = -1;
+    }
+    if (capture != -1) {
+        close(capture);
+        capture = -1;
+    }
     return pid;
 success:
+    *output = capture;
+    capture = -1;
+    if (step)
+        *step = PROCESS_STEP_NONE;
+    if (error)
+        *error = 0;
     goto cleanup;
 failure:
-    /* _exit(0) in child process? */
-    if (pid == 0) {
-        LOGI("exit from child process with status code 1");
-        exitcode = 1;
-    }
+    LOGE("spawning %s failed at %s: %s", args[0],
+            ProcessBuilder_getStepString(spawn.step), strerror(spawn.error));
+    if (step)
+        *step = spawn.step;
+    if (error)
+        *error = spawn.error;
+    pid = -1;
     goto cleanup;
 cleanup:
     goto exit;
 }
 
 static
-Process* ProcessBuilder_build(ProcessBuilder const *me) {
+Process* ProcessBuilder_build0(ProcessBuilder const *me, int *step, int *error) {
     Process *r = NULL;
     Process *process = NULL;
+    OutputLog *log = NULL;
     pid_t pid = -1;
-    int nargs = 0;
-    int size = 0;
-    char **args = NULL;
-    char **src = NULL;
-    char **dest = NULL;
-
-    if (!me->data._M_file || strlen(me->data._M_file) < 1)
-        goto failure;
-
-    nargs = ProcessBuilder_countof((char const**) me->data._M_arguments);
-
-    /* the first one for executable file, the last one for end mark (NULL) */
-    args = (char**) realloc(NULL, (nargs + 2) * sizeof(*args));
-    if (!args) {
-        perror("realloc");
+    int output = -1;
+
+    if (step)
+        *step = PROCESS_STEP_NONE;
+    if (error)
+        *error = 0;
+    if (!me->data._M_file || strlen(me->data._M_file) < 1) {
+        if (error)
+            *error = EINVAL;
         goto failure;
     }
 
-    memset(args, 0, (nargs + 2) * sizeof(*args));
-    src = me->data._M_arguments;
-    dest = args;
-    size = nargs;
-
-    *dest++ = me->data._M_file;
-    /* copy pointers */
-    if (src)
-        memcpy(dest, src, (size + 1) * sizeof(src));
-
-    pid = ProcessBuilder_runProcess(me->data._M_path, args,
-            me->data._M_environments);
+    /* argv and envp go to exec as they are, nothing to copy per build */
+    pid = ProcessBuilder_runProcess(me,
+            (char**) me->data._M_argv->calls.getArray(me->data._M_argv),
+            (char**) ProcessBuilder_getEnvironments(me),
+            &output, step, error);
 
     if (pid == -1)
         goto failure;
@@ -463,6 +1175,19 @@ Process* ProcessBuilder_build(ProcessBuilder const *me) {
     if (!process)
         goto failure;
     process->calls.setPID(process, (int) pid);
+    if (output != -1) {
+        log = OutputLog_create(PROCESS_OUTPUT_CAPACITY);
+        if (!log)
+            goto failure;
+        log->calls.setHook(log, me->data._M_output_hook, me->data._M_output_context);
+        process->data._M_output = log;
+        /* the log owns output now, whatever happens */
+        if (!OutputLog_attach(log, output)) {
+            output = -1;
+            goto failure;
+        }
+        output = -1;
+    }
 
     goto success;
 exit:
@@ -474,17 +1199,22 @@ success:
 failure:
     goto cleanup;
 cleanup:
+    if (output != -1) {
+        close(output);
+        output = -1;
+    }
     if (process) {
         Process_destroy(process);
         process = NULL;
     }
-    if (args) {
-        free(args);
-        args = NULL;
-    }
     goto exit;
 }
 
+static
+Process* ProcessBuilder_build(ProcessBuilder const *me) {
+    return ProcessBuilder_build0(me, NULL, NULL);
+}
+
 void ProcessBuilder_destroy(ProcessBuilder *me) {
     if (me) {
         if (me->data._M_path) {
@@ -495,14 +1225,28 @@ void ProcessBuilder_destroy(ProcessBuilder *me) {
             free(me->data._M_file);
             me->data._M_file = NULL;
         }
-        if (me->data._M_arguments) {
-            ProcessBuilder_freeValues(me->data._M_arguments);
-            me->data._M_arguments = NULL;
+        if (me->data._M_argv) {
+            StringArena_destroy(me->data._M_argv);
+            me->data._M_argv = NULL;
+        }
+        if (me->data._M_envp) {
+            StringArena_destroy(me->data._M_envp);
+            me->data._M_envp = NULL;
+        }
+        if (me->data._M_cgroup_procs) {
+            free(me->data._M_cgroup_procs);
+            me->data._M_cgroup_procs = NULL;
         }
-        if (me->data._M_environments) {
-            ProcessBuilder_freeValues(me->data._M_environments);
-            me->data._M_environments = NULL;
+        if (me->data._M_output_path) {
+            free(me->data._M_output_path);
+            me->data._M_output_path = NULL;
         }
+#if defined(__linux__)
+        if (me->data._M_cpuset) {
+            CPU_FREE((cpu_set_t*) me->data._M_cpuset);
+            me->data._M_cpuset = NULL;
+        }
+#endif
         free(me);
     }
 }
@@ -514,6 +1258,13 @@ ProcessBuilder* ProcessBuilder_create() {
     builder = (ProcessBuilder*) calloc(1, sizeof(*builder));
     if (!builder)
         goto failure;
+    builder->data._M_memory_node = -1;
+    builder->data._M_pgid = -1;
+    /* argv[0] is the file, empty until setFile */
+    builder->data._M_argv = StringArena_create();
+    if (!builder->data._M_argv
+            || !builder->data._M_argv->calls.append(builder->data._M_argv, "", 0))
+        goto failure;
 
     builder->calls.getPath = &ProcessBuilder_getPath;
     builder->calls.getFile = &ProcessBuilder_getFile;
@@ -524,7 +1275,20 @@ ProcessBuilder* ProcessBuilder_create() {
     builder->calls.setFile = &ProcessBuilder_setFile;
     builder->calls.setArguments = &ProcessBuilder_setArguments;
     builder->calls.setEnvironments = &ProcessBuilder_setEnvironments;
+    builder->calls.addArgument = &ProcessBuilder_addArgument;
+    builder->calls.putEnvironment = &ProcessBuilder_putEnvironment;
+    builder->calls.setSpawnMode = &ProcessBuilder_setSpawnMode;
+    builder->calls.getSpawnMode = &ProcessBuilder_getSpawnMode;
+    builder->calls.setStats = &ProcessBuilder_setStats;
+    builder->calls.setAffinity = &ProcessBuilder_setAffinity;
+    builder->calls.setMemoryNode = &ProcessBuilder_setMemoryNode;
+    builder->calls.setProcessGroup = &ProcessBuilder_setProcessGroup;
+    builder->calls.setParentDeathSignal = &ProcessBuilder_setParentDeathSignal;
+    builder->calls.setControlGroup = &ProcessBuilder_setControlGroup;
+    builder->calls.setOutput = &ProcessBuilder_setOutput;
+    builder->calls.setOutputHook = &ProcessBuilder_setOutputHook;
     builder->calls.build = &ProcessBuilder_build;
+    builder->calls.build0 = &ProcessBuilder_build0;
 
     goto success;
 exit:
@@ -1,6 +1,12 @@
 #ifndef PROCESSBUILDER_H_INCLUDED
 #define PROCESSBUILDER_H_INCLUDED
 
+#include <sys/resource.h>
+
+#include "lifecyclestats.h"
+#include "outputlog.h"
+#include "stringarena.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -11,6 +17,54 @@ struct tagProcessBuilder;
 typedef struct tagProcess Process;
 typedef struct tagProcessBuilder ProcessBuilder;
 
+/* how ProcessBuilder creates the child process */
+enum {
+    /* fork + execve, page tables are copied, cost grows with parent RSS */
+    PROCESS_SPAWN_FORK = 0,
+    /* vfork + execve, the parent is suspended until the child exec'ed */
+    PROCESS_SPAWN_VFORK,
+    /* posix_spawn, chdir through spawn file actions */
+    PROCESS_SPAWN_POSIX_SPAWN,
+    /* clone(CLONE_VM | CLONE_VFORK) with a small private stack (Linux) */
+    PROCESS_SPAWN_CLONE
+};
+
+/* where stdout and stderr of the child go, both to the same place */
+enum {
+    /* ours, the default */
+    PROCESS_OUTPUT_INHERIT = 0,
+    /* /dev/null */
+    PROCESS_OUTPUT_NULL,
+    /* appended to a file, a relative one is below the child's path */
+    PROCESS_OUTPUT_FILE,
+    /* a pipe drained into the OutputLog of the Process */
+    PROCESS_OUTPUT_CAPTURE
+};
+
+/* bytes of captured output a Process keeps */
+#define PROCESS_OUTPUT_CAPACITY (64 * 1024)
+
+/* highest cpu number a cpulist may name, plus one */
+#define PROCESS_MAX_CPUS 4096
+
+/* highest NUMA node setMemoryNode accepts, plus one */
+#define PROCESS_MAX_NODES 1024
+
+/* the step at which starting a child failed, reported by build0 */
+enum {
+    PROCESS_STEP_NONE = 0,
+    /* fork, vfork, clone or posix_spawn itself */
+    PROCESS_STEP_SPAWN,
+    /* joining the cgroup, PR_SET_PDEATHSIG or setpgid */
+    PROCESS_STEP_GROUP,
+    /* opening the output file or pipe, dup2 in the child */
+    PROCESS_STEP_REDIRECT,
+    /* sched_setaffinity or set_mempolicy */
+    PROCESS_STEP_PLACEMENT,
+    PROCESS_STEP_CHDIR,
+    PROCESS_STEP_EXEC
+};
+
 struct tagProcess {
     struct {
         int         (*wait0)    (Process*, int, int*);
@@ -19,10 +73,32 @@ struct tagProcess {
         int         (*kill)     (Process*);
         int         (*getPID)   (Process const*);
         Process*    (*setPID)   (Process*, int);
+
+        /*
+         * wait up to timeout_ms (< 0 waits forever) for termination, returns
+         * 1 once the child is reaped and 0 on timeout.
+         */
+        int         (*waitFor)  (Process*, long timeout_ms, int *exitcode);
+        /* pidfd of the child (Linux 5.3+), -1 if unavailable or reaped */
+        int         (*getPidFD) (Process const*);
+        /* exit status of a reaped child, -1 if it did not exit normally */
+        int         (*getExitCode)  (Process const*);
+        /* signal that terminated a reaped child, 0 if none */
+        int         (*getTermSignal)(Process const*);
+        /* the captured output (PROCESS_OUTPUT_CAPTURE), NULL if not captured */
+        OutputLog*  (*getOutput)    (Process const*);
+        /* rusage of a reaped child from wait4, returns 0 before it is reaped */
+        int         (*getUsage)     (Process const*, struct rusage *usage);
     } calls;
 
     struct {
         int _M_pid;
+        int _M_pidfd;
+        int _M_exitcode;
+        int _M_signal;
+        OutputLog *_M_output;
+        int _M_reaped;
+        struct rusage _M_usage;
     } data;
 };
 
@@ -36,23 +112,103 @@ struct tagProcessBuilder {
 
         ProcessBuilder* (*setArguments)     (ProcessBuilder*, char const**arguments);
         char const**    (*getArguments)     (ProcessBuilder const*);
+        /* append one argument, the others stay as they are */
+        ProcessBuilder* (*addArgument)      (ProcessBuilder*, char const *value);
 
+        /* NULL (the default) passes on the environment of the parent */
         ProcessBuilder* (*setEnvironments)  (ProcessBuilder*, char const**arguments);
         char const**    (*getEnvironments)  (ProcessBuilder const*);
+        /*
+         * Set name to value in the child's environment, a NULL value
+         * removes it. The first call starts from the parent's environment
+         * unless setEnvironments gave one.
+         */
+        ProcessBuilder* (*putEnvironment)   (ProcessBuilder*, char const *name, char const *value);
+
+        ProcessBuilder* (*setSpawnMode)     (ProcessBuilder*, int mode);
+        int             (*getSpawnMode)     (ProcessBuilder const*);
+
+        /* time fork and exec of every build into stats (not owned), NULL to stop */
+        ProcessBuilder* (*setStats)         (ProcessBuilder*, LifecycleStats*);
+
+        /*
+         * Pin the child to the cpus of cpulist ("0-3,8"), NULL to let it
+         * float. Linux only, posix_spawn mode takes the vfork path then.
+         */
+        ProcessBuilder* (*setAffinity)      (ProcessBuilder*, char const *cpulist);
+        /* allocate the child's memory on NUMA node only, -1 for no policy */
+        ProcessBuilder* (*setMemoryNode)    (ProcessBuilder*, int node);
+
+        /*
+         * Put the child into process group pgid, 0 for a new one it leads
+         * and -1 (the default) to stay in ours. killpg(pgid) then reaches
+         * every process of the group in one call.
+         */
+        ProcessBuilder* (*setProcessGroup)  (ProcessBuilder*, int pgid);
+        /*
+         * Have the kernel send sig to the child once the thread that built
+         * it exits, crashes included (PR_SET_PDEATHSIG). 0 (the default)
+         * for none. Linux only, posix_spawn mode takes the vfork path then.
+         */
+        ProcessBuilder* (*setParentDeathSignal)(ProcessBuilder*, int sig);
+        /*
+         * Start the child in the cgroup v2 group at dir (see ControlGroup),
+         * before it allocates anything. NULL (the default) for our group.
+         * Linux only, posix_spawn mode takes the vfork path then.
+         */
+        ProcessBuilder* (*setControlGroup)  (ProcessBuilder*, char const *dir);
+
+        /*
+         * Send stdout and stderr of the child to mode (PROCESS_OUTPUT_*),
+         * path names the file of PROCESS_OUTPUT_FILE and is ignored else.
+         */
+        ProcessBuilder* (*setOutput)        (ProcessBuilder*, int mode, char const *path);
+        /*
+         * Hook of the OutputLog of captured children, installed before
+         * they run so no line is missed. NULL for none.
+         */
+        ProcessBuilder* (*setOutputHook)    (ProcessBuilder*, OutputLogHook, void *context);
 
+        /* returns once the child exec'ed, NULL if it could not */
         Process*        (*build)            (ProcessBuilder const*);
+        /* same as build, step (PROCESS_STEP_*) and errno tell why it failed */
+        Process*        (*build0)           (ProcessBuilder const*, int *step, int *error);
     } calls;
     struct {
         char* _M_path;
         char* _M_file;
-        char* *_M_arguments;
-        char* *_M_environments;
+        /* argv as passed to exec, the file followed by the arguments */
+        StringArena *_M_argv;
+        /* envp as passed to exec, NULL to inherit */
+        StringArena *_M_envp;
+        int   _M_spawn_mode;
+        LifecycleStats *_M_stats;
+        /* cpu_set_t of _M_cpuset_size bytes, NULL to float */
+        void *_M_cpuset;
+        size_t _M_cpuset_size;
+        int   _M_memory_node;
+        /* -1 to stay in our process group */
+        int   _M_pgid;
+        int   _M_death_signal;
+        /* cgroup.procs of the group to start in, NULL for ours */
+        char *_M_cgroup_procs;
+        /* PROCESS_OUTPUT_*, path for PROCESS_OUTPUT_FILE */
+        int   _M_output;
+        char *_M_output_path;
+        OutputLogHook _M_output_hook;
+        void *_M_output_context;
     } data;
 };
 
 extern ProcessBuilder*  ProcessBuilder_create();
 extern void             ProcessBuilder_destroy(ProcessBuilder*);
 extern void             Process_destroy(Process*);
+extern char const*      ProcessBuilder_getStepString(int step);
+/*
+ * cpus of a cpulist ("0-3,8"), the first n of them go to cpus. Returns
+ * the number of cpus in the list, -1 if it is malformed.
+ */
+extern int              ProcessBuilder_parseCPUList(char const *list, int *cpus, int n);
 
 #ifdef __cplusplus
 }
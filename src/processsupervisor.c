@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#   include <sys/epoll.h>
+#endif
+
+#include "processsupervisor.h"
+
+#define LOG_TAG "ProcessSupervisor"
+#include "logging.h"
+
+/* re-check interval for processes that have no pidfd (ms) */
+#define PROCESS_SUPERVISOR_FALLBACK_INTERVAL 10L
+#define PROCESS_SUPERVISOR_MAX_EVENTS 64
+
+struct tagProcessSupervisorEntry {
+    Process            *process;
+    ProcessExitCallback callback;
+    void               *userdata;
+    int                 watched;
+};
+
+static
+long ProcessSupervisor_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static
+size_t ProcessSupervisor_getCount(ProcessSupervisor const *me) {
+    return me->data._M_count;
+}
+
+static
+ProcessSupervisorEntry* ProcessSupervisor_detach(ProcessSupervisor *me, size_t i) {
+    ProcessSupervisorEntry *entry = me->data._M_entries[i];
+    int fd = -1;
+
+    if (entry->watched) {
+        fd = entry->process->calls.getPidFD(entry->process);
+#if defined(__linux__)
+        if (fd != -1)
+            epoll_ctl(me->data._M_epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+    } else {
+        --me->data._M_unwatched;
+    }
+    me->data._M_entries[i] = me->data._M_entries[--me->data._M_count];
+    me->data._M_entries[me->data._M_count] = NULL;
+    return entry;
+}
+
+static
+int ProcessSupervisor_add(ProcessSupervisor *me, Process *process,
+        ProcessExitCallback callback, void *userdata) {
+    int rc = 0;
+    int fd = -1;
+    size_t capacity = 0;
+    ProcessSupervisorEntry **entries = NULL;
+    ProcessSupervisorEntry *entry = NULL;
+#if defined(__linux__)
+    struct epoll_event ev;
+#endif
+
+    if (!process)
+        goto failure;
+    if (me->data._M_count == me->data._M_capacity) {
+        capacity = me->data._M_capacity ? me->data._M_capacity * 2 : 16;
+        entries = (ProcessSupervisorEntry**) realloc(me->data._M_entries,
+                capacity * sizeof(*entries));
+        if (!entries)
+            goto failure;
+        me->data._M_entries = entries;
+        me->data._M_capacity = capacity;
+    }
+    entry = (ProcessSupervisorEntry*) calloc(1, sizeof(*entry));
+    if (!entry)
+        goto failure;
+    entry->process = process;
+    entry->callback = callback;
+    entry->userdata = userdata;
+
+    fd = process->calls.getPidFD(process);
+#if defined(__linux__)
+    if (fd != -1 && me->data._M_epfd != -1) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = entry;
+        if (epoll_ctl(me->data._M_epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+            entry->watched = 1;
+    }
+#endif
+    if (!entry->watched)
+        ++me->data._M_unwatched;
+    me->data._M_entries[me->data._M_count++] = entry;
+    entry = NULL;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (entry) {
+        free(entry);
+        entry = NULL;
+    }
+    goto exit;
+}
+
+static
+int ProcessSupervisor_remove(ProcessSupervisor *me, Process *process) {
+    size_t i = 0;
+
+    for (i = 0; i < me->data._M_count; ++i) {
+        if (me->data._M_entries[i]->process == process) {
+            free(ProcessSupervisor_detach(me, i));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* reap entry i if its process is gone, returns 1 if a callback ran */
+static
+int ProcessSupervisor_check(ProcessSupervisor *me, size_t i) {
+    ProcessSupervisorEntry *entry = me->data._M_entries[i];
+    Process *process = entry->process;
+
+    if (!process->calls.wait0(process, WNOHANG, NULL))
+        return 0;
+    entry = ProcessSupervisor_detach(me, i);
+    if (entry->callback)
+        entry->callback(process,
+                process->calls.getExitCode(process),
+                process->calls.getTermSignal(process),
+                entry->userdata);
+    free(entry);
+    return 1;
+}
+
+static
+int ProcessSupervisor_poll(ProcessSupervisor *me, long timeout_ms) {
+    int n = 0;
+    int count = 0;
+    int i = 0;
+    size_t j = 0;
+    Process *process = NULL;
+    struct timespec ts;
+#if defined(__linux__)
+    struct epoll_event events[PROCESS_SUPERVISOR_MAX_EVENTS];
+#endif
+
+    if (me->data._M_count == 0)
+        return 0;
+    if (me->data._M_unwatched > 0
+            && (timeout_ms < 0 || timeout_ms > PROCESS_SUPERVISOR_FALLBACK_INTERVAL))
+        timeout_ms = PROCESS_SUPERVISOR_FALLBACK_INTERVAL;
+
+#if defined(__linux__)
+    if (me->data._M_epfd != -1) {
+        do {
+            n = epoll_wait(me->data._M_epfd, &events[0],
+                    PROCESS_SUPERVISOR_MAX_EVENTS, (int) timeout_ms);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            return -1;
+        }
+        for (i = 0; i < n; ++i) {
+            for (j = 0; j < me->data._M_count; ++j) {
+                if (me->data._M_entries[j] == events[i].data.ptr) {
+                    count += ProcessSupervisor_check(me, j);
+                    break;
+                }
+            }
+        }
+    }
+#endif
+    if (me->data._M_epfd == -1 && timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000L;
+        ts.tv_nsec = (timeout_ms % 1000L) * 1000000L;
+        nanosleep(&ts, NULL);
+    }
+
+    /* processes without pidfd, or reaped behind our back */
+    j = 0;
+    while (j < me->data._M_count) {
+        process = me->data._M_entries[j]->process;
+        if ((!me->data._M_entries[j]->watched
+                    || process->calls.getPID(process) < 0)
+                && ProcessSupervisor_check(me, j)) {
+            ++count;
+            continue;
+        }
+        ++j;
+    }
+    return count;
+}
+
+static
+int ProcessSupervisor_waitAll(ProcessSupervisor *me, long timeout_ms) {
+    long deadline = ProcessSupervisor_now() + timeout_ms;
+    long remaining = timeout_ms;
+
+    while (me->data._M_count > 0) {
+        if (timeout_ms >= 0) {
+            remaining = deadline - ProcessSupervisor_now();
+            if (remaining <= 0)
+                return 0;
+        }
+        if (ProcessSupervisor_poll(me, remaining) < 0)
+            return 0;
+    }
+    return 1;
+}
+
+void ProcessSupervisor_destroy(ProcessSupervisor *me) {
+    size_t i = 0;
+    if (me) {
+        if (me->data._M_entries) {
+            for (i = 0; i < me->data._M_count; ++i)
+                free(me->data._M_entries[i]);
+            free(me->data._M_entries);
+            me->data._M_entries = NULL;
+        }
+        if (me->data._M_epfd != -1) {
+            close(me->data._M_epfd);
+            me->data._M_epfd = -1;
+        }
+        free(me);
+    }
+}
+
+ProcessSupervisor* ProcessSupervisor_create() {
+    ProcessSupervisor *instance = NULL;
+
+    instance = (ProcessSupervisor*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->data._M_epfd = -1;
+#if defined(__linux__)
+    instance->data._M_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (instance->data._M_epfd == -1)
+        LOGE("epoll_create1 failed, falling back to polling");
+#endif
+    instance->calls.add = &ProcessSupervisor_add;
+    instance->calls.remove = &ProcessSupervisor_remove;
+    instance->calls.poll = &ProcessSupervisor_poll;
+    instance->calls.waitAll = &ProcessSupervisor_waitAll;
+    instance->calls.getCount = &ProcessSupervisor_getCount;
+    return instance;
+}
@@ -0,0 +1,64 @@
+#ifndef PROCESSSUPERVISOR_H_INCLUDED
+#define PROCESSSUPERVISOR_H_INCLUDED
+
+#include <stddef.h>
+
+#include "processbuilder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Watches many child processes from one thread through their pidfds
+     * registered in a single epoll set. No SIGCHLD handler is involved.
+     *
+     * A supervisor is not thread safe, drive it from one thread.
+     */
+
+    struct tagProcessSupervisor;
+    struct tagProcessSupervisorEntry;
+
+    typedef struct tagProcessSupervisor ProcessSupervisor;
+    typedef struct tagProcessSupervisorEntry ProcessSupervisorEntry;
+
+    /*
+     * Invoked once the process has been reaped. exitcode is -1 when it was
+     * killed by signal. The process is no longer supervised at this point
+     * and may be destroyed by the callback.
+     */
+    typedef void (*ProcessExitCallback)(Process*, int exitcode, int signal, void *userdata);
+
+    struct tagProcessSupervisor {
+        struct {
+            int     (*add)      (ProcessSupervisor*, Process*, ProcessExitCallback, void *userdata);
+            int     (*remove)   (ProcessSupervisor*, Process*);
+            /*
+             * wait up to timeout_ms (< 0 waits forever) for exits and dispatch
+             * their callbacks, returns the number of exits or -1 on error.
+             */
+            int     (*poll)     (ProcessSupervisor*, long timeout_ms);
+            /* returns 1 once every process exited, 0 on timeout */
+            int     (*waitAll)  (ProcessSupervisor*, long timeout_ms);
+            size_t  (*getCount) (ProcessSupervisor const*);
+        } calls;
+
+        struct {
+            int                       _M_epfd;
+            ProcessSupervisorEntry  **_M_entries;
+            size_t                    _M_count;
+            size_t                    _M_capacity;
+            /* processes without pidfd have to be polled with WNOHANG */
+            size_t                    _M_unwatched;
+        } data;
+    };
+
+    extern ProcessSupervisor*   ProcessSupervisor_create();
+    /* does not touch the remaining processes, they are only forgotten */
+    extern void                 ProcessSupervisor_destroy(ProcessSupervisor*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROCESSSUPERVISOR_H_INCLUDED */
@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <sys/time.h>
+#   include <sys/un.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <netdb.h>
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+#include "redisclient.h"
+
+#define LOG_TAG "RedisClient"
+#include "logging.h"
+
+#define REDIS_CLIENT_MAX_ARGS 64
+
+void RedisClientReply_destroy(RedisClientReply *me) {
+    size_t i = 0;
+    if (me) {
+        if (me->element) {
+            for (i = 0; i < me->elements; ++i)
+                RedisClientReply_destroy(me->element[i]);
+            free(me->element);
+            me->element = NULL;
+        }
+        if (me->str) {
+            free(me->str);
+            me->str = NULL;
+        }
+        free(me);
+    }
+}
+
+int RedisClientReply_is(RedisClientReply const *me, char const *expected) {
+    if (!me || !me->str)
+        return 0;
+    if (me->type != REDIS_CLIENT_REPLY_STATUS
+            && me->type != REDIS_CLIENT_REPLY_STRING)
+        return 0;
+    return strcmp(me->str, expected) == 0;
+}
+
+static
+int RedisClient_getFD(RedisClient const *me) {
+    return me->data._M_fd;
+}
+
+static
+int RedisClient_reserve(char **buffer, size_t *capacity, size_t required) {
+    char *p = NULL;
+    size_t n = *capacity ? *capacity : 512;
+
+    if (required <= *capacity)
+        return 1;
+    while (n < required)
+        n <<= 1;
+    p = (char*) realloc(*buffer, n);
+    if (!p)
+        return 0;
+    *buffer = p;
+    *capacity = n;
+    return 1;
+}
+
+static
+int RedisClient_appendBytes(RedisClient *me, char const *bytes, size_t len) {
+    if (!RedisClient_reserve(&me->data._M_wbuf, &me->data._M_wcap,
+                me->data._M_wlen + len))
+        return 0;
+    memcpy(me->data._M_wbuf + me->data._M_wlen, bytes, len);
+    me->data._M_wlen += len;
+    return 1;
+}
+
+static
+int RedisClient_append(RedisClient *me, char const **argv) {
+    int rc = 0;
+    char header[32];
+    int c = 0;
+    size_t argc = 0;
+    size_t len = 0;
+    char const **p = NULL;
+
+    for (p = argv; *p; ++p)
+        ++argc;
+    if (argc < 1)
+        goto failure;
+
+    c = snprintf(&header[0], sizeof(header), "*%lu\r\n", (unsigned long) argc);
+    if (!RedisClient_appendBytes(me, &header[0], c))
+        goto failure;
+    for (p = argv; *p; ++p) {
+        len = strlen(*p);
+        c = snprintf(&header[0], sizeof(header), "$%lu\r\n", (unsigned long) len);
+        if (!RedisClient_appendBytes(me, &header[0], c))
+            goto failure;
+        if (!RedisClient_appendBytes(me, *p, len))
+            goto failure;
+        if (!RedisClient_appendBytes(me, "\r\n", 2))
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    goto exit;
+}
+
+static
+int RedisClient_flush(RedisClient *me) {
+    size_t written = 0;
+    ssize_t n = 0;
+
+    while (written < me->data._M_wlen) {
+        n = send(me->data._M_fd, me->data._M_wbuf + written,
+                me->data._M_wlen - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        written += (size_t) n;
+    }
+    me->data._M_wlen = 0;
+    return 1;
+}
+
+/* make sure at least one more byte is readable, returns 0 on EOF/error */
+static
+int RedisClient_fill(RedisClient *me) {
+    ssize_t n = 0;
+
+    if (me->data._M_rpos > 0) {
+        /* compact consumed bytes so the buffer does not grow forever */
+        memmove(me->data._M_rbuf, me->data._M_rbuf + me->data._M_rpos,
+                me->data._M_rlen - me->data._M_rpos);
+        me->data._M_rlen -= me->data._M_rpos;
+        me->data._M_rpos = 0;
+    }
+    if (!RedisClient_reserve(&me->data._M_rbuf, &me->data._M_rcap,
+                me->data._M_rlen + 4096))
+        return 0;
+    do {
+        n = recv(me->data._M_fd, me->data._M_rbuf + me->data._M_rlen,
+                me->data._M_rcap - me->data._M_rlen, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return 0;
+    me->data._M_rlen += (size_t) n;
+    return 1;
+}
+
+/* returns a pointer to a NUL terminated line (without CRLF) */
+static
+char* RedisClient_readLine(RedisClient *me) {
+    char *line = NULL;
+    char *end = NULL;
+
+    for (;;) {
+        line = me->data._M_rbuf + me->data._M_rpos;
+        if (me->data._M_rlen > me->data._M_rpos) {
+            end = (char*) memchr(line, '\n', me->data._M_rlen - me->data._M_rpos);
+            if (end && end > line && *(end - 1) == '\r') {
+                *(end - 1) = '\0';
+                me->data._M_rpos = (end - me->data._M_rbuf) + 1;
+                return line;
+            }
+        }
+        if (!RedisClient_fill(me))
+            return NULL;
+    }
+}
+
+static
+RedisClientReply* RedisClient_readReply(RedisClient *me) {
+    RedisClientReply *r = NULL;
+    RedisClientReply *reply = NULL;
+    char *line = NULL;
+    long long n = 0;
+    size_t i = 0;
+
+    line = RedisClient_readLine(me);
+    if (!line)
+        goto failure;
+    reply = (RedisClientReply*) calloc(1, sizeof(*reply));
+    if (!reply)
+        goto failure;
+
+    switch (line[0]) {
+        case '+':
+        case '-':
+            reply->type = line[0] == '+'
+                ? REDIS_CLIENT_REPLY_STATUS
+                : REDIS_CLIENT_REPLY_ERROR;
+            reply->len = strlen(line + 1);
+            reply->str = strdup(line + 1);
+            if (!reply->str)
+                goto failure;
+            break;
+        case ':':
+            reply->type = REDIS_CLIENT_REPLY_INTEGER;
+            reply->integer = strtoll(line + 1, NULL, 10);
+            break;
+        case '$':
+            n = strtoll(line + 1, NULL, 10);
+            if (n < 0) {
+                reply->type = REDIS_CLIENT_REPLY_NIL;
+                break;
+            }
+            reply->type = REDIS_CLIENT_REPLY_STRING;
+            while (me->data._M_rlen - me->data._M_rpos < (size_t) n + 2) {
+                if (!RedisClient_fill(me))
+                    goto failure;
+            }
+            reply->str = (char*) malloc((size_t) n + 1);
+            if (!reply->str)
+                goto failure;
+            memcpy(reply->str, me->data._M_rbuf + me->data._M_rpos, (size_t) n);
+            reply->str[n] = '\0';
+            reply->len = (size_t) n;
+            me->data._M_rpos += (size_t) n + 2;
+            break;
+        case '*':
+            n = strtoll(line + 1, NULL, 10);
+            if (n < 0) {
+                reply->type = REDIS_CLIENT_REPLY_NIL;
+                break;
+            }
+            reply->type = REDIS_CLIENT_REPLY_ARRAY;
+            if (n > 0) {
+                reply->element = (RedisClientReply**) calloc((size_t) n,
+                        sizeof(*reply->element));
+                if (!reply->element)
+                    goto failure;
+            }
+            for (i = 0; i < (size_t) n; ++i) {
+                reply->element[i] = RedisClient_readReply(me);
+                reply->elements = i + 1;
+                if (!reply->element[i])
+                    goto failure;
+            }
+            break;
+        default:
+            LOGE("unexpected reply prefix '%c'", line[0]);
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = reply;
+    reply = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    goto exit;
+}
+
+static
+RedisClientReply* RedisClient_getReply(RedisClient *me) {
+    if (me->data._M_wlen > 0 && !RedisClient_flush(me))
+        return NULL;
+    return RedisClient_readReply(me);
+}
+
+static
+size_t RedisClient_getBuffered(RedisClient const *me) {
+    return me->data._M_rlen - me->data._M_rpos;
+}
+
+static
+RedisClientReply* RedisClient_command(RedisClient *me, char const **argv) {
+    if (!RedisClient_append(me, argv))
+        return NULL;
+    return RedisClient_getReply(me);
+}
+
+static
+RedisClientReply* RedisClient_commandv(RedisClient *me, ...) {
+    char const *argv[REDIS_CLIENT_MAX_ARGS + 1];
+    char const *arg = NULL;
+    size_t argc = 0;
+    va_list ap;
+
+    va_start(ap, me);
+    while ((arg = va_arg(ap, char const*)) != NULL) {
+        if (argc >= REDIS_CLIENT_MAX_ARGS) {
+            va_end(ap);
+            return NULL;
+        }
+        argv[argc++] = arg;
+    }
+    va_end(ap);
+    argv[argc] = NULL;
+    return RedisClient_command(me, &argv[0]);
+}
+
+/* connect fd to addr within timeout_ms, leaving fd in blocking mode */
+static
+int RedisClient_connectFD(int fd, struct sockaddr const *addr,
+        socklen_t addrlen, long timeout_ms) {
+    int rc = 0;
+    int flags = 0;
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    struct pollfd pfd;
+    struct timeval tv;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        goto failure;
+    if (connect(fd, addr, addrlen) == -1) {
+        if (errno != EINPROGRESS)
+            goto failure;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (int) timeout_ms) != 1)
+            goto failure;
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1 || err)
+            goto failure;
+    }
+    if (fcntl(fd, F_SETFL, flags) == -1)
+        goto failure;
+
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    goto exit;
+}
+
+static
+RedisClient* RedisClient_create(int fd) {
+    RedisClient *instance = NULL;
+
+    instance = (RedisClient*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->data._M_fd = fd;
+    instance->calls.command = &RedisClient_command;
+    instance->calls.commandv = &RedisClient_commandv;
+    instance->calls.append = &RedisClient_append;
+    instance->calls.getReply = &RedisClient_getReply;
+    instance->calls.flush = &RedisClient_flush;
+    instance->calls.getBuffered = &RedisClient_getBuffered;
+    instance->calls.getFD = &RedisClient_getFD;
+    return instance;
+}
+
+RedisClient* RedisClient_connect(char const *host, int port, long timeout_ms) {
+    RedisClient *r = NULL;
+    int fd = -1;
+    int one = 1;
+    char service[16];
+    struct addrinfo hints;
+    struct addrinfo *addrs = NULL;
+    struct addrinfo *ai = NULL;
+
+    snprintf(&service[0], sizeof(service), "%d", port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host ? host : "127.0.0.1", &service[0], &hints, &addrs) != 0)
+        goto failure;
+
+    for (ai = addrs; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (RedisClient_connectFD(fd, ai->ai_addr, ai->ai_addrlen, timeout_ms))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    if (fd == -1)
+        goto failure;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    r = RedisClient_create(fd);
+    if (!r)
+        goto failure;
+    fd = -1;
+
+    goto success;
+exit:
+    return r;
+success:
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (addrs) {
+        freeaddrinfo(addrs);
+        addrs = NULL;
+    }
+    goto exit;
+}
+
+RedisClient* RedisClient_connectUnix(char const *path, long timeout_ms) {
+    RedisClient *r = NULL;
+    int fd = -1;
+    struct sockaddr_un addr;
+
+    if (!path || strlen(path) >= sizeof(addr.sun_path))
+        goto failure;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(&addr.sun_path[0], path, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        goto failure;
+    if (!RedisClient_connectFD(fd, (struct sockaddr const*) &addr,
+                sizeof(addr), timeout_ms))
+        goto failure;
+
+    r = RedisClient_create(fd);
+    if (!r)
+        goto failure;
+    fd = -1;
+
+    goto success;
+exit:
+    return r;
+success:
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    goto exit;
+}
+
+void RedisClient_destroy(RedisClient *me) {
+    if (me) {
+        if (me->data._M_fd != -1) {
+            close(me->data._M_fd);
+            me->data._M_fd = -1;
+        }
+        if (me->data._M_rbuf) {
+            free(me->data._M_rbuf);
+            me->data._M_rbuf = NULL;
+        }
+        if (me->data._M_wbuf) {
+            free(me->data._M_wbuf);
+            me->data._M_wbuf = NULL;
+        }
+        free(me);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef REDISCLIENT_H_INCLUDED
+#define REDISCLIENT_H_INCLUDED
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Minimal blocking RESP client used by the builders to talk to the
+     * redis-server instances they launch (readiness probes, resets,
+     * topology setup). It is deliberately tiny and has no dependency on
+     * hiredis.
+     */
+
+    struct tagRedisClient;
+    struct tagRedisClientReply;
+
+    typedef struct tagRedisClient RedisClient;
+    typedef struct tagRedisClientReply RedisClientReply;
+
+    enum {
+        REDIS_CLIENT_REPLY_STATUS = 1,
+        REDIS_CLIENT_REPLY_ERROR,
+        REDIS_CLIENT_REPLY_INTEGER,
+        REDIS_CLIENT_REPLY_STRING,
+        REDIS_CLIENT_REPLY_ARRAY,
+        REDIS_CLIENT_REPLY_NIL
+    };
+
+    struct tagRedisClientReply {
+        int                 type;
+        long long           integer;
+        size_t              len;
+        char               *str;
+        size_t              elements;
+        RedisClientReply  **element;
+    };
+
+    struct tagRedisClient {
+        struct {
+            /* send one command (NULL terminated argv) and read its reply */
+            RedisClientReply*   (*command)  (RedisClient*, char const **argv);
+            /* same as command, arguments are a NULL terminated list */
+            RedisClientReply*   (*commandv) (RedisClient*, ...);
+            /* queue one command without flushing it (pipelining) */
+            int                 (*append)   (RedisClient*, char const **argv);
+            /* flush queued commands and read the next reply */
+            RedisClientReply*   (*getReply) (RedisClient*);
+            /* send queued commands without waiting for a reply */
+            int                 (*flush)    (RedisClient*);
+            /*
+             * bytes already received but not consumed by getReply yet,
+             * a poll on the fd does not see them
+             */
+            size_t              (*getBuffered)(RedisClient const*);
+            int                 (*getFD)    (RedisClient const*);
+        } calls;
+
+        struct {
+            int     _M_fd;
+            char   *_M_rbuf;
+            size_t  _M_rcap;
+            size_t  _M_rlen;
+            size_t  _M_rpos;
+            char   *_M_wbuf;
+            size_t  _M_wcap;
+            size_t  _M_wlen;
+        } data;
+    };
+
+    extern RedisClient* RedisClient_connect(char const *host, int port, long timeout_ms);
+    extern RedisClient* RedisClient_connectUnix(char const *path, long timeout_ms);
+    extern void         RedisClient_destroy(RedisClient*);
+
+    extern void         RedisClientReply_destroy(RedisClientReply*);
+    /* 1 if reply is a status (or bulk string) equal to expected */
+    extern int          RedisClientReply_is(RedisClientReply const*, char const *expected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REDISCLIENT_H_INCLUDED */
@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "redisclusterbuilder.h"
+#include "redisclient.h"
+
+#define LOG_TAG "RedisClusterBuilder"
+#include "logging.h"
+
+#define REDIS_CLUSTER_DEFAULT_MASTERS   3
+#define REDIS_CLUSTER_DEFAULT_TIMEOUT   30000L
+/* reply timeout of the setup connections (ms) */
+#define REDIS_CLUSTER_COMMAND_TIMEOUT   5000L
+/* convergence polling backoff (ms) */
+#define REDIS_CLUSTER_MIN_DELAY         10L
+#define REDIS_CLUSTER_MAX_DELAY         200L
+
+static
+long RedisClusterBuilder_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static
+void RedisClusterBuilder_sleep(long milliseconds) {
+    struct timespec ts;
+    ts.tv_sec = milliseconds / 1000L;
+    ts.tv_nsec = (milliseconds % 1000L) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static
+size_t RedisCluster_getNodeCount(RedisCluster const *me) {
+    return me->data._M_count;
+}
+
+static
+RedisInstance* RedisCluster_getNode(RedisCluster const *me, size_t i) {
+    return i < me->data._M_count ? me->data._M_nodes[i] : NULL;
+}
+
+static
+char const* RedisCluster_getNodeId(RedisCluster const *me, size_t i) {
+    return i < me->data._M_count ? me->data._M_ids[i] : NULL;
+}
+
+static
+long RedisCluster_getMaster(RedisCluster const *me, size_t i) {
+    return i < me->data._M_count ? me->data._M_masters[i] : -1;
+}
+
+static
+int RedisCluster_getSlots(RedisCluster const *me, size_t i,
+        int *first, int *last) {
+    size_t n = me->data._M_nmasters;
+
+    if (i >= n)
+        return 0;
+    if (first)
+        *first = (int) (i * REDIS_CLUSTER_SLOTS / n);
+    if (last)
+        *last = (int) ((i + 1) * REDIS_CLUSTER_SLOTS / n) - 1;
+    return 1;
+}
+
+void RedisCluster_destroy(RedisCluster *me) {
+    size_t i = 0;
+    if (me) {
+        if (me->data._M_nodes) {
+            for (i = 0; i < me->data._M_count; ++i)
+                RedisInstance_destroy(me->data._M_nodes[i]);
+            free(me->data._M_nodes);
+            me->data._M_nodes = NULL;
+        }
+        if (me->data._M_ids) {
+            for (i = 0; i < me->data._M_count; ++i)
+                free(me->data._M_ids[i]);
+            free(me->data._M_ids);
+            me->data._M_ids = NULL;
+        }
+        if (me->data._M_masters) {
+            free(me->data._M_masters);
+            me->data._M_masters = NULL;
+        }
+        free(me);
+    }
+}
+
+static
+RedisCluster* RedisCluster_create(size_t count, size_t nmasters) {
+    RedisCluster *r = NULL;
+    RedisCluster *instance = NULL;
+
+    instance = (RedisCluster*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.getNodeCount = &RedisCluster_getNodeCount;
+    instance->calls.getNode = &RedisCluster_getNode;
+    instance->calls.getNodeId = &RedisCluster_getNodeId;
+    instance->calls.getMaster = &RedisCluster_getMaster;
+    instance->calls.getSlots = &RedisCluster_getSlots;
+    instance->data._M_count = count;
+    instance->data._M_nmasters = nmasters;
+    instance->data._M_nodes = (RedisInstance**) calloc(count,
+            sizeof(*instance->data._M_nodes));
+    instance->data._M_ids = (char**) calloc(count, sizeof(*instance->data._M_ids));
+    instance->data._M_masters = (long*) calloc(count,
+            sizeof(*instance->data._M_masters));
+    if (!instance->data._M_nodes || !instance->data._M_ids
+            || !instance->data._M_masters)
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisCluster_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
+
+/* send one command and check for the expected status reply */
+static
+int RedisClusterBuilder_expect(RedisClient *client, char const **argv,
+        char const *expected) {
+    int rc = 0;
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.command(client, argv);
+    rc = RedisClientReply_is(reply, expected);
+    if (!rc)
+        LOGE("CLUSTER %s failed: %s", argv[1],
+                reply && reply->str ? reply->str : "no reply");
+    RedisClientReply_destroy(reply);
+    return rc;
+}
+
+/* CLUSTER ADDSLOTS first..last in one command */
+static
+int RedisClusterBuilder_addSlots(RedisClient *client, int first, int last) {
+    int rc = 0;
+    int slot = 0;
+    int n = last - first + 1;
+    char const **argv = NULL;
+    char *numbers = NULL;
+    char *p = NULL;
+
+    argv = (char const**) calloc(n + 3, sizeof(*argv));
+    /* "16383" plus terminator per slot */
+    numbers = (char*) malloc((size_t) n * 6);
+    if (!argv || !numbers)
+        goto failure;
+    argv[0] = "CLUSTER";
+    argv[1] = "ADDSLOTS";
+    p = numbers;
+    for (slot = first; slot <= last; ++slot) {
+        argv[slot - first + 2] = p;
+        p += sprintf(p, "%d", slot) + 1;
+    }
+    if (!RedisClusterBuilder_expect(client, argv, "OK"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (numbers) {
+        free(numbers);
+        numbers = NULL;
+    }
+    if (argv) {
+        free(argv);
+        argv = NULL;
+    }
+    goto exit;
+}
+
+/* value of field in a CLUSTER INFO reply, 0 if it differs from expected */
+static
+int RedisClusterBuilder_infoIs(RedisClient *client, char const *field,
+        char const *expected) {
+    int rc = 0;
+    char const *p = NULL;
+    size_t len = strlen(field);
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.commandv(client, "CLUSTER", "INFO", NULL);
+    if (reply && reply->str) {
+        p = strstr(reply->str, field);
+        if (p && p[len] == ':')
+            rc = strncmp(p + len + 1, expected, strlen(expected)) == 0
+                && (p[len + 1 + strlen(expected)] == '\r'
+                        || p[len + 1 + strlen(expected)] == '\n');
+    }
+    RedisClientReply_destroy(reply);
+    return rc;
+}
+
+/* poll CLUSTER INFO on every node until field has the expected value */
+static
+int RedisClusterBuilder_waitInfo(RedisClient **clients, size_t n,
+        char const *field, char const *expected, long deadline) {
+    size_t i = 0;
+    long delay = REDIS_CLUSTER_MIN_DELAY;
+
+    while (i < n) {
+        if (RedisClusterBuilder_infoIs(clients[i], field, expected)) {
+            ++i;
+            continue;
+        }
+        if (RedisClusterBuilder_now() >= deadline) {
+            LOGE("node %lu never reported %s:%s", (unsigned long) i,
+                    field, expected);
+            return 0;
+        }
+        RedisClusterBuilder_sleep(delay);
+        delay = delay * 2 < REDIS_CLUSTER_MAX_DELAY
+            ? delay * 2
+            : REDIS_CLUSTER_MAX_DELAY;
+    }
+    return 1;
+}
+
+static
+RedisCluster* RedisClusterBuilder_build(RedisClusterBuilder const *me,
+        int *status) {
+    RedisCluster *r = NULL;
+    RedisCluster *cluster = NULL;
+    int rc = REDIS_SERVER_STATUS_FAILED;
+    size_t i = 0;
+    size_t n = me->data._M_masters * (1 + me->data._M_replicas);
+    size_t nmasters = me->data._M_masters;
+    int first = 0;
+    int last = 0;
+    int *statuses = NULL;
+    long deadline = 0;
+    char port[16];
+    char known[32];
+    char const *host = NULL;
+    char const *meet[5] = { "CLUSTER", "MEET", NULL, NULL, NULL };
+    char const *replicate[4] = { "CLUSTER", "REPLICATE", NULL, NULL };
+    RedisClient **clients = NULL;
+    RedisClientReply *reply = NULL;
+
+    cluster = RedisCluster_create(n, nmasters);
+    statuses = (int*) calloc(n, sizeof(*statuses));
+    clients = (RedisClient**) calloc(n, sizeof(*clients));
+    if (!cluster || !statuses || !clients)
+        goto failure;
+
+    /* every node on its own port, the failing status wins */
+    if (me->data._M_template->calls.buildMany(me->data._M_template, n,
+                cluster->data._M_nodes, statuses) != n) {
+        for (i = 0; i < n; ++i) {
+            if (statuses[i] != REDIS_SERVER_STATUS_OK) {
+                rc = statuses[i];
+                break;
+            }
+        }
+        goto failure;
+    }
+    deadline = RedisClusterBuilder_now() + me->data._M_timeout;
+
+    for (i = 0; i < n; ++i) {
+        clients[i] = cluster->data._M_nodes[i]->calls.connect(
+                cluster->data._M_nodes[i], REDIS_CLUSTER_COMMAND_TIMEOUT);
+        if (!clients[i])
+            goto failure;
+        reply = clients[i]->calls.commandv(clients[i], "CLUSTER", "MYID", NULL);
+        if (!reply || reply->type != REDIS_CLIENT_REPLY_STRING)
+            goto failure;
+        cluster->data._M_ids[i] = strdup(reply->str);
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+        if (!cluster->data._M_ids[i])
+            goto failure;
+        cluster->data._M_masters[i] = i < nmasters
+            ? -1
+            : (long) ((i - nmasters) / me->data._M_replicas);
+    }
+
+    for (i = 0; i < nmasters; ++i) {
+        cluster->calls.getSlots(cluster, i, &first, &last);
+        if (!RedisClusterBuilder_addSlots(clients[i], first, last))
+            goto failure;
+    }
+
+    /* node 0 introduces everybody, gossip spreads the rest */
+    for (i = 1; i < n; ++i) {
+        host = cluster->data._M_nodes[i]->calls.getHost(cluster->data._M_nodes[i]);
+        snprintf(port, sizeof(port), "%d",
+                cluster->data._M_nodes[i]->calls.getPort(cluster->data._M_nodes[i]));
+        /* MEET wants an address, not a host name */
+        meet[2] = host && strcmp(host, "localhost") != 0 ? host : "127.0.0.1";
+        meet[3] = port;
+        if (!RedisClusterBuilder_expect(clients[0], meet, "OK"))
+            goto failure;
+    }
+    snprintf(known, sizeof(known), "%lu", (unsigned long) n);
+    if (!RedisClusterBuilder_waitInfo(clients, n, "cluster_known_nodes",
+                known, deadline)) {
+        rc = REDIS_SERVER_STATUS_TIMEDOUT;
+        goto failure;
+    }
+
+    for (i = nmasters; i < n; ++i) {
+        replicate[2] = cluster->data._M_ids[cluster->data._M_masters[i]];
+        if (!RedisClusterBuilder_expect(clients[i], replicate, "OK"))
+            goto failure;
+    }
+    if (!RedisClusterBuilder_waitInfo(clients, n, "cluster_state", "ok",
+                deadline)) {
+        rc = REDIS_SERVER_STATUS_TIMEDOUT;
+        goto failure;
+    }
+    LOGI("cluster of %lu masters and %lu nodes ready",
+            (unsigned long) nmasters, (unsigned long) n);
+
+    goto success;
+exit:
+    if (status)
+        *status = rc;
+    return r;
+success:
+    rc = REDIS_SERVER_STATUS_OK;
+    r = cluster;
+    cluster = NULL;
+    goto cleanup;
+failure:
+    if (rc == REDIS_SERVER_STATUS_OK)
+        rc = REDIS_SERVER_STATUS_FAILED;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    if (clients) {
+        for (i = 0; i < n; ++i)
+            RedisClient_destroy(clients[i]);
+        free(clients);
+        clients = NULL;
+    }
+    if (statuses) {
+        free(statuses);
+        statuses = NULL;
+    }
+    if (cluster) {
+        RedisCluster_destroy(cluster);
+        cluster = NULL;
+    }
+    goto exit;
+}
+
+static
+RedisClusterBuilder* RedisClusterBuilder_setMasters(RedisClusterBuilder *me,
+        size_t n) {
+    if (n < 1 || n > REDIS_CLUSTER_SLOTS)
+        return NULL;
+    me->data._M_masters = n;
+    return me;
+}
+
+static
+RedisClusterBuilder* RedisClusterBuilder_setReplicas(RedisClusterBuilder *me,
+        size_t per_master) {
+    me->data._M_replicas = per_master;
+    return me;
+}
+
+static
+RedisClusterBuilder* RedisClusterBuilder_setTimeout(RedisClusterBuilder *me,
+        long milliseconds) {
+    if (milliseconds <= 0)
+        return NULL;
+    me->data._M_timeout = milliseconds;
+    return me;
+}
+
+void RedisClusterBuilder_destroy(RedisClusterBuilder *me) {
+    if (me) {
+        if (me->data._M_template) {
+            RedisServerBuilder_destroy(me->data._M_template);
+            me->data._M_template = NULL;
+        }
+        free(me);
+    }
+}
+
+RedisClusterBuilder* RedisClusterBuilder_create(RedisServerBuilder const *tmpl) {
+    RedisClusterBuilder *r = NULL;
+    RedisClusterBuilder *instance = NULL;
+    RedisServerBuilder *builder = NULL;
+
+    instance = (RedisClusterBuilder*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.setMasters = &RedisClusterBuilder_setMasters;
+    instance->calls.setReplicas = &RedisClusterBuilder_setReplicas;
+    instance->calls.setTimeout = &RedisClusterBuilder_setTimeout;
+    instance->calls.build = &RedisClusterBuilder_build;
+    instance->data._M_masters = REDIS_CLUSTER_DEFAULT_MASTERS;
+    instance->data._M_timeout = REDIS_CLUSTER_DEFAULT_TIMEOUT;
+
+    builder = tmpl ? tmpl->calls.clone(tmpl) : RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    instance->data._M_template = builder;
+    /* the cluster bus is TCP only, nodes.conf must not be shared */
+    if (!builder->calls.setUnixSocketMode(builder, 0)
+            || !builder->calls.setPrivateDir(builder, 1)
+            || !builder->calls.optionString(builder, "cluster-enabled", "yes")
+            || !builder->calls.optionString(builder, "cluster-config-file", "nodes.conf"))
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisClusterBuilder_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,89 @@
+#ifndef REDISCLUSTERBUILDER_H_INCLUDED
+#define REDISCLUSTERBUILDER_H_INCLUDED
+
+#include <stddef.h>
+
+#include "redisserverbuilder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Builds a local redis cluster out of RedisServerBuilder instances.
+     *
+     * All nodes are started at once with cluster-enabled yes, each one in
+     * a private dir (so every node has its own nodes.conf) on a port whose
+     * cluster bus port is leased as well. The 16384 slots are split evenly
+     * over the masters, the nodes are joined with CLUSTER MEET, replicas
+     * attached with CLUSTER REPLICATE and build returns once every node
+     * reports cluster_state:ok.
+     */
+
+    struct tagRedisCluster;
+    struct tagRedisClusterBuilder;
+
+    typedef struct tagRedisCluster RedisCluster;
+    typedef struct tagRedisClusterBuilder RedisClusterBuilder;
+
+#define REDIS_CLUSTER_SLOTS 16384
+
+    /*
+     * Nodes are ordered masters first, the replicas of master i follow at
+     * masters + i * replicas + j.
+     */
+    struct tagRedisCluster {
+        struct {
+            size_t          (*getNodeCount) (RedisCluster const*);
+            RedisInstance*  (*getNode)      (RedisCluster const*, size_t i);
+            /* 40 character node id as reported by CLUSTER MYID */
+            char const*     (*getNodeId)    (RedisCluster const*, size_t i);
+            /* index of the master of node i, -1 if node i is a master */
+            long            (*getMaster)    (RedisCluster const*, size_t i);
+            /* slot range served by master i, 0 for replicas */
+            int             (*getSlots)     (RedisCluster const*, size_t i,
+                                             int *first, int *last);
+        } calls;
+
+        struct {
+            RedisInstance **_M_nodes;
+            char          **_M_ids;
+            long           *_M_masters;
+            size_t          _M_count;
+            size_t          _M_nmasters;
+        } data;
+    };
+
+    struct tagRedisClusterBuilder {
+        struct {
+            RedisClusterBuilder*    (*setMasters)   (RedisClusterBuilder*, size_t);
+            RedisClusterBuilder*    (*setReplicas)  (RedisClusterBuilder*, size_t per_master);
+            /* how long build waits for cluster_state:ok (ms) */
+            RedisClusterBuilder*    (*setTimeout)   (RedisClusterBuilder*, long);
+            /* status (optional) receives one of REDIS_SERVER_STATUS_* */
+            RedisCluster*           (*build)        (RedisClusterBuilder const*, int *status);
+        } calls;
+
+        struct {
+            RedisServerBuilder *_M_template;
+            size_t              _M_masters;
+            size_t              _M_replicas;
+            long                _M_timeout;
+        } data;
+    };
+
+    /*
+     * template (may be NULL) supplies the options of every node, it is
+     * copied. Defaults to 3 masters without replicas.
+     */
+    extern RedisClusterBuilder* RedisClusterBuilder_create(RedisServerBuilder const *tmpl);
+    extern void                 RedisClusterBuilder_destroy(RedisClusterBuilder*);
+
+    /* stops every node */
+    extern void                 RedisCluster_destroy(RedisCluster*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REDISCLUSTERBUILDER_H_INCLUDED */
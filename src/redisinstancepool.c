@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#endif
+
+#include "redisinstancepool.h"
+#include "librarythread.h"
+
+#define LOG_TAG "RedisInstancePool"
+#include "logging.h"
+
+/* how often idle instances are checked for unexpected exits (ms) */
+#define REDIS_INSTANCE_POOL_CHECK_INTERVAL  500L
+/* backoff between failed refills (ms) */
+#define REDIS_INSTANCE_POOL_MIN_BACKOFF     50L
+#define REDIS_INSTANCE_POOL_MAX_BACKOFF     2000L
+
+static
+void RedisInstancePool_deadline(struct timespec *ts, long milliseconds) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += milliseconds / 1000L;
+    ts->tv_nsec += (milliseconds % 1000L) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static
+int RedisInstancePool_isAlive(RedisInstance *instance) {
+    Process *p = instance->calls.getProcess(instance);
+    int exitcode = 0;
+
+    if (!p || p->calls.wait0(p, WNOHANG, &exitcode)) {
+        LOGI("pooled redis instance on port %d exited with code %d",
+                instance->calls.getPort(instance), exitcode);
+        return 0;
+    }
+    return 1;
+}
+
+/* bring an instance back to its freshly built state before it is reused */
+static
+int RedisInstancePool_reset(RedisInstance *instance) {
+    if (!instance->calls.reset(instance, REDIS_INSTANCE_RESET_ALL, NULL)) {
+        LOGE("reset redis instance on port %d failed",
+                instance->calls.getPort(instance));
+        return 0;
+    }
+    return 1;
+}
+
+static
+RedisInstance* RedisInstancePool_spawn(RedisInstancePool *me) {
+    RedisInstance *r = NULL;
+    RedisServerBuilder *builder = NULL;
+    int status = 0;
+
+    builder = me->data._M_builder->calls.clone(me->data._M_builder);
+    if (!builder)
+        goto failure;
+    /* every instance needs a port of its own, unix socket mode ignores it */
+    if (!builder->data._M_port_allocator)
+        builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
+    r = builder->calls.build1(builder, NULL, &status);
+    if (!r) {
+        LOGE("build pooled redis instance failed: %s",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* drop idle instances whose server died, caller holds the mutex */
+static
+void RedisInstancePool_reapIdle(RedisInstancePool *me) {
+    size_t i = 0;
+
+    while (i < me->data._M_nidle) {
+        if (RedisInstancePool_isAlive(me->data._M_idle[i])) {
+            ++i;
+            continue;
+        }
+        RedisInstance_destroy(me->data._M_idle[i]);
+        me->data._M_idle[i] = me->data._M_idle[--me->data._M_nidle];
+        me->data._M_idle[me->data._M_nidle] = NULL;
+    }
+}
+
+static
+void* RedisInstancePool_run(void *arg) {
+    RedisInstancePool *me = (RedisInstancePool*) arg;
+    RedisInstance *instance = NULL;
+    long backoff = REDIS_INSTANCE_POOL_MIN_BACKOFF;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    while (me->data._M_running) {
+        RedisInstancePool_reapIdle(me);
+        if (me->data._M_nidle + me->data._M_nleased < me->data._M_size) {
+            pthread_mutex_unlock(&me->data._M_mutex);
+            instance = RedisInstancePool_spawn(me);
+            pthread_mutex_lock(&me->data._M_mutex);
+            if (instance) {
+                backoff = REDIS_INSTANCE_POOL_MIN_BACKOFF;
+                if (me->data._M_running) {
+                    me->data._M_idle[me->data._M_nidle++] = instance;
+                    pthread_cond_signal(&me->data._M_available);
+                } else {
+                    RedisInstance_destroy(instance);
+                }
+                instance = NULL;
+                continue;
+            }
+            RedisInstancePool_deadline(&deadline, backoff);
+            pthread_cond_timedwait(&me->data._M_refill, &me->data._M_mutex,
+                    &deadline);
+            backoff = backoff * 2 < REDIS_INSTANCE_POOL_MAX_BACKOFF
+                ? backoff * 2
+                : REDIS_INSTANCE_POOL_MAX_BACKOFF;
+            continue;
+        }
+        RedisInstancePool_deadline(&deadline, REDIS_INSTANCE_POOL_CHECK_INTERVAL);
+        pthread_cond_timedwait(&me->data._M_refill, &me->data._M_mutex,
+                &deadline);
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return NULL;
+}
+
+static
+RedisInstance* RedisInstancePool_acquire(RedisInstancePool *me, long timeout_ms) {
+    RedisInstance *r = NULL;
+    struct timespec deadline;
+    int rc = 0;
+
+    if (timeout_ms >= 0)
+        RedisInstancePool_deadline(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    while (!r && me->data._M_running) {
+        if (me->data._M_nidle > 0) {
+            r = me->data._M_idle[--me->data._M_nidle];
+            me->data._M_idle[me->data._M_nidle] = NULL;
+            if (!RedisInstancePool_isAlive(r)) {
+                RedisInstance_destroy(r);
+                r = NULL;
+                pthread_cond_signal(&me->data._M_refill);
+                continue;
+            }
+            ++me->data._M_nleased;
+            break;
+        }
+        if (timeout_ms < 0)
+            rc = pthread_cond_wait(&me->data._M_available, &me->data._M_mutex);
+        else
+            rc = pthread_cond_timedwait(&me->data._M_available,
+                    &me->data._M_mutex, &deadline);
+        if (rc == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return r;
+}
+
+static
+int RedisInstancePool_release(RedisInstancePool *me, RedisInstance *instance) {
+    int reusable = 0;
+
+    if (!instance)
+        return 0;
+    reusable = RedisInstancePool_isAlive(instance)
+        && RedisInstancePool_reset(instance);
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    if (me->data._M_nleased > 0)
+        --me->data._M_nleased;
+    if (reusable && me->data._M_running) {
+        me->data._M_idle[me->data._M_nidle++] = instance;
+        instance = NULL;
+        pthread_cond_signal(&me->data._M_available);
+    } else {
+        pthread_cond_signal(&me->data._M_refill);
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    return reusable;
+}
+
+static
+size_t RedisInstancePool_getSize(RedisInstancePool const *me) {
+    return me->data._M_size;
+}
+
+static
+size_t RedisInstancePool_getIdleCount(RedisInstancePool *me) {
+    size_t n = 0;
+    pthread_mutex_lock(&me->data._M_mutex);
+    n = me->data._M_nidle;
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return n;
+}
+
+void RedisInstancePool_destroy(RedisInstancePool *me) {
+    size_t i = 0;
+    if (me) {
+        if (me->data._M_started) {
+            pthread_mutex_lock(&me->data._M_mutex);
+            me->data._M_running = 0;
+            pthread_cond_broadcast(&me->data._M_refill);
+            pthread_cond_broadcast(&me->data._M_available);
+            pthread_mutex_unlock(&me->data._M_mutex);
+            pthread_join(me->data._M_thread, NULL);
+            me->data._M_started = 0;
+        }
+        if (me->data._M_idle) {
+            for (i = 0; i < me->data._M_nidle; ++i)
+                RedisInstance_destroy(me->data._M_idle[i]);
+            free(me->data._M_idle);
+            me->data._M_idle = NULL;
+        }
+        if (me->data._M_builder) {
+            RedisServerBuilder_destroy(me->data._M_builder);
+            me->data._M_builder = NULL;
+        }
+        pthread_cond_destroy(&me->data._M_refill);
+        pthread_cond_destroy(&me->data._M_available);
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me);
+    }
+}
+
+RedisInstancePool* RedisInstancePool_create(RedisServerBuilder const *builder,
+        size_t size) {
+    RedisInstancePool *r = NULL;
+    RedisInstancePool *pool = NULL;
+    pthread_condattr_t attr;
+
+    if (!builder || size < 1)
+        goto failure;
+
+    pool = (RedisInstancePool*) calloc(1, sizeof(*pool));
+    if (!pool)
+        goto failure;
+    pthread_mutex_init(&pool->data._M_mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->data._M_available, &attr);
+    pthread_cond_init(&pool->data._M_refill, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pool->calls.acquire = &RedisInstancePool_acquire;
+    pool->calls.release = &RedisInstancePool_release;
+    pool->calls.getSize = &RedisInstancePool_getSize;
+    pool->calls.getIdleCount = &RedisInstancePool_getIdleCount;
+
+    pool->data._M_size = size;
+    pool->data._M_idle = (RedisInstance**) calloc(size, sizeof(*pool->data._M_idle));
+    if (!pool->data._M_idle)
+        goto failure;
+    pool->data._M_builder = builder->calls.clone(builder);
+    if (!pool->data._M_builder)
+        goto failure;
+
+    pool->data._M_running = 1;
+    if (LibraryThread_create(&pool->data._M_thread, NULL,
+                &RedisInstancePool_run, pool) != 0) {
+        pool->data._M_running = 0;
+        goto failure;
+    }
+    pool->data._M_started = 1;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = pool;
+    pool = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (pool) {
+        RedisInstancePool_destroy(pool);
+        pool = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,61 @@
+#ifndef REDISINSTANCEPOOL_H_INCLUDED
+#define REDISINSTANCEPOOL_H_INCLUDED
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "redisserverbuilder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Keeps a fixed number of identical redis-server instances warm.
+     *
+     * Every instance is built from a private copy of the template builder
+     * with its own port. Instances are handed out by acquire, brought back
+     * to their initial state by release (RedisInstance reset) and replaced
+     * by a background thread whenever one of them dies or cannot be reset.
+     */
+
+    struct tagRedisInstancePool;
+
+    typedef struct tagRedisInstancePool RedisInstancePool;
+
+    struct tagRedisInstancePool {
+        struct {
+            /* wait up to timeout_ms (< 0 waits forever) for an idle instance */
+            RedisInstance*  (*acquire)      (RedisInstancePool*, long timeout_ms);
+            /* give a leased instance back, it is reset before reuse */
+            int             (*release)      (RedisInstancePool*, RedisInstance*);
+            size_t          (*getSize)      (RedisInstancePool const*);
+            size_t          (*getIdleCount) (RedisInstancePool*);
+        } calls;
+
+        struct {
+            RedisServerBuilder *_M_builder;
+            size_t              _M_size;
+            RedisInstance     **_M_idle;
+            size_t              _M_nidle;
+            size_t              _M_nleased;
+            int                 _M_running;
+            int                 _M_started;
+            pthread_t           _M_thread;
+            pthread_mutex_t     _M_mutex;
+            /* signaled when an instance becomes idle */
+            pthread_cond_t      _M_available;
+            /* signaled when the pool shrinks below its size */
+            pthread_cond_t      _M_refill;
+        } data;
+    };
+
+    extern RedisInstancePool*   RedisInstancePool_create(RedisServerBuilder const*, size_t size);
+    /* leased instances must be released before the pool is destroyed */
+    extern void                 RedisInstancePool_destroy(RedisInstancePool*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REDISINSTANCEPOOL_H_INCLUDED */
@@ -0,0 +1,542 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <poll.h>
+#   include <unistd.h>
+#endif
+
+#include "redisloadgenerator.h"
+#include "redisclient.h"
+#include "librarythread.h"
+
+#define LOG_TAG "RedisLoadGenerator"
+#include "logging.h"
+
+#define REDIS_LOAD_DEFAULT_CONNECTIONS  4
+#define REDIS_LOAD_DEFAULT_KEYS         10000L
+#define REDIS_LOAD_DEFAULT_VALUE_SIZE   3
+#define REDIS_LOAD_DEFAULT_DURATION     1000L
+#define REDIS_LOAD_CONNECT_TIMEOUT      5000L
+/* a reply later than this means the server is gone (ms) */
+#define REDIS_LOAD_REPLY_TIMEOUT        10000
+#define REDIS_LOAD_ZIPFIAN_THETA        0.99
+
+/* state shared by the threads of one run */
+typedef struct {
+    RedisLoadGenerator const *generator;
+    /* 0 when there is no duration limit */
+    long    deadline;
+    /* commands left to send when there is a request limit */
+    long    remaining;
+    /* value_max 'x' characters, shorter values are suffixes of it */
+    char   *value;
+    int     weights;
+    double  zetan;
+    double  eta;
+} RedisLoadRun;
+
+typedef struct {
+    RedisLoadRun       *run;
+    int                 connections;
+    unsigned long long  rng;
+    long                next_key;
+    LatencyHistogram   *histogram;
+    long                ops;
+    long                errors;
+    int                 failed;
+    int                 started;
+    pthread_t           thread;
+} RedisLoadWorker;
+
+static
+long RedisLoadGenerator_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/* xorshift64*, plenty for picking keys and commands */
+static
+unsigned long long RedisLoadGenerator_random(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static
+double RedisLoadGenerator_uniform(unsigned long long *state) {
+    return (RedisLoadGenerator_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static
+long RedisLoadGenerator_key(RedisLoadWorker *worker) {
+    RedisLoadRun *run = worker->run;
+    long n = run->generator->data._M_keys;
+    double u = 0;
+    double uz = 0;
+    long key = 0;
+
+    switch (run->generator->data._M_distribution) {
+        case REDIS_LOAD_KEYS_SEQUENTIAL:
+            key = worker->next_key;
+            worker->next_key = (worker->next_key + 1) % n;
+            return key;
+        case REDIS_LOAD_KEYS_ZIPFIAN:
+            /* Gray et al., "Quickly Generating Billion-Record Synthetic Databases" */
+            u = RedisLoadGenerator_uniform(&worker->rng);
+            uz = u * run->zetan;
+            if (uz < 1.0)
+                return 0;
+            if (uz < 1.0 + pow(0.5, REDIS_LOAD_ZIPFIAN_THETA))
+                return n > 1 ? 1 : 0;
+            key = (long) (n * pow(run->eta * u - run->eta + 1.0,
+                        1.0 / (1.0 - REDIS_LOAD_ZIPFIAN_THETA)));
+            return key < n ? key : n - 1;
+        default:
+            return (long) (RedisLoadGenerator_random(&worker->rng) % (unsigned long long) n);
+    }
+}
+
+/* queue one command picked from the mix */
+static
+int RedisLoadGenerator_append(RedisLoadWorker *worker, RedisClient *client) {
+    RedisLoadGenerator const *gen = worker->run->generator;
+    int pick = 0;
+    int command = 0;
+    size_t size = 0;
+    char key[32];
+    char const *argv[4] = { NULL, NULL, NULL, NULL };
+
+    pick = (int) (RedisLoadGenerator_random(&worker->rng)
+            % (unsigned long long) worker->run->weights);
+    for (command = 0; command < REDIS_LOAD_COMMANDS - 1; ++command) {
+        if (pick < gen->data._M_mix[command])
+            break;
+        pick -= gen->data._M_mix[command];
+    }
+    argv[1] = &key[0];
+    switch (command) {
+        case REDIS_LOAD_PING:
+            argv[0] = "PING";
+            argv[1] = NULL;
+            break;
+        case REDIS_LOAD_GET:
+            argv[0] = "GET";
+            snprintf(&key[0], sizeof(key), "key:%ld", RedisLoadGenerator_key(worker));
+            break;
+        case REDIS_LOAD_SET:
+            argv[0] = "SET";
+            snprintf(&key[0], sizeof(key), "key:%ld", RedisLoadGenerator_key(worker));
+            size = gen->data._M_value_min;
+            if (gen->data._M_value_max > size)
+                size += (size_t) (RedisLoadGenerator_random(&worker->rng)
+                        % (gen->data._M_value_max - size + 1));
+            argv[2] = worker->run->value + (gen->data._M_value_max - size);
+            break;
+        case REDIS_LOAD_DEL:
+            argv[0] = "DEL";
+            snprintf(&key[0], sizeof(key), "key:%ld", RedisLoadGenerator_key(worker));
+            break;
+        default:
+            argv[0] = "INCR";
+            snprintf(&key[0], sizeof(key), "counter:%ld", RedisLoadGenerator_key(worker));
+            break;
+    }
+    return client->calls.append(client, argv);
+}
+
+/* how many commands the next pipeline may carry, 0 once the run is over */
+static
+long RedisLoadGenerator_reserve(RedisLoadWorker *worker) {
+    RedisLoadRun *run = worker->run;
+    long depth = run->generator->data._M_pipeline;
+    long before = 0;
+
+    if (run->deadline && RedisLoadGenerator_now() >= run->deadline)
+        return 0;
+    if (run->generator->data._M_requests == 0)
+        return depth;
+    before = __sync_fetch_and_sub(&run->remaining, depth);
+    if (before <= 0)
+        return 0;
+    return before < depth ? before : depth;
+}
+
+static
+void* RedisLoadGenerator_work(void *arg) {
+    RedisLoadWorker *worker = (RedisLoadWorker*) arg;
+    RedisInstance const *target = worker->run->generator->data._M_target;
+    int n = worker->connections;
+    int i = 0;
+    int busy = 0;
+    int stopping = 0;
+    int rc = 0;
+    long j = 0;
+    long batch = 0;
+    long now = 0;
+    RedisClient **clients = NULL;
+    struct pollfd *pfds = NULL;
+    long *outstanding = NULL;
+    long *sent = NULL;
+    RedisClientReply *reply = NULL;
+
+    clients = (RedisClient**) calloc(n, sizeof(*clients));
+    pfds = (struct pollfd*) calloc(n, sizeof(*pfds));
+    outstanding = (long*) calloc(n, sizeof(*outstanding));
+    sent = (long*) calloc(n, sizeof(*sent));
+    if (!clients || !pfds || !outstanding || !sent)
+        goto failure;
+    for (i = 0; i < n; ++i) {
+        clients[i] = target->calls.connect(target, REDIS_LOAD_CONNECT_TIMEOUT);
+        if (!clients[i])
+            goto failure;
+        pfds[i].fd = clients[i]->calls.getFD(clients[i]);
+        pfds[i].events = POLLIN;
+    }
+
+    for (;;) {
+        busy = 0;
+        for (i = 0; i < n; ++i) {
+            if (outstanding[i] == 0 && !stopping) {
+                batch = RedisLoadGenerator_reserve(worker);
+                if (batch == 0) {
+                    stopping = 1;
+                } else {
+                    for (j = 0; j < batch; ++j) {
+                        if (!RedisLoadGenerator_append(worker, clients[i]))
+                            goto failure;
+                    }
+                    if (!clients[i]->calls.flush(clients[i]))
+                        goto failure;
+                    sent[i] = RedisLoadGenerator_now();
+                    outstanding[i] = batch;
+                }
+            }
+            /* a negative fd makes poll skip idle connections */
+            pfds[i].fd = outstanding[i] > 0 ? clients[i]->calls.getFD(clients[i]) : -1;
+            pfds[i].revents = 0;
+            if (outstanding[i] > 0) {
+                ++busy;
+                /* replies parsed ahead are already in the buffer */
+                if (clients[i]->calls.getBuffered(clients[i]) > 0)
+                    pfds[i].revents = POLLIN;
+            }
+        }
+        if (busy == 0)
+            break;
+
+        for (i = 0; i < n && pfds[i].revents == 0; ++i)
+            ;
+        if (i == n) {
+            do {
+                rc = poll(pfds, n, REDIS_LOAD_REPLY_TIMEOUT);
+            } while (rc < 0 && errno == EINTR);
+            if (rc <= 0) {
+                LOGE("no reply within %d ms", REDIS_LOAD_REPLY_TIMEOUT);
+                goto failure;
+            }
+        }
+
+        for (i = 0; i < n; ++i) {
+            if (outstanding[i] == 0 || pfds[i].revents == 0)
+                continue;
+            /* take every complete reply that arrived with this read */
+            do {
+                reply = clients[i]->calls.getReply(clients[i]);
+                if (!reply)
+                    goto failure;
+                now = RedisLoadGenerator_now();
+                worker->histogram->calls.record(worker->histogram, now - sent[i]);
+                if (reply->type == REDIS_CLIENT_REPLY_ERROR)
+                    ++worker->errors;
+                ++worker->ops;
+                --outstanding[i];
+                RedisClientReply_destroy(reply);
+                reply = NULL;
+            } while (outstanding[i] > 0 && clients[i]->calls.getBuffered(clients[i]) > 0);
+        }
+    }
+
+    goto success;
+exit:
+    return NULL;
+success:
+    goto cleanup;
+failure:
+    LOGE("load connection failed after %ld commands", worker->ops);
+    worker->failed = 1;
+    /* stop the other threads as well */
+    __sync_lock_test_and_set(&worker->run->deadline, 1);
+    __sync_lock_test_and_set(&worker->run->remaining, 0);
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    if (clients) {
+        for (i = 0; i < n; ++i)
+            RedisClient_destroy(clients[i]);
+        free(clients);
+        clients = NULL;
+    }
+    free(pfds);
+    free(outstanding);
+    free(sent);
+    goto exit;
+}
+
+static
+int RedisLoadGenerator_run(RedisLoadGenerator *me, RedisLoadReport *report) {
+    int rc = 0;
+    int i = 0;
+    int nthreads = me->data._M_threads;
+    long k = 0;
+    long started = 0;
+    long elapsed = 0;
+    long ops = 0;
+    long errors = 0;
+    RedisLoadRun run;
+    RedisLoadWorker *workers = NULL;
+    LatencyHistogram *h = me->data._M_histogram;
+
+    memset(&run, 0, sizeof(run));
+    run.generator = me;
+    for (i = 0; i < REDIS_LOAD_COMMANDS; ++i)
+        run.weights += me->data._M_mix[i];
+    if (run.weights == 0 || (me->data._M_duration == 0 && me->data._M_requests == 0))
+        goto failure;
+    if (nthreads > me->data._M_connections)
+        nthreads = me->data._M_connections;
+
+    run.value = (char*) malloc(me->data._M_value_max + 1);
+    workers = (RedisLoadWorker*) calloc(nthreads, sizeof(*workers));
+    if (!run.value || !workers)
+        goto failure;
+    memset(run.value, 'x', me->data._M_value_max);
+    run.value[me->data._M_value_max] = '\0';
+    run.remaining = me->data._M_requests;
+    if (me->data._M_distribution == REDIS_LOAD_KEYS_ZIPFIAN) {
+        for (k = 1; k <= me->data._M_keys; ++k)
+            run.zetan += 1.0 / pow((double) k, REDIS_LOAD_ZIPFIAN_THETA);
+        run.eta = (1.0 - pow(2.0 / me->data._M_keys, 1.0 - REDIS_LOAD_ZIPFIAN_THETA))
+            / (1.0 - (1.0 + pow(0.5, REDIS_LOAD_ZIPFIAN_THETA)) / run.zetan);
+    }
+
+    h->calls.reset(h);
+    for (i = 0; i < nthreads; ++i) {
+        workers[i].run = &run;
+        workers[i].connections = me->data._M_connections / nthreads
+            + (i < me->data._M_connections % nthreads ? 1 : 0);
+        workers[i].rng = 0x9E3779B97F4A7C15ULL * (unsigned long long) (i + 1);
+        workers[i].next_key = me->data._M_keys / nthreads * i;
+        workers[i].histogram = LatencyHistogram_create();
+        if (!workers[i].histogram)
+            goto failure;
+    }
+
+    started = RedisLoadGenerator_now();
+    if (me->data._M_duration > 0)
+        run.deadline = started + me->data._M_duration * 1000L;
+    for (i = 0; i < nthreads; ++i) {
+        if (LibraryThread_create(&workers[i].thread, NULL,
+                    &RedisLoadGenerator_work, &workers[i]) != 0) {
+            workers[i].failed = 1;
+            __sync_lock_test_and_set(&run.deadline, 1);
+            __sync_lock_test_and_set(&run.remaining, 0);
+            break;
+        }
+        workers[i].started = 1;
+    }
+    for (i = 0; i < nthreads; ++i) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = RedisLoadGenerator_now() - started;
+
+    for (i = 0; i < nthreads; ++i) {
+        h->calls.merge(h, workers[i].histogram);
+        ops += workers[i].ops;
+        errors += workers[i].errors;
+        if (workers[i].failed)
+            goto failure;
+    }
+    if (report) {
+        report->ops = ops;
+        report->errors = errors;
+        report->elapsed_us = elapsed;
+        report->ops_per_sec = elapsed > 0 ? ops * 1e6 / elapsed : 0;
+        report->min_us = h->calls.getMin(h);
+        report->mean_us = h->calls.getMean(h);
+        report->p50_us = h->calls.getPercentile(h, 50);
+        report->p90_us = h->calls.getPercentile(h, 90);
+        report->p99_us = h->calls.getPercentile(h, 99);
+        report->p999_us = h->calls.getPercentile(h, 99.9);
+        report->max_us = h->calls.getMax(h);
+    }
+    LOGI("%ld ops in %ld ms, %.0f ops/sec", ops, elapsed / 1000L,
+            elapsed > 0 ? ops * 1e6 / elapsed : 0);
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (workers) {
+        for (i = 0; i < nthreads; ++i)
+            LatencyHistogram_destroy(workers[i].histogram);
+        free(workers);
+        workers = NULL;
+    }
+    free(run.value);
+    goto exit;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setThreads(RedisLoadGenerator *me, int n) {
+    if (n < 1)
+        return NULL;
+    me->data._M_threads = n;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setConnections(RedisLoadGenerator *me, int n) {
+    if (n < 1)
+        return NULL;
+    me->data._M_connections = n;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setPipeline(RedisLoadGenerator *me, int depth) {
+    if (depth < 1)
+        return NULL;
+    me->data._M_pipeline = depth;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setKeySpace(RedisLoadGenerator *me,
+        long keys, int distribution) {
+    if (keys < 1 || distribution < REDIS_LOAD_KEYS_UNIFORM
+            || distribution > REDIS_LOAD_KEYS_ZIPFIAN)
+        return NULL;
+    me->data._M_keys = keys;
+    me->data._M_distribution = distribution;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setValueSize(RedisLoadGenerator *me,
+        size_t min, size_t max) {
+    if (min > max)
+        return NULL;
+    me->data._M_value_min = min;
+    me->data._M_value_max = max;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setMix(RedisLoadGenerator *me,
+        int command, int weight) {
+    if (command < 0 || command >= REDIS_LOAD_COMMANDS || weight < 0)
+        return NULL;
+    me->data._M_mix[command] = weight;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setDuration(RedisLoadGenerator *me,
+        long milliseconds) {
+    if (milliseconds < 0)
+        return NULL;
+    me->data._M_duration = milliseconds;
+    return me;
+}
+
+static
+RedisLoadGenerator* RedisLoadGenerator_setRequests(RedisLoadGenerator *me, long n) {
+    if (n < 0)
+        return NULL;
+    me->data._M_requests = n;
+    return me;
+}
+
+static
+LatencyHistogram const* RedisLoadGenerator_getHistogram(RedisLoadGenerator const *me) {
+    return me->data._M_histogram;
+}
+
+void RedisLoadGenerator_destroy(RedisLoadGenerator *me) {
+    if (me) {
+        if (me->data._M_histogram) {
+            LatencyHistogram_destroy(me->data._M_histogram);
+            me->data._M_histogram = NULL;
+        }
+        free(me);
+    }
+}
+
+RedisLoadGenerator* RedisLoadGenerator_create(RedisInstance const *target) {
+    RedisLoadGenerator *r = NULL;
+    RedisLoadGenerator *instance = NULL;
+
+    if (!target)
+        goto failure;
+    instance = (RedisLoadGenerator*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.setThreads = &RedisLoadGenerator_setThreads;
+    instance->calls.setConnections = &RedisLoadGenerator_setConnections;
+    instance->calls.setPipeline = &RedisLoadGenerator_setPipeline;
+    instance->calls.setKeySpace = &RedisLoadGenerator_setKeySpace;
+    instance->calls.setValueSize = &RedisLoadGenerator_setValueSize;
+    instance->calls.setMix = &RedisLoadGenerator_setMix;
+    instance->calls.setDuration = &RedisLoadGenerator_setDuration;
+    instance->calls.setRequests = &RedisLoadGenerator_setRequests;
+    instance->calls.run = &RedisLoadGenerator_run;
+    instance->calls.getHistogram = &RedisLoadGenerator_getHistogram;
+
+    instance->data._M_target = target;
+    instance->data._M_threads = 1;
+    instance->data._M_connections = REDIS_LOAD_DEFAULT_CONNECTIONS;
+    instance->data._M_pipeline = 1;
+    instance->data._M_keys = REDIS_LOAD_DEFAULT_KEYS;
+    instance->data._M_distribution = REDIS_LOAD_KEYS_UNIFORM;
+    instance->data._M_value_min = REDIS_LOAD_DEFAULT_VALUE_SIZE;
+    instance->data._M_value_max = REDIS_LOAD_DEFAULT_VALUE_SIZE;
+    instance->data._M_mix[REDIS_LOAD_GET] = 1;
+    instance->data._M_mix[REDIS_LOAD_SET] = 1;
+    instance->data._M_duration = REDIS_LOAD_DEFAULT_DURATION;
+    instance->data._M_histogram = LatencyHistogram_create();
+    if (!instance->data._M_histogram)
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisLoadGenerator_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,123 @@
+#ifndef REDISLOADGENERATOR_H_INCLUDED
+#define REDISLOADGENERATOR_H_INCLUDED
+
+#include <stddef.h>
+
+#include "redisserverbuilder.h"
+#include "latencyhistogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Closed loop load generator driving a RedisInstance.
+     *
+     * Each thread owns a share of the connections and keeps every one of
+     * them loaded with a pipeline of commands drawn from the mix, refilling
+     * a connection as soon as its last reply arrived. The latency of a
+     * command is the time from sending its pipeline to reading its reply,
+     * as redis-benchmark counts it. Replies are read over plain sockets
+     * with RedisClient, so the library still needs no hiredis.
+     */
+
+    struct tagRedisLoadGenerator;
+    struct tagRedisLoadReport;
+
+    typedef struct tagRedisLoadGenerator RedisLoadGenerator;
+    typedef struct tagRedisLoadReport RedisLoadReport;
+
+    /* commands of the mix */
+    enum {
+        REDIS_LOAD_PING = 0,
+        /* GET / SET / DEL key:<n> */
+        REDIS_LOAD_GET,
+        REDIS_LOAD_SET,
+        REDIS_LOAD_DEL,
+        /* INCR counter:<n>, kept apart from the string values of SET */
+        REDIS_LOAD_INCR,
+        REDIS_LOAD_COMMANDS
+    };
+
+    /* how key numbers are drawn from the key space */
+    enum {
+        REDIS_LOAD_KEYS_UNIFORM = 0,
+        /* every thread walks the key space in order */
+        REDIS_LOAD_KEYS_SEQUENTIAL,
+        /* YCSB zipfian (theta 0.99), low key numbers are the hot ones */
+        REDIS_LOAD_KEYS_ZIPFIAN
+    };
+
+    struct tagRedisLoadReport {
+        long    ops;
+        /* error replies, they are counted in ops as well */
+        long    errors;
+        long    elapsed_us;
+        double  ops_per_sec;
+        long    min_us;
+        double  mean_us;
+        long    p50_us;
+        long    p90_us;
+        long    p99_us;
+        long    p999_us;
+        long    max_us;
+    };
+
+    struct tagRedisLoadGenerator {
+        struct {
+            RedisLoadGenerator* (*setThreads)   (RedisLoadGenerator*, int);
+            /* total, spread over the threads, at least one per thread */
+            RedisLoadGenerator* (*setConnections)(RedisLoadGenerator*, int);
+            /* commands in flight per connection */
+            RedisLoadGenerator* (*setPipeline)  (RedisLoadGenerator*, int depth);
+            RedisLoadGenerator* (*setKeySpace)  (RedisLoadGenerator*, long keys,
+                                                 int distribution);
+            /* SET value sizes, uniform in [min, max] */
+            RedisLoadGenerator* (*setValueSize) (RedisLoadGenerator*, size_t min,
+                                                 size_t max);
+            /* relative weight of a REDIS_LOAD_* command, 0 removes it */
+            RedisLoadGenerator* (*setMix)       (RedisLoadGenerator*, int command,
+                                                 int weight);
+            /* stop sending after this long (ms), 0 for no limit */
+            RedisLoadGenerator* (*setDuration)  (RedisLoadGenerator*, long);
+            /* stop after this many commands, 0 for no limit */
+            RedisLoadGenerator* (*setRequests)  (RedisLoadGenerator*, long);
+            /*
+             * Run the load and fill report (optional). Returns 1 on
+             * success, 0 if a connection failed or no limit is set.
+             */
+            int                 (*run)          (RedisLoadGenerator*, RedisLoadReport*);
+            /* latencies (us) of every command of the last run */
+            LatencyHistogram const*
+                                (*getHistogram) (RedisLoadGenerator const*);
+        } calls;
+
+        struct {
+            RedisInstance const *_M_target;
+            int                 _M_threads;
+            int                 _M_connections;
+            int                 _M_pipeline;
+            long                _M_keys;
+            int                 _M_distribution;
+            size_t              _M_value_min;
+            size_t              _M_value_max;
+            int                 _M_mix[REDIS_LOAD_COMMANDS];
+            long                _M_duration;
+            long                _M_requests;
+            LatencyHistogram   *_M_histogram;
+        } data;
+    };
+
+    /*
+     * target must outlive the generator. Defaults to 1 thread with 4
+     * connections, no pipelining, 10000 uniform keys, 3 byte values, an
+     * even GET/SET mix and a 1 second run.
+     */
+    extern RedisLoadGenerator*  RedisLoadGenerator_create(RedisInstance const *target);
+    extern void                 RedisLoadGenerator_destroy(RedisLoadGenerator*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REDISLOADGENERATOR_H_INCLUDED */
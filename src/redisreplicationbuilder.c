@@ -0,0 +1,573 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "redisreplicationbuilder.h"
+#include "redisclient.h"
+
+#define LOG_TAG "RedisReplicationBuilder"
+#include "logging.h"
+
+#define REDIS_REPLICATION_DEFAULT_REPLICAS  2
+#define REDIS_REPLICATION_DEFAULT_TIMEOUT   30000L
+/* reply timeout of the setup connections (ms) */
+#define REDIS_REPLICATION_COMMAND_TIMEOUT   5000L
+/* sync polling backoff (ms) */
+#define REDIS_REPLICATION_MIN_DELAY         10L
+#define REDIS_REPLICATION_MAX_DELAY         200L
+/* key whose value tells which lag sample a replica has reached */
+#define REDIS_REPLICATION_MARKER_KEY        "__replication_lag__"
+
+static
+long RedisReplicationBuilder_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+static
+void RedisReplicationBuilder_sleep(long microseconds) {
+    struct timespec ts;
+    ts.tv_sec = microseconds / 1000000L;
+    ts.tv_nsec = (microseconds % 1000000L) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+static
+RedisInstance* RedisReplication_getMaster(RedisReplication const *me) {
+    return me->data._M_nodes[0];
+}
+
+static
+size_t RedisReplication_getReplicaCount(RedisReplication const *me) {
+    return me->data._M_count;
+}
+
+static
+RedisInstance* RedisReplication_getReplica(RedisReplication const *me, size_t i) {
+    return i < me->data._M_count ? me->data._M_nodes[i + 1] : NULL;
+}
+
+static
+long RedisReplication_getUpstream(RedisReplication const *me, size_t i) {
+    return me->data._M_chained && i > 0 ? (long) i - 1 : -1;
+}
+
+/* value of field in an INFO replication reply, 0 if it is missing */
+static
+int RedisReplicationBuilder_info(RedisClient *client, char const *field,
+        char *value, size_t size) {
+    int rc = 0;
+    char const *p = NULL;
+    size_t len = strlen(field);
+    size_t n = 0;
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.commandv(client, "INFO", "replication", NULL);
+    if (!reply || !reply->str)
+        goto failure;
+    for (p = reply->str; (p = strstr(p, field)) != NULL; p += len) {
+        if ((p == reply->str || p[-1] == '\n') && p[len] == ':')
+            break;
+    }
+    if (!p)
+        goto failure;
+    p += len + 1;
+    while (p[n] && p[n] != '\r' && p[n] != '\n' && n + 1 < size) {
+        value[n] = p[n];
+        ++n;
+    }
+    value[n] = '\0';
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    goto exit;
+}
+
+static
+int RedisReplicationBuilder_offset(RedisClient *client, char const *field,
+        long long *offset) {
+    char value[32];
+
+    if (!RedisReplicationBuilder_info(client, field, &value[0], sizeof(value)))
+        return 0;
+    *offset = strtoll(&value[0], NULL, 10);
+    return 1;
+}
+
+/*
+ * Poll every replica until its link is up, then until its offset reached
+ * the master offset as of that moment.
+ */
+static
+int RedisReplicationBuilder_waitSync(RedisClient *master, RedisClient **clients,
+        size_t n, long deadline) {
+    size_t i = 0;
+    long delay = REDIS_REPLICATION_MIN_DELAY;
+    long long target = 0;
+    long long offset = 0;
+    char value[16];
+
+    while (i < n) {
+        if (RedisReplicationBuilder_info(clients[i], "master_link_status",
+                    &value[0], sizeof(value)) && strcmp(&value[0], "up") == 0) {
+            ++i;
+            continue;
+        }
+        if (RedisReplicationBuilder_now() >= deadline) {
+            LOGE("replica %lu never reported master_link_status:up",
+                    (unsigned long) i);
+            return 0;
+        }
+        RedisReplicationBuilder_sleep(delay * 1000L);
+        delay = delay * 2 < REDIS_REPLICATION_MAX_DELAY
+            ? delay * 2
+            : REDIS_REPLICATION_MAX_DELAY;
+    }
+
+    if (!RedisReplicationBuilder_offset(master, "master_repl_offset", &target))
+        return 0;
+    delay = REDIS_REPLICATION_MIN_DELAY;
+    i = 0;
+    while (i < n) {
+        if (RedisReplicationBuilder_offset(clients[i], "slave_repl_offset", &offset)
+                && offset >= target) {
+            ++i;
+            continue;
+        }
+        if (RedisReplicationBuilder_now() >= deadline) {
+            LOGE("replica %lu stuck at offset %lld of %lld",
+                    (unsigned long) i, offset, target);
+            return 0;
+        }
+        RedisReplicationBuilder_sleep(delay * 1000L);
+        delay = delay * 2 < REDIS_REPLICATION_MAX_DELAY
+            ? delay * 2
+            : REDIS_REPLICATION_MAX_DELAY;
+    }
+    return 1;
+}
+
+/* pipeline n SETs plus the marker of sample, wait for all replies */
+static
+int RedisReplication_write(RedisClient *client, long first, long n,
+        char const *value, long sample) {
+    int rc = 0;
+    long i = 0;
+    char key[48];
+    char marker[24];
+    char const *set[4] = { "SET", NULL, NULL, NULL };
+    RedisClientReply *reply = NULL;
+
+    set[1] = &key[0];
+    set[2] = value;
+    for (i = 0; i < n; ++i) {
+        snprintf(&key[0], sizeof(key), "replication:lag:%ld", first + i);
+        if (!client->calls.append(client, set))
+            goto failure;
+    }
+    snprintf(&marker[0], sizeof(marker), "%ld", sample);
+    set[1] = REDIS_REPLICATION_MARKER_KEY;
+    set[2] = &marker[0];
+    if (!client->calls.append(client, set))
+        goto failure;
+    for (i = 0; i <= n; ++i) {
+        reply = client->calls.getReply(client);
+        if (!reply || reply->type == REDIS_CLIENT_REPLY_ERROR) {
+            LOGE("write to master failed: %s",
+                    reply && reply->str ? reply->str : "no reply");
+            goto failure;
+        }
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    goto exit;
+}
+
+static
+int RedisReplication_measureLag(RedisReplication *me,
+        RedisReplicationLoad const *load, RedisReplicationLag *lags) {
+    int rc = 0;
+    size_t i = 0;
+    size_t seen = 0;
+    size_t n = me->data._M_count;
+    long written = 0;
+    long batch = 0;
+    long sample = 0;
+    long start = 0;
+    long acked = 0;
+    long lag = 0;
+    long due = 0;
+    long deadline = 0;
+    char marker[24];
+    char *value = NULL;
+    char *done = NULL;
+    long long *totals = NULL;
+    RedisClient *master = NULL;
+    RedisClient **clients = NULL;
+    RedisClientReply *reply = NULL;
+
+    if (!load || !lags || load->writes < 0 || load->batch < 1 || load->rate < 0)
+        goto failure;
+    memset(lags, 0, n * sizeof(*lags));
+
+    value = (char*) malloc(load->value_size + 1);
+    done = (char*) calloc(n, sizeof(*done));
+    totals = (long long*) calloc(n, sizeof(*totals));
+    clients = (RedisClient**) calloc(n, sizeof(*clients));
+    if (!value || (n > 0 && (!done || !totals || !clients)))
+        goto failure;
+    memset(value, 'x', load->value_size);
+    value[load->value_size] = '\0';
+
+    master = me->data._M_nodes[0]->calls.connect(me->data._M_nodes[0],
+            REDIS_REPLICATION_COMMAND_TIMEOUT);
+    if (!master)
+        goto failure;
+    for (i = 0; i < n; ++i) {
+        clients[i] = me->data._M_nodes[i + 1]->calls.connect(
+                me->data._M_nodes[i + 1], REDIS_REPLICATION_COMMAND_TIMEOUT);
+        if (!clients[i])
+            goto failure;
+    }
+
+    start = RedisReplicationBuilder_now();
+    while (written < load->writes) {
+        batch = load->writes - written < load->batch
+            ? load->writes - written
+            : load->batch;
+        if (!RedisReplication_write(master, written, batch, value, sample))
+            goto failure;
+        acked = RedisReplicationBuilder_now();
+        deadline = acked + me->data._M_timeout * 1000L;
+        snprintf(&marker[0], sizeof(marker), "%ld", sample);
+
+        /* busy poll, a sleep would dwarf the lag of a local replica */
+        memset(done, 0, n * sizeof(*done));
+        for (seen = 0; seen < n; ) {
+            for (i = 0; i < n; ++i) {
+                if (done[i])
+                    continue;
+                reply = clients[i]->calls.commandv(clients[i], "GET",
+                        REDIS_REPLICATION_MARKER_KEY, NULL);
+                if (!reply)
+                    goto failure;
+                if (RedisClientReply_is(reply, &marker[0])) {
+                    lag = RedisReplicationBuilder_now() - acked;
+                    if (lags[i].samples == 0 || lag < lags[i].min_us)
+                        lags[i].min_us = lag;
+                    if (lag > lags[i].max_us)
+                        lags[i].max_us = lag;
+                    totals[i] += lag;
+                    ++lags[i].samples;
+                    done[i] = 1;
+                    ++seen;
+                }
+                RedisClientReply_destroy(reply);
+                reply = NULL;
+            }
+            if (seen < n && RedisReplicationBuilder_now() >= deadline) {
+                LOGE("replicas did not catch up with sample %ld", sample);
+                goto failure;
+            }
+        }
+
+        written += batch;
+        ++sample;
+        if (load->rate > 0) {
+            due = start + (long) (written * 1000000.0 / load->rate);
+            if (due > RedisReplicationBuilder_now())
+                RedisReplicationBuilder_sleep(due - RedisReplicationBuilder_now());
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        if (lags[i].samples > 0)
+            lags[i].avg_us = (long) (totals[i] / lags[i].samples);
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    if (clients) {
+        for (i = 0; i < n; ++i)
+            RedisClient_destroy(clients[i]);
+        free(clients);
+        clients = NULL;
+    }
+    if (master) {
+        RedisClient_destroy(master);
+        master = NULL;
+    }
+    free(totals);
+    free(done);
+    free(value);
+    goto exit;
+}
+
+void RedisReplication_destroy(RedisReplication *me) {
+    size_t i = 0;
+    if (me) {
+        if (me->data._M_nodes) {
+            for (i = 0; i <= me->data._M_count; ++i)
+                RedisInstance_destroy(me->data._M_nodes[i]);
+            free(me->data._M_nodes);
+            me->data._M_nodes = NULL;
+        }
+        free(me);
+    }
+}
+
+static
+RedisReplication* RedisReplication_create(size_t count, int chained,
+        long timeout) {
+    RedisReplication *r = NULL;
+    RedisReplication *instance = NULL;
+
+    instance = (RedisReplication*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.getMaster = &RedisReplication_getMaster;
+    instance->calls.getReplicaCount = &RedisReplication_getReplicaCount;
+    instance->calls.getReplica = &RedisReplication_getReplica;
+    instance->calls.getUpstream = &RedisReplication_getUpstream;
+    instance->calls.measureLag = &RedisReplication_measureLag;
+    instance->data._M_count = count;
+    instance->data._M_chained = chained;
+    instance->data._M_timeout = timeout;
+    instance->data._M_nodes = (RedisInstance**) calloc(count + 1,
+            sizeof(*instance->data._M_nodes));
+    if (!instance->data._M_nodes)
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisReplication_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
+
+static
+RedisReplication* RedisReplicationBuilder_build(RedisReplicationBuilder const *me,
+        int *status) {
+    RedisReplication *r = NULL;
+    RedisReplication *replication = NULL;
+    int rc = REDIS_SERVER_STATUS_FAILED;
+    size_t i = 0;
+    size_t n = me->data._M_replicas;
+    int *statuses = NULL;
+    long deadline = 0;
+    char port[16];
+    char const *host = NULL;
+    char const *replicaof[4] = { "REPLICAOF", NULL, NULL, NULL };
+    RedisInstance *upstream = NULL;
+    RedisClient *master = NULL;
+    RedisClient **clients = NULL;
+    RedisClientReply *reply = NULL;
+
+    replication = RedisReplication_create(n, me->data._M_chained,
+            me->data._M_timeout);
+    statuses = (int*) calloc(n + 1, sizeof(*statuses));
+    clients = (RedisClient**) calloc(n + 1, sizeof(*clients));
+    if (!replication || !statuses || !clients)
+        goto failure;
+
+    /* master and replicas boot together, the failing status wins */
+    if (me->data._M_template->calls.buildMany(me->data._M_template, n + 1,
+                replication->data._M_nodes, statuses) != n + 1) {
+        for (i = 0; i <= n; ++i) {
+            if (statuses[i] != REDIS_SERVER_STATUS_OK) {
+                rc = statuses[i];
+                break;
+            }
+        }
+        goto failure;
+    }
+    deadline = RedisReplicationBuilder_now() + me->data._M_timeout * 1000L;
+
+    master = replication->data._M_nodes[0]->calls.connect(
+            replication->data._M_nodes[0], REDIS_REPLICATION_COMMAND_TIMEOUT);
+    if (!master)
+        goto failure;
+    for (i = 0; i < n; ++i) {
+        clients[i] = replication->data._M_nodes[i + 1]->calls.connect(
+                replication->data._M_nodes[i + 1], REDIS_REPLICATION_COMMAND_TIMEOUT);
+        if (!clients[i])
+            goto failure;
+        upstream = replication->data._M_nodes[
+            replication->calls.getUpstream(replication, i) + 1];
+        host = upstream->calls.getHost(upstream);
+        snprintf(port, sizeof(port), "%d", upstream->calls.getPort(upstream));
+        /* the replica resolves host itself, an address saves it the lookup */
+        replicaof[1] = host && strcmp(host, "localhost") != 0 ? host : "127.0.0.1";
+        replicaof[2] = port;
+        reply = clients[i]->calls.command(clients[i], replicaof);
+        if (!RedisClientReply_is(reply, "OK")) {
+            LOGE("REPLICAOF failed: %s",
+                    reply && reply->str ? reply->str : "no reply");
+            goto failure;
+        }
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+
+    if (!RedisReplicationBuilder_waitSync(master, clients, n, deadline)) {
+        rc = REDIS_SERVER_STATUS_TIMEDOUT;
+        goto failure;
+    }
+    LOGI("master with %lu %s replicas in sync", (unsigned long) n,
+            me->data._M_chained ? "chained" : "direct");
+
+    goto success;
+exit:
+    if (status)
+        *status = rc;
+    return r;
+success:
+    rc = REDIS_SERVER_STATUS_OK;
+    r = replication;
+    replication = NULL;
+    goto cleanup;
+failure:
+    if (rc == REDIS_SERVER_STATUS_OK)
+        rc = REDIS_SERVER_STATUS_FAILED;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    if (clients) {
+        for (i = 0; i < n; ++i)
+            RedisClient_destroy(clients[i]);
+        free(clients);
+        clients = NULL;
+    }
+    if (master) {
+        RedisClient_destroy(master);
+        master = NULL;
+    }
+    if (statuses) {
+        free(statuses);
+        statuses = NULL;
+    }
+    if (replication) {
+        RedisReplication_destroy(replication);
+        replication = NULL;
+    }
+    goto exit;
+}
+
+static
+RedisReplicationBuilder* RedisReplicationBuilder_setReplicas(RedisReplicationBuilder *me,
+        size_t n) {
+    me->data._M_replicas = n;
+    return me;
+}
+
+static
+RedisReplicationBuilder* RedisReplicationBuilder_setChained(RedisReplicationBuilder *me,
+        int enabled) {
+    me->data._M_chained = enabled ? 1 : 0;
+    return me;
+}
+
+static
+RedisReplicationBuilder* RedisReplicationBuilder_setTimeout(RedisReplicationBuilder *me,
+        long milliseconds) {
+    if (milliseconds <= 0)
+        return NULL;
+    me->data._M_timeout = milliseconds;
+    return me;
+}
+
+void RedisReplicationBuilder_destroy(RedisReplicationBuilder *me) {
+    if (me) {
+        if (me->data._M_template) {
+            RedisServerBuilder_destroy(me->data._M_template);
+            me->data._M_template = NULL;
+        }
+        free(me);
+    }
+}
+
+RedisReplicationBuilder* RedisReplicationBuilder_create(RedisServerBuilder const *tmpl) {
+    RedisReplicationBuilder *r = NULL;
+    RedisReplicationBuilder *instance = NULL;
+    RedisServerBuilder *builder = NULL;
+
+    instance = (RedisReplicationBuilder*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->calls.setReplicas = &RedisReplicationBuilder_setReplicas;
+    instance->calls.setChained = &RedisReplicationBuilder_setChained;
+    instance->calls.setTimeout = &RedisReplicationBuilder_setTimeout;
+    instance->calls.build = &RedisReplicationBuilder_build;
+    instance->data._M_replicas = REDIS_REPLICATION_DEFAULT_REPLICAS;
+    instance->data._M_timeout = REDIS_REPLICATION_DEFAULT_TIMEOUT;
+
+    builder = tmpl ? tmpl->calls.clone(tmpl) : RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    instance->data._M_template = builder;
+    /* replicas sync over TCP, the full sync RDBs must not be shared */
+    if (!builder->calls.setUnixSocketMode(builder, 0)
+            || !builder->calls.setPrivateDir(builder, 1))
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisReplicationBuilder_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,111 @@
+#ifndef REDISREPLICATIONBUILDER_H_INCLUDED
+#define REDISREPLICATIONBUILDER_H_INCLUDED
+
+#include <stddef.h>
+
+#include "redisserverbuilder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Builds one master plus K replicas out of RedisServerBuilder instances.
+     *
+     * All servers are started at once, each one in a private dir so the
+     * RDB files of the full syncs never clash, then attached with
+     * REPLICAOF either to the master or, when chained, to the replica
+     * before them. build returns once every replica reports
+     * master_link_status:up and has caught up with the master offset.
+     */
+
+    struct tagRedisReplication;
+    struct tagRedisReplicationBuilder;
+    struct tagRedisReplicationLoad;
+    struct tagRedisReplicationLag;
+
+    typedef struct tagRedisReplication RedisReplication;
+    typedef struct tagRedisReplicationBuilder RedisReplicationBuilder;
+    typedef struct tagRedisReplicationLoad RedisReplicationLoad;
+    typedef struct tagRedisReplicationLag RedisReplicationLag;
+
+    /* write load of measureLag */
+    struct tagRedisReplicationLoad {
+        /* SETs sent to the master in total */
+        long    writes;
+        /* SETs pipelined between two lag samples */
+        long    batch;
+        size_t  value_size;
+        /* SETs per second, 0 to write as fast as the master answers */
+        long    rate;
+    };
+
+    /* lag of one replica, from the master acking a write to it being readable */
+    struct tagRedisReplicationLag {
+        long    samples;
+        long    min_us;
+        long    max_us;
+        long    avg_us;
+    };
+
+    struct tagRedisReplication {
+        struct {
+            RedisInstance*  (*getMaster)        (RedisReplication const*);
+            size_t          (*getReplicaCount)  (RedisReplication const*);
+            RedisInstance*  (*getReplica)       (RedisReplication const*, size_t i);
+            /* index of the replica that replica i follows, -1 for the master */
+            long            (*getUpstream)      (RedisReplication const*, size_t i);
+            /*
+             * Run load against the master and sample after every batch how
+             * long each replica takes to see it. lags receives one entry per
+             * replica. The written keys are left in place. Returns 1 on
+             * success, 0 if a replica fell behind past the build timeout.
+             */
+            int             (*measureLag)       (RedisReplication*,
+                                                 RedisReplicationLoad const *load,
+                                                 RedisReplicationLag *lags);
+        } calls;
+
+        struct {
+            /* master first, replica i at i + 1 */
+            RedisInstance **_M_nodes;
+            size_t          _M_count;
+            int             _M_chained;
+            long            _M_timeout;
+        } data;
+    };
+
+    struct tagRedisReplicationBuilder {
+        struct {
+            RedisReplicationBuilder*    (*setReplicas)  (RedisReplicationBuilder*, size_t);
+            /* attach replica i to replica i - 1 instead of the master */
+            RedisReplicationBuilder*    (*setChained)   (RedisReplicationBuilder*, int enabled);
+            /* how long build waits for the replicas to sync (ms) */
+            RedisReplicationBuilder*    (*setTimeout)   (RedisReplicationBuilder*, long);
+            /* status (optional) receives one of REDIS_SERVER_STATUS_* */
+            RedisReplication*           (*build)        (RedisReplicationBuilder const*, int *status);
+        } calls;
+
+        struct {
+            RedisServerBuilder *_M_template;
+            size_t              _M_replicas;
+            int                 _M_chained;
+            long                _M_timeout;
+        } data;
+    };
+
+    /*
+     * template (may be NULL) supplies the options of every server, it is
+     * copied. Defaults to 2 replicas attached to the master.
+     */
+    extern RedisReplicationBuilder* RedisReplicationBuilder_create(RedisServerBuilder const *tmpl);
+    extern void                     RedisReplicationBuilder_destroy(RedisReplicationBuilder*);
+
+    /* stops the master and every replica */
+    extern void                     RedisReplication_destroy(RedisReplication*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REDISREPLICATIONBUILDER_H_INCLUDED */
@@ -1,107 +1,2224 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <sys/wait.h>
+#   include <sys/stat.h>
+#   include <sys/ioctl.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <netdb.h>
+#   include <poll.h>
+#   include <ftw.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#   include <sched.h>
+#   include <sys/mman.h>
+#   include <linux/fs.h>
+#endif
+
+#include "redisserverbuilder.h"
+#include "redisclient.h"
+#include "portallocator.h"
+
+#define LOG_TAG "RedisServerBuilder"
+#include "logging.h"
+
+#define REDIS_SERVER_DEFAULT_PORT           6379
+#define REDIS_SERVER_DEFAULT_READY_TIMEOUT  10000L
+/* readiness probe backoff, doubled after every failed probe */
+#define REDIS_SERVER_PROBE_MIN_DELAY        1L
+#define REDIS_SERVER_PROBE_MAX_DELAY        100L
+/* starts on an allocated port that somebody else grabbed meanwhile */
+#define REDIS_SERVER_PORT_ATTEMPTS          3
+/* the cluster bus listens on the data port plus this offset */
+#define REDIS_SERVER_CLUSTER_BUS_OFFSET     10000
+/* data ports tried for a cluster node before giving up on its bus port */
+#define REDIS_SERVER_BUS_ATTEMPTS           16
+/* reply timeout of the control connection kept by RedisInstance */
+#define REDIS_INSTANCE_COMMAND_TIMEOUT      5000L
+/* how long RedisInstance_destroy waits before it sends SIGKILL (ms) */
+#define REDIS_INSTANCE_SHUTDOWN_TIMEOUT     30000L
+/* exit re-check interval for servers that have no pidfd (ms) */
+#define REDIS_INSTANCE_EXIT_POLL_INTERVAL   10L
+/* tmpfs the private dirs of setMemoryDir go to */
+#define REDIS_SERVER_MEMORY_DIR             "/dev/shm"
+/* output lines logged of a failed launch, how long to wait for them (ms) */
+#define REDIS_SERVER_OUTPUT_TAIL            20
+#define REDIS_SERVER_OUTPUT_DRAIN_TIMEOUT   100
+/* cpu.max period the cpu limit of setLimits is given for (us) */
+#define REDIS_SERVER_CPU_PERIOD             100000L
+
+static
+long RedisServerBuilder_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+char const* RedisServerBuilder_getStatusString(int status) {
+    switch (status) {
+        case REDIS_SERVER_STATUS_OK:
+            return "ok";
+        case REDIS_SERVER_STATUS_FAILED:
+            return "failed";
+        case REDIS_SERVER_STATUS_NOT_FOUND:
+            return "executable not found";
+        case REDIS_SERVER_STATUS_EXITED:
+            return "exited before ready";
+        case REDIS_SERVER_STATUS_TIMEDOUT:
+            return "timed out waiting for ready";
+        case REDIS_SERVER_STATUS_SPAWN_FAILED:
+            return "spawn failed";
+        default:
+            break;
+    }
+    return "<UNKNOWN>";
+}
+
+/*
+ * Process wide cache of the PATH lookup, shared by all builders. The entry
+ * holds while PATH is unchanged and the file found is still the same
+ * executable (device, inode and mtime), revalidating it costs one stat and
+ * one access instead of a probe per PATH directory.
+ */
+static pthread_mutex_t RedisServerBuilder_cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    char           *path;
+    char           *found;
+    dev_t           dev;
+    ino_t           ino;
+    struct timespec mtime;
+} RedisServerBuilder_cache;
+
+/*
+ * Next slot of REDIS_SERVER_PLACEMENT_ROUND_ROBIN, process wide so that
+ * fleets of several builders spread out instead of stacking up.
+ */
+static unsigned long RedisServerBuilder_nextSlot = 0;
+
+static
+int RedisServerBuilder_isExecutable(char const *filename, struct stat *sb) {
+    LOGD("check executable %s", filename);
+    return stat(filename, sb) == 0
+        && S_ISREG(sb->st_mode)
+        && access(filename, X_OK) == 0;
+}
+
+/* first executable redis-server in the directories of path */
+static
+char* RedisServerBuilder_findInPATH(char const *path, struct stat *sb) {
+    char const *filename = "redis-server";
+    char const *pos = path;
+    char const *end = NULL;
+    size_t len = 0;
+    char candidate[FILENAME_MAX + 1];
+
+    for (;;) {
+        end = strchr(pos, ':');
+        len = end ? (size_t) (end - pos) : strlen(pos);
+        /* empty entries are skipped, so are ones that would be truncated */
+        if (len > 0 && len + 1 + strlen(filename) < sizeof(candidate)) {
+            memcpy(&candidate[0], pos, len);
+            if (candidate[len - 1] != '/')
+                candidate[len++] = '/';
+            strcpy(&candidate[len], filename);
+            if (RedisServerBuilder_isExecutable(&candidate[0], sb))
+                return strdup(&candidate[0]);
+        }
+        if (!end)
+            break;
+        pos = end + 1;
+    }
+    return NULL;
+}
+
+static
+char* RedisServerBuilder_findExecutable() {
+    char *r = NULL;
+    char const *path = getenv("PATH");
+    struct stat sb;
+
+    if (!path)
+        return NULL;
+    pthread_mutex_lock(&RedisServerBuilder_cacheMutex);
+    if (RedisServerBuilder_cache.found
+            && strcmp(RedisServerBuilder_cache.path, path) == 0
+            && RedisServerBuilder_isExecutable(RedisServerBuilder_cache.found, &sb)
+            && sb.st_dev == RedisServerBuilder_cache.dev
+            && sb.st_ino == RedisServerBuilder_cache.ino
+            && sb.st_mtim.tv_sec == RedisServerBuilder_cache.mtime.tv_sec
+            && sb.st_mtim.tv_nsec == RedisServerBuilder_cache.mtime.tv_nsec) {
+        r = strdup(RedisServerBuilder_cache.found);
+        goto exit;
+    }
+
+    free(RedisServerBuilder_cache.path);
+    free(RedisServerBuilder_cache.found);
+    RedisServerBuilder_cache.path = NULL;
+    RedisServerBuilder_cache.found = NULL;
+    r = RedisServerBuilder_findInPATH(path, &sb);
+    if (!r)
+        goto exit;
+    RedisServerBuilder_cache.path = strdup(path);
+    RedisServerBuilder_cache.found = strdup(r);
+    if (!RedisServerBuilder_cache.path || !RedisServerBuilder_cache.found) {
+        free(RedisServerBuilder_cache.path);
+        free(RedisServerBuilder_cache.found);
+        RedisServerBuilder_cache.path = NULL;
+        RedisServerBuilder_cache.found = NULL;
+        goto exit;
+    }
+    RedisServerBuilder_cache.dev = sb.st_dev;
+    RedisServerBuilder_cache.ino = sb.st_ino;
+    RedisServerBuilder_cache.mtime = sb.st_mtim;
+exit:
+    pthread_mutex_unlock(&RedisServerBuilder_cacheMutex);
+    return r;
+}
+
+static
+Process* RedisInstance_getProcess(RedisInstance const *me) {
+    return me->data._M_process;
+}
+
+static
+char const* RedisInstance_getHost(RedisInstance const *me) {
+    return me->data._M_host;
+}
+
+static
+int RedisInstance_getPort(RedisInstance const *me) {
+    return me->data._M_port;
+}
+
+static
+char const* RedisInstance_getUnixSocket(RedisInstance const *me) {
+    return me->data._M_unixsocket;
+}
+
+static
+RedisClient* RedisInstance_connect(RedisInstance const *me, long timeout_ms) {
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+    char const *password = me->data._M_builder
+        ? me->data._M_builder->data._M_requirepass
+        : NULL;
+
+    if (me->data._M_unixsocket)
+        client = RedisClient_connectUnix(me->data._M_unixsocket, timeout_ms);
+    else
+        client = RedisClient_connect(me->data._M_host, me->data._M_port, timeout_ms);
+    if (!client || !password)
+        return client;
+    /* a password changed at runtime fails here, commands tell NOAUTH then */
+    reply = client->calls.commandv(client, "AUTH", password, NULL);
+    if (!RedisClientReply_is(reply, "OK"))
+        LOGE("AUTH failed: %s", reply && reply->str ? reply->str : "no reply");
+    RedisClientReply_destroy(reply);
+    return client;
+}
+
+static
+void RedisServerBuilder_removeDir(char const *path);
+
+/* options describing where and how the server runs, never reset */
+static char const *RedisInstance_fixedOptions[] = {
+    "port", "bind", "unixsocket", "unixsocketperm", "dir", "dbfilename",
+    "daemonize", "supervised", "pidfile", "logfile", "include", "loadmodule",
+    "databases", "cluster-enabled", "cluster-config-file", "tls-port",
+    "replicaof", "slaveof", "rename-command",
+    NULL
+};
+
+static
+int RedisInstance_isFixedOption(char const *name, size_t len) {
+    char const **p = NULL;
+
+    for (p = &RedisInstance_fixedOptions[0]; *p; ++p)
+        if (strlen(*p) == len && strncasecmp(*p, name, len) == 0)
+            return 1;
+    return 0;
+}
+
+/* options given one value per line that CONFIG SET takes as one list */
+static char const *RedisInstance_listOptions[] = {
+    "save", "client-output-buffer-limit",
+    NULL
+};
+
+static
+int RedisInstance_isListOption(char const *name, size_t len) {
+    char const **p = NULL;
+
+    for (p = &RedisInstance_listOptions[0]; *p; ++p)
+        if (strlen(*p) == len && strncasecmp(*p, name, len) == 0)
+            return 1;
+    return 0;
+}
+
+/*
+ * The value CONFIG SET needs to restore option name, given by parameters
+ * p ("--name value"): the last one, or all of them joined by spaces for
+ * a list option where "" drops the values before it, as on the command
+ * line. Returns a "name\0value" copy to free, NULL on allocation failure.
+ */
+static
+char* RedisInstance_joinOption(char const **p, char const *name, size_t len) {
+    size_t size = len + 2;
+    size_t used = 0;
+    char const **q = NULL;
+    char const *value = NULL;
+    char *r = NULL;
+    int list = RedisInstance_isListOption(name, len);
+
+    for (q = p; *q; ++q)
+        size += strlen(*q) + 1;
+    r = (char*) malloc(size);
+    if (!r)
+        return NULL;
+    memcpy(r, name, len);
+    r[len] = '\0';
+    used = len + 1;
+    r[used] = '\0';
+    for (q = p; *q; ++q) {
+        if (strncmp(*q + 2, name, len) != 0 || (*q)[2 + len] != ' ')
+            continue;
+        value = *q + 2 + len + 1;
+        /* "" is how the command line spells an empty value */
+        if (strcmp(value, "\"\"") == 0)
+            value = "";
+        if (!list || !*value)
+            used = len + 1;
+        else if (used > len + 1)
+            r[used++] = ' ';
+        strcpy(r + used, value);
+        used += strlen(value);
+    }
+    return r;
+}
+
+/*
+ * Queue the reset commands selected by flags on client, returns the number
+ * of queued commands or -1. Builder options are restored with one
+ * CONFIG SET per option after the other steps, whose number goes to
+ * nsteps, so that a single immutable option can not fail the rest.
+ */
+static
+int RedisInstance_queueReset(RedisInstance const *me, RedisClient *client,
+        int flags, int *nsteps) {
+    static char const *flushall[] = { "FLUSHALL", "ASYNC", NULL };
+    static char const *scriptflush[] = { "SCRIPT", "FLUSH", NULL };
+    static char const *resetstat[] = { "CONFIG", "RESETSTAT", NULL };
+    static char const *clientkill[] = {
+        "CLIENT", "KILL", "TYPE", "normal", "SKIPME", "yes", NULL
+    };
+    char const *configset[5] = { "CONFIG", "SET", NULL, NULL, NULL };
+    char const **parameters = NULL;
+    char const **p = NULL;
+    char const **q = NULL;
+    char const *name = NULL;
+    char const *value = NULL;
+    char *option = NULL;
+    size_t len = 0;
+    int appended = 0;
+    int n = 0;
+
+    if ((flags & REDIS_INSTANCE_RESET_DATA)
+            && !client->calls.append(client, flushall))
+        return -1;
+    if ((flags & REDIS_INSTANCE_RESET_SCRIPTS)
+            && !client->calls.append(client, scriptflush))
+        return -1;
+    if ((flags & REDIS_INSTANCE_RESET_STATS)
+            && !client->calls.append(client, resetstat))
+        return -1;
+    if ((flags & REDIS_INSTANCE_RESET_CLIENTS)
+            && !client->calls.append(client, clientkill))
+        return -1;
+    n = !!(flags & REDIS_INSTANCE_RESET_DATA)
+        + !!(flags & REDIS_INSTANCE_RESET_SCRIPTS)
+        + !!(flags & REDIS_INSTANCE_RESET_STATS)
+        + !!(flags & REDIS_INSTANCE_RESET_CLIENTS);
+    *nsteps = n;
+
+    if (!(flags & REDIS_INSTANCE_RESET_CONFIG) || !me->data._M_builder)
+        return n;
+    parameters = me->data._M_builder->calls.getParameters(me->data._M_builder);
+    for (p = parameters; p && *p; ++p) {
+        /* "--name value" */
+        name = *p + 2;
+        value = strchr(name, ' ');
+        len = value ? (size_t) (value - name) : strlen(name);
+        if (!value || RedisInstance_isFixedOption(name, len))
+            continue;
+        /* an option given more than once goes with its first occurrence */
+        for (q = parameters; q != p; ++q)
+            if (strncmp(*q + 2, name, len) == 0 && (*q)[2 + len] == ' ')
+                break;
+        if (q != p)
+            continue;
+        option = RedisInstance_joinOption(p, name, len);
+        if (!option)
+            return -1;
+        configset[2] = option;
+        configset[3] = option + len + 1;
+        /* append copied the arguments */
+        appended = client->calls.append(client, configset);
+        free(option);
+        if (!appended)
+            return -1;
+        ++n;
+    }
+    return n;
+}
+
+static
+int RedisInstance_reset(RedisInstance *me, int flags, long *elapsed_us) {
+    int rc = 0;
+    int n = 0;
+    int i = 0;
+    int nsteps = 0;
+    int attempt = 0;
+    int failed = 0;
+    struct timespec started;
+    struct timespec finished;
+    RedisClientReply *reply = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    /* a cached connection may have gone stale, reconnect once */
+    for (attempt = 0; attempt < 2; ++attempt) {
+        if (!me->data._M_client)
+            me->data._M_client = me->calls.connect(me,
+                    REDIS_INSTANCE_COMMAND_TIMEOUT);
+        if (!me->data._M_client)
+            goto failure;
+        n = RedisInstance_queueReset(me, me->data._M_client, flags, &nsteps);
+        if (n < 0) {
+            /* do not leave half a pipeline behind for the next reset */
+            RedisClient_destroy(me->data._M_client);
+            me->data._M_client = NULL;
+            goto failure;
+        }
+        failed = 0;
+        for (i = 0; i < n; ++i) {
+            reply = me->data._M_client->calls.getReply(me->data._M_client);
+            if (!reply) {
+                failed = -1;
+                break;
+            }
+            if (reply->type == REDIS_CLIENT_REPLY_ERROR && i >= nsteps) {
+                /* immutable or unknown at runtime, stays as it was built */
+                LOGI("reset of option %d skipped: %s", i - nsteps, reply->str);
+            } else if (reply->type == REDIS_CLIENT_REPLY_ERROR) {
+                LOGE("reset step %d failed: %s", i, reply->str);
+                ++failed;
+            }
+            RedisClientReply_destroy(reply);
+            reply = NULL;
+        }
+        if (failed >= 0)
+            break;
+        RedisClient_destroy(me->data._M_client);
+        me->data._M_client = NULL;
+    }
+    if (failed != 0)
+        goto failure;
+
+    goto success;
+exit:
+    if (elapsed_us) {
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        *elapsed_us = (finished.tv_sec - started.tv_sec) * 1000000L
+            + (finished.tv_nsec - started.tv_nsec) / 1000L;
+    }
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    goto exit;
+}
+
+/* ask for SHUTDOWN NOSAVE without waiting, a server that obeys just closes */
+static
+int RedisInstance_requestShutdown(RedisInstance *me, long timeout_ms) {
+    char const *shutdown[] = { "SHUTDOWN", "NOSAVE", NULL };
+
+    if (!me->data._M_client)
+        me->data._M_client = RedisInstance_connect(me, timeout_ms);
+    if (!me->data._M_client)
+        return 0;
+    return me->data._M_client->calls.append(me->data._M_client, shutdown)
+        && me->data._M_client->calls.flush(me->data._M_client);
+}
+
+/* 1 once the server exited, the zombie is left for RedisInstance_reap */
+static
+int RedisInstance_hasExited(RedisInstance const *me) {
+    siginfo_t info;
+
+    memset(&info, 0, sizeof(info));
+    while (waitid(P_PID, (id_t) me->data._M_process->calls.getPID(me->data._M_process),
+                &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+        if (errno != EINTR)
+            return 1;
+    }
+    return info.si_pid != 0;
+}
+
+/* the rusage of a reaped server as the last sample of its series */
+static
+void RedisInstance_recordUsage(RedisInstance *me) {
+    struct rusage usage;
+    ResourceSample sample;
+
+    if (!me->data._M_process->calls.getUsage(me->data._M_process, &usage))
+        return;
+    memset(&sample, 0, sizeof(sample));
+    sample.time_us = LifecycleStats_now();
+    sample.peak_rss_bytes = usage.ru_maxrss * 1024L;
+    sample.user_us = usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec;
+    sample.system_us = usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec;
+    sample.voluntary_switches = usage.ru_nvcsw;
+    sample.involuntary_switches = usage.ru_nivcsw;
+    sample.minor_faults = usage.ru_minflt;
+    sample.major_faults = usage.ru_majflt;
+    me->data._M_usage->calls.add(me->data._M_usage, &sample);
+}
+
+static
+void RedisInstance_reap(RedisInstance *me, long stopping) {
+    int exitcode = 0;
+    long exited = LifecycleStats_now();
+    LifecycleStats *stats = me->data._M_stats;
+
+    if (stats)
+        stats->calls.record(stats, LIFECYCLE_SPAN_TERMINATE, exited - stopping);
+    /* the pid may be somebody else's once reaped */
+    if (me->data._M_sampler)
+        me->data._M_sampler->calls.unwatch(me->data._M_sampler, me->data._M_usage);
+    me->data._M_process->calls.wait(me->data._M_process, &exitcode);
+    if (me->data._M_usage)
+        RedisInstance_recordUsage(me);
+    if (stats)
+        stats->calls.record(stats, LIFECYCLE_SPAN_REAP,
+                LifecycleStats_now() - exited);
+    LOGI("redis instance exit with code %d", exitcode);
+    Process_destroy(me->data._M_process);
+    me->data._M_process = NULL;
+}
+
+/* where each server of RedisInstance_stop is on its way out */
+enum {
+    /* nothing sent yet */
+    REDIS_INSTANCE_STOP_NONE = 0,
+    /* SHUTDOWN NOSAVE sent, its reply or the close not seen yet */
+    REDIS_INSTANCE_STOP_REQUESTED,
+    /* the control connection closed, the server is exiting */
+    REDIS_INSTANCE_STOP_CLOSED,
+    REDIS_INSTANCE_STOP_TERMINATED
+};
+
+static
+void RedisInstance_terminate(RedisInstance *me) {
+    Process *process = me->data._M_process;
+
+    LOGD("sending SIGTERM to %d", process->calls.getPID(process));
+    process->calls.kill0(process, SIGTERM);
+}
+
+/*
+ * the control connection of a requested shutdown is readable: an error
+ * reply means the server refused it and gets SIGTERM right away, a close
+ * means it is on its way out
+ */
+static
+void RedisInstance_checkShutdown(RedisInstance *me, char *step) {
+    RedisClientReply *reply = NULL;
+
+    reply = me->data._M_client->calls.getReply(me->data._M_client);
+    if (!reply) {
+        *step = REDIS_INSTANCE_STOP_CLOSED;
+        return;
+    }
+    LOGE("redis instance %d refused SHUTDOWN: %s",
+            me->data._M_process->calls.getPID(me->data._M_process),
+            reply->type == REDIS_CLIENT_REPLY_ERROR && reply->str ? reply->str : "?");
+    RedisClientReply_destroy(reply);
+    RedisInstance_terminate(me);
+    *step = REDIS_INSTANCE_STOP_TERMINATED;
+}
+
+/*
+ * Wait until the servers still running exited or the deadline (ms, < 0
+ * for none) passed, reaping every one that did. Exits are seen through the
+ * pidfds, servers without one are re-checked every few ms. Servers whose
+ * steps entry (optional) is REDIS_INSTANCE_STOP_REQUESTED have their
+ * control connection watched for the answer to SHUTDOWN as well.
+ */
+static
+void RedisInstance_waitExits(RedisInstance **instances, size_t n, char *steps,
+        long stopping, long deadline) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t npolled = 0;
+    size_t running = 0;
+    long timeout = 0;
+    int fd = -1;
+    int unwatched = 0;
+    struct pollfd *pfds = NULL;
+    /* instance of each connection polled after the pidfds */
+    size_t *owners = NULL;
+    size_t nconnections = 0;
+    RedisClient *client = NULL;
+
+    pfds = (struct pollfd*) calloc(2 * n, sizeof(*pfds));
+    owners = (size_t*) calloc(n, sizeof(*owners));
+    if (!owners) {
+        free(pfds);
+        pfds = NULL;
+    }
+    for (;;) {
+        npolled = 0;
+        running = 0;
+        nconnections = 0;
+        unwatched = !pfds;
+        for (i = 0; i < n; ++i) {
+            if (!instances[i] || !instances[i]->data._M_process)
+                continue;
+            if (RedisInstance_hasExited(instances[i])) {
+                RedisInstance_reap(instances[i], stopping);
+                continue;
+            }
+            ++running;
+            client = instances[i]->data._M_client;
+            /* a reply read along with an earlier one is not seen by poll */
+            if (steps && steps[i] == REDIS_INSTANCE_STOP_REQUESTED && client
+                    && client->calls.getBuffered(client) > 0)
+                RedisInstance_checkShutdown(instances[i], &steps[i]);
+            if (pfds && steps && steps[i] == REDIS_INSTANCE_STOP_REQUESTED && client)
+                owners[nconnections++] = i;
+            fd = instances[i]->data._M_process->calls.getPidFD(
+                    instances[i]->data._M_process);
+            if (fd == -1 || !pfds) {
+                unwatched = 1;
+                continue;
+            }
+            pfds[npolled].fd = fd;
+            pfds[npolled].events = POLLIN;
+            pfds[npolled].revents = 0;
+            ++npolled;
+        }
+        if (running == 0)
+            break;
+        timeout = -1;
+        if (deadline >= 0) {
+            timeout = deadline - RedisServerBuilder_now();
+            if (timeout <= 0)
+                break;
+        }
+        if (unwatched && (timeout < 0 || timeout > REDIS_INSTANCE_EXIT_POLL_INTERVAL))
+            timeout = REDIS_INSTANCE_EXIT_POLL_INTERVAL;
+        for (j = 0; j < nconnections; ++j) {
+            client = instances[owners[j]]->data._M_client;
+            pfds[npolled + j].fd = client->calls.getFD(client);
+            pfds[npolled + j].events = POLLIN;
+            pfds[npolled + j].revents = 0;
+        }
+        /* a pidfd becomes readable once its process exited */
+        if (poll(pfds, npolled + nconnections, (int) timeout) == -1 && errno != EINTR)
+            break;
+        for (j = 0; j < nconnections; ++j) {
+            if (pfds[npolled + j].revents != 0)
+                RedisInstance_checkShutdown(instances[owners[j]], &steps[owners[j]]);
+        }
+    }
+    free(owners);
+    free(pfds);
+}
+
+/*
+ * Stop every running server of instances within timeout_ms: SHUTDOWN
+ * NOSAVE if nosave, SIGTERM after half of it, SIGKILL once it is over.
+ * Servers that could not be asked (no connection, without nosave) or
+ * answered SHUTDOWN with an error get SIGTERM right away. All servers
+ * share the deadlines, so a batch takes as long as its slowest member.
+ * Returns the number of servers that exited before SIGKILL.
+ */
+static
+size_t RedisInstance_stop(RedisInstance **instances, size_t n, long timeout_ms,
+        int nosave) {
+    size_t i = 0;
+    size_t r = 0;
+    size_t running = 0;
+    size_t requested = 0;
+    long stopping = LifecycleStats_now();
+    long started = RedisServerBuilder_now();
+    Process *process = NULL;
+    /* REDIS_INSTANCE_STOP_* of each instance, all of them get SIGTERM without */
+    char *steps = NULL;
+
+    steps = (char*) calloc(n > 0 ? n : 1, sizeof(*steps));
+    for (i = 0; i < n; ++i) {
+        if (!instances[i] || !instances[i]->data._M_process)
+            continue;
+        ++running;
+        if (steps && nosave && RedisInstance_requestShutdown(instances[i],
+                    timeout_ms / 2 > 0 ? timeout_ms / 2 : 1)) {
+            steps[i] = REDIS_INSTANCE_STOP_REQUESTED;
+            ++requested;
+        } else {
+            RedisInstance_terminate(instances[i]);
+            if (steps)
+                steps[i] = REDIS_INSTANCE_STOP_TERMINATED;
+        }
+    }
+    if (running == 0)
+        goto exit;
+
+    if (requested > 0)
+        RedisInstance_waitExits(instances, n, steps, stopping,
+                started + timeout_ms / 2);
+    for (i = 0; steps && i < n; ++i) {
+        if (!instances[i] || !instances[i]->data._M_process
+                || steps[i] == REDIS_INSTANCE_STOP_TERMINATED)
+            continue;
+        RedisInstance_terminate(instances[i]);
+    }
+    RedisInstance_waitExits(instances, n, NULL, stopping, started + timeout_ms);
+
+    for (i = 0; i < n; ++i) {
+        if (!instances[i] || !(process = instances[i]->data._M_process))
+            continue;
+        LOGE("redis instance %d did not stop in %ld ms, killing it",
+                process->calls.getPID(process), timeout_ms);
+        process->calls.kill0(process, SIGKILL);
+        --running;
+    }
+    r = running;
+    RedisInstance_waitExits(instances, n, NULL, stopping, -1);
+exit:
+    free(steps);
+    return r;
+}
+
+static
+int RedisInstance_shutdown(RedisInstance *me, long timeout_ms) {
+    if (timeout_ms < 0)
+        return 0;
+    return RedisInstance_stop(&me, 1, timeout_ms, 1) == 1;
+}
+
+size_t RedisInstance_shutdownMany(RedisInstance **instances, size_t n,
+        long timeout_ms) {
+    if (timeout_ms < 0)
+        return 0;
+    return RedisInstance_stop(instances, n, timeout_ms, 1);
+}
+
+void
+RedisInstance_destroy(RedisInstance *me) {
+    if (me) {
+        /* data in a private dir goes with it, no point in saving it first */
+        if (me->data._M_process)
+            RedisInstance_stop(&me, 1, REDIS_INSTANCE_SHUTDOWN_TIMEOUT,
+                    me->data._M_workdir != NULL);
+        if (me->data._M_usage) {
+            if (me->data._M_sampler)
+                me->data._M_sampler->calls.unwatch(me->data._M_sampler,
+                        me->data._M_usage);
+            ResourceSeries_destroy(me->data._M_usage);
+            me->data._M_usage = NULL;
+        }
+        if (me->data._M_cgroup) {
+            /* children the server forked (bgsave) must not keep it busy */
+            me->data._M_cgroup->calls.kill(me->data._M_cgroup);
+            ControlGroup_destroy(me->data._M_cgroup);
+            me->data._M_cgroup = NULL;
+        }
+        if (me->data._M_host) {
+            free(me->data._M_host);
+            me->data._M_host = NULL;
+        }
+        if (me->data._M_unixsocket) {
+            free(me->data._M_unixsocket);
+            me->data._M_unixsocket = NULL;
+        }
+        if (me->data._M_port_lease != -1) {
+            PortAllocator_release(me->data._M_port_lease);
+            me->data._M_port_lease = -1;
+        }
+        if (me->data._M_bus_lease != -1) {
+            PortAllocator_release(me->data._M_bus_lease);
+            me->data._M_bus_lease = -1;
+        }
+        if (me->data._M_workdir) {
+            /* socket and anything else the server left in there */
+            RedisServerBuilder_removeDir(me->data._M_workdir);
+            free(me->data._M_workdir);
+            me->data._M_workdir = NULL;
+        }
+        if (me->data._M_builder) {
+            RedisServerBuilder_destroy(me->data._M_builder);
+            me->data._M_builder = NULL;
+        }
+        if (me->data._M_client) {
+            RedisClient_destroy(me->data._M_client);
+            me->data._M_client = NULL;
+        }
+        free(me);
+        me = NULL;
+    }
+}
+
+static
+ControlGroup* RedisInstance_getControlGroup(RedisInstance const *me) {
+    return me->data._M_cgroup;
+}
+
+static
+ResourceSeries* RedisInstance_getUsage(RedisInstance const *me) {
+    return me->data._M_usage;
+}
+
+static
+RedisInstance* RedisInstance_create() {
+    RedisInstance *instance = NULL;
+    instance = (RedisInstance*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->calls.getProcess = &RedisInstance_getProcess;
+    instance->calls.getHost = &RedisInstance_getHost;
+    instance->calls.getPort = &RedisInstance_getPort;
+    instance->calls.getUnixSocket = &RedisInstance_getUnixSocket;
+    instance->calls.connect = &RedisInstance_connect;
+    instance->calls.reset = &RedisInstance_reset;
+    instance->calls.shutdown = &RedisInstance_shutdown;
+    instance->calls.getControlGroup = &RedisInstance_getControlGroup;
+    instance->calls.getUsage = &RedisInstance_getUsage;
+    instance->data._M_port_lease = -1;
+    instance->data._M_bus_lease = -1;
+    return instance;
+}
+
+/*
+ * Readiness probing.
+ *
+ * Every launch is probed with a non-blocking connect followed by a PING,
+ * all launches of a batch are multiplexed on one poll() loop. A server
+ * that is still loading its dataset answers -LOADING and is retried with
+ * exponential backoff, just like a server that does not listen yet. With
+ * requirepass the PING goes after an AUTH; a server that still refuses
+ * it (-NOAUTH, -NOPERM, e.g. users set up by an ACL file) does accept
+ * connections and counts as ready.
+ */
+enum {
+    REDIS_SERVER_LAUNCH_WAITING = 0,
+    REDIS_SERVER_LAUNCH_CONNECTING,
+    REDIS_SERVER_LAUNCH_PINGING,
+    REDIS_SERVER_LAUNCH_DONE
+};
+
+typedef struct tagRedisServerLaunch {
+    /* builder the launch was requested from */
+    RedisServerBuilder const   *origin;
+    RedisServerBuilder const   *builder;
+    /* private builder of this launch, if any */
+    RedisServerBuilder         *owned;
+    /* private directory of this launch, if any */
+    char                       *workdir;
+    /* lease of an allocated port, -1 if none */
+    int                         lease;
+    /* lease of the cluster bus port that goes with it, -1 if none */
+    int                         bus_lease;
+    /* generated redis.conf in config file mode, else NULL */
+    char                       *config;
+    /* memfd behind config, -1 if none */
+    int                         config_fd;
+    /* cpus the server is pinned to, NULL to float */
+    char                       *cpus;
+    /* cgroup of its own the server starts in, NULL if none */
+    ControlGroup               *cgroup;
+    /* config is a temp file of its own, removed once the server is up */
+    int                         config_temp;
+    Process                    *process;
+    /* when the spawn returned (us), readiness is timed from there */
+    long                        spawned;
+    struct sockaddr_storage     addr;
+    socklen_t                   addrlen;
+    int                         fd;
+    int                         state;
+    int                         status;
+    long                        next;
+    long                        delay;
+    /* replies to the probe, one line each */
+    char                        reply[192];
+    size_t                      nreply;
+    size_t                      nlines;
+} RedisServerLaunch;
+
+static
+int RedisServerBuilder_resolve(RedisServerBuilder const *me,
+        struct sockaddr_storage *addr, socklen_t *addrlen) {
+    int rc = 0;
+    char service[16];
+    struct addrinfo hints;
+    struct addrinfo *ai = NULL;
+    struct sockaddr_un *un = NULL;
+
+    memset(addr, 0, sizeof(*addr));
+    if (me->data._M_unixsocket) {
+        un = (struct sockaddr_un*) addr;
+        if (strlen(me->data._M_unixsocket) >= sizeof(un->sun_path))
+            goto failure;
+        un->sun_family = AF_UNIX;
+        strncpy(&un->sun_path[0], me->data._M_unixsocket,
+                sizeof(un->sun_path) - 1);
+        *addrlen = sizeof(*un);
+        goto success;
+    }
+
+    snprintf(&service[0], sizeof(service), "%d", me->data._M_port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(me->data._M_bind ? me->data._M_bind : "127.0.0.1",
+                &service[0], &hints, &ai) != 0)
+        goto failure;
+    memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+    *addrlen = ai->ai_addrlen;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (ai) {
+        freeaddrinfo(ai);
+        ai = NULL;
+    }
+    goto exit;
+}
+
+/*
+ * A ready or failed server has no use for its config any more, except for
+ * CONFIG REWRITE, which only the copy in the private dir supports anyway.
+ */
+static
+void RedisServerBuilder_dropConfig(RedisServerLaunch *launch) {
+    if (launch->config_fd != -1) {
+        close(launch->config_fd);
+        launch->config_fd = -1;
+    }
+    if (launch->config) {
+        if (launch->config_temp)
+            unlink(launch->config);
+        free(launch->config);
+        launch->config = NULL;
+    }
+    launch->config_temp = 0;
+}
+
+static
+void RedisServerBuilder_finish(RedisServerLaunch *launch, int status) {
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+    int attempt = 0;
+    char *tail = NULL;
+    OutputLog *output = launch->process
+        ? launch->process->calls.getOutput(launch->process)
+        : NULL;
+    struct timespec delay = { 0, 1000000L };
+
+    /* what the server said before it gave up, the reader may still be at it */
+    if (output && status != REDIS_SERVER_STATUS_OK) {
+        while (status == REDIS_SERVER_STATUS_EXITED
+                && !output->calls.isClosed(output)
+                && attempt++ < REDIS_SERVER_OUTPUT_DRAIN_TIMEOUT)
+            nanosleep(&delay, NULL);
+        tail = output->calls.tail(output, REDIS_SERVER_OUTPUT_TAIL);
+        if (tail && *tail)
+            LOGE("redis-server %s, its last output:\n%s",
+                    RedisServerBuilder_getStatusString(status), tail);
+        free(tail);
+    }
+#endif
+    if (launch->fd != -1) {
+        close(launch->fd);
+        launch->fd = -1;
+    }
+    RedisServerBuilder_dropConfig(launch);
+    launch->state = REDIS_SERVER_LAUNCH_DONE;
+    launch->status = status;
+}
+
+static
+void RedisServerBuilder_retry(RedisServerLaunch *launch, long now) {
+    if (launch->fd != -1) {
+        close(launch->fd);
+        launch->fd = -1;
+    }
+    launch->state = REDIS_SERVER_LAUNCH_WAITING;
+    launch->next = now + launch->delay;
+    launch->delay = launch->delay * 2 < REDIS_SERVER_PROBE_MAX_DELAY
+        ? launch->delay * 2
+        : REDIS_SERVER_PROBE_MAX_DELAY;
+}
+
+static
+void RedisServerBuilder_ping(RedisServerLaunch *launch, long now) {
+    static char const ping[] = "*1\r\n$4\r\nPING\r\n";
+    char const *password = launch->builder->data._M_requirepass;
+    char *probe = NULL;
+    int len = 0;
+
+    launch->nlines = 1;
+    if (password) {
+        /* AUTH and PING in one go, AUTH is served while loading */
+        probe = (char*) malloc(strlen(password) + 64);
+        if (!probe) {
+            RedisServerBuilder_retry(launch, now);
+            return;
+        }
+        len = sprintf(probe, "*2\r\n$4\r\nAUTH\r\n$%lu\r\n%s\r\n%s",
+                (unsigned long) strlen(password), password, &ping[0]);
+        launch->nlines = 2;
+    }
+    if (send(launch->fd, probe ? probe : &ping[0],
+                probe ? (size_t) len : sizeof(ping) - 1, MSG_NOSIGNAL)
+            != (probe ? (ssize_t) len : (ssize_t) sizeof(ping) - 1)) {
+        free(probe);
+        RedisServerBuilder_retry(launch, now);
+        return;
+    }
+    free(probe);
+    launch->state = REDIS_SERVER_LAUNCH_PINGING;
+    launch->nreply = 0;
+}
+
+static
+void RedisServerBuilder_connect(RedisServerLaunch *launch, long now) {
+    launch->fd = socket(launch->addr.ss_family,
+            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (launch->fd == -1) {
+        RedisServerBuilder_retry(launch, now);
+        return;
+    }
+    if (connect(launch->fd, (struct sockaddr*) &launch->addr,
+                launch->addrlen) == 0) {
+        RedisServerBuilder_ping(launch, now);
+    } else if (errno == EINPROGRESS) {
+        launch->state = REDIS_SERVER_LAUNCH_CONNECTING;
+    } else {
+        RedisServerBuilder_retry(launch, now);
+    }
+}
+
+static
+void RedisServerBuilder_onConnected(RedisServerLaunch *launch, long now) {
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+
+    if (getsockopt(launch->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1
+            || err != 0) {
+        RedisServerBuilder_retry(launch, now);
+        return;
+    }
+    RedisServerBuilder_ping(launch, now);
+}
+
+static
+void RedisServerBuilder_onReply(RedisServerLaunch *launch, long now) {
+    ssize_t n = 0;
+    size_t i = 0;
+    char *line = NULL;
+    char *end = NULL;
+
+    n = recv(launch->fd, &launch->reply[launch->nreply],
+            sizeof(launch->reply) - 1 - launch->nreply, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        RedisServerBuilder_retry(launch, now);
+        return;
+    }
+    launch->nreply += (size_t) n;
+    launch->reply[launch->nreply] = '\0';
+    /* the reply to PING is the last line, the one to AUTH goes first */
+    line = &launch->reply[0];
+    for (i = 1; i < launch->nlines && (end = strstr(line, "\r\n")); ++i)
+        line = end + 2;
+    if (!strstr(line, "\r\n")) {
+        if (launch->nreply < sizeof(launch->reply) - 1)
+            return;
+        RedisServerBuilder_retry(launch, now);
+        return;
+    }
+    if (strncmp(line, "+PONG\r\n", 7) == 0
+            || strncmp(line, "-NOAUTH", 7) == 0
+            || strncmp(line, "-NOPERM", 7) == 0)
+        RedisServerBuilder_finish(launch, REDIS_SERVER_STATUS_OK);
+    else
+        RedisServerBuilder_retry(launch, now);
+}
+
+/*
+ * Wait until every launch is ready, has exited or missed the deadline of
+ * its builder. The status of each launch is stored in launch->status.
+ */
+static
+void RedisServerBuilder_waitReady(RedisServerLaunch *launches, size_t n) {
+    struct pollfd *pfds = NULL;
+    RedisServerLaunch **polled = NULL;
+    RedisServerLaunch *launch = NULL;
+    long started = RedisServerBuilder_now();
+    long now = 0;
+    long deadline = 0;
+    long timeout = 0;
+    size_t pending = 0;
+    size_t npolled = 0;
+    size_t i = 0;
+    int exitcode = 0;
+
+    /* one socket and one pidfd per launch */
+    pfds = (struct pollfd*) calloc(n * 2, sizeof(*pfds));
+    polled = (RedisServerLaunch**) calloc(n * 2, sizeof(*polled));
+    for (i = 0; i < n; ++i) {
+        launch = &launches[i];
+        if (launch->state == REDIS_SERVER_LAUNCH_DONE)
+            continue;
+        if (!pfds || !polled) {
+            RedisServerBuilder_finish(launch, REDIS_SERVER_STATUS_FAILED);
+            continue;
+        }
+        launch->fd = -1;
+        launch->next = started;
+        launch->delay = REDIS_SERVER_PROBE_MIN_DELAY;
+        if (!RedisServerBuilder_resolve(launch->builder, &launch->addr,
+                    &launch->addrlen)) {
+            RedisServerBuilder_finish(launch, REDIS_SERVER_STATUS_FAILED);
+            continue;
+        }
+        ++pending;
+    }
+
+    while (pending > 0) {
+        now = RedisServerBuilder_now();
+        timeout = REDIS_SERVER_PROBE_MAX_DELAY;
+        npolled = 0;
+        for (i = 0; i < n; ++i) {
+            launch = &launches[i];
+            if (launch->state == REDIS_SERVER_LAUNCH_DONE)
+                continue;
+            deadline = started + launch->builder->data._M_ready_timeout;
+            if (launch->process->calls.wait0(launch->process, WNOHANG, &exitcode)) {
+                LOGE("redis process failed with exit code %d", exitcode);
+                RedisServerBuilder_finish(launch, REDIS_SERVER_STATUS_EXITED);
+            } else if (now >= deadline) {
+                LOGE("redis process not ready after %ld ms", now - started);
+                RedisServerBuilder_finish(launch, REDIS_SERVER_STATUS_TIMEDOUT);
+            } else if (launch->state == REDIS_SERVER_LAUNCH_WAITING
+                    && now >= launch->next) {
+                RedisServerBuilder_connect(launch, now);
+            }
+            if (launch->state == REDIS_SERVER_LAUNCH_DONE) {
+                --pending;
+                continue;
+            }
+            if (deadline - now < timeout)
+                timeout = deadline - now;
+            if (launch->state == REDIS_SERVER_LAUNCH_WAITING) {
+                if (launch->next - now < timeout)
+                    timeout = launch->next - now;
+                continue;
+            }
+            pfds[npolled].fd = launch->fd;
+            pfds[npolled].events = launch->state == REDIS_SERVER_LAUNCH_CONNECTING
+                ? POLLOUT
+                : POLLIN;
+            pfds[npolled].revents = 0;
+            polled[npolled++] = launch;
+        }
+        /* wake up as soon as a child dies, the next round reports it */
+        for (i = 0; i < n && pending > 0; ++i) {
+            launch = &launches[i];
+            if (launch->state == REDIS_SERVER_LAUNCH_DONE
+                    || launch->process->calls.getPidFD(launch->process) == -1)
+                continue;
+            pfds[npolled].fd = launch->process->calls.getPidFD(launch->process);
+            pfds[npolled].events = POLLIN;
+            pfds[npolled].revents = 0;
+            polled[npolled++] = NULL;
+        }
+        if (pending == 0)
+            break;
+
+        if (poll(pfds, npolled, (int) (timeout > 0 ? timeout : 0)) <= 0)
+            continue;
+        now = RedisServerBuilder_now();
+        for (i = 0; i < npolled; ++i) {
+            if (!pfds[i].revents || !polled[i])
+                continue;
+            launch = polled[i];
+            if (launch->state == REDIS_SERVER_LAUNCH_CONNECTING)
+                RedisServerBuilder_onConnected(launch, now);
+            else if (launch->state == REDIS_SERVER_LAUNCH_PINGING)
+                RedisServerBuilder_onReply(launch, now);
+            if (launch->state == REDIS_SERVER_LAUNCH_DONE) {
+                if (launch->status == REDIS_SERVER_STATUS_OK) {
+                    LOGI("redis process ready in %ld ms", now - started);
+                    if (launch->builder->data._M_stats)
+                        launch->builder->data._M_stats->calls.record(
+                                launch->builder->data._M_stats, LIFECYCLE_SPAN_READY,
+                                LifecycleStats_now() - launch->spawned);
+                }
+                --pending;
+            }
+        }
+    }
+
+    if (pfds) {
+        free(pfds);
+        pfds = NULL;
+    }
+    if (polled) {
+        free(polled);
+        polled = NULL;
+    }
+}
+
+/* fork the server of a prepared launch, launch->status tells why it failed */
+static
+Process* RedisServerBuilder_spawn(RedisServerLaunch *launch,
+        char const *executable_path) {
+    Process *r = NULL;
+    ProcessBuilder *pb = NULL;
+    RedisServerBuilder const *me = launch->builder;
+    int step = PROCESS_STEP_NONE;
+    int error = 0;
+    int *status = &launch->status;
+    char const *config = launch->config;
+    char const *args[2] = { NULL, NULL };
+
+    *status = REDIS_SERVER_STATUS_FAILED;
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        goto failure;
+    if (!pb->calls.setFile(pb, executable_path))
+        goto failure;
+    /* relative paths of the server (logfile, pidfile) stay private too */
+    if (launch->workdir && !pb->calls.setPath(pb, launch->workdir))
+        goto failure;
+    if (!pb->calls.setSpawnMode(pb, me->data._M_spawn_mode))
+        goto failure;
+    pb->calls.setStats(pb, me->data._M_stats);
+    if (launch->cpus && !pb->calls.setAffinity(pb, launch->cpus))
+        goto failure;
+    if (!pb->calls.setMemoryNode(pb, me->data._M_memory_node))
+        goto failure;
+    if (!pb->calls.setProcessGroup(pb, me->data._M_pgid)
+            || !pb->calls.setParentDeathSignal(pb, me->data._M_death_signal))
+        goto failure;
+    if (launch->cgroup && !pb->calls.setControlGroup(pb,
+                launch->cgroup->calls.getPath(launch->cgroup)))
+        goto failure;
+    if (!pb->calls.setOutput(pb, me->data._M_output, me->data._M_output_path))
+        goto failure;
+    pb->calls.setOutputHook(pb, me->data._M_output_hook, me->data._M_output_context);
+    args[0] = config;
+    if (!pb->calls.setArguments(pb, config
+                ? &args[0]
+                : me->data._M_cfg->calls.getArray(me->data._M_cfg)))
+        goto failure;
+    r = pb->calls.build0(pb, &step, &error);
+    if (!r) {
+        /* the child reported its failure before exec, no need to wait */
+        if (step == PROCESS_STEP_EXEC && (error == ENOENT || error == EACCES))
+            *status = REDIS_SERVER_STATUS_NOT_FOUND;
+        else if (step != PROCESS_STEP_NONE)
+            *status = REDIS_SERVER_STATUS_SPAWN_FAILED;
+        LOGE("spawn %s failed at %s: %s", executable_path,
+                ProcessBuilder_getStepString(step), strerror(error));
+        goto failure;
+    }
+    *status = REDIS_SERVER_STATUS_OK;
+
+    goto success;
+exit:
+    return r;
+success:
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (pb) {
+        ProcessBuilder_destroy(pb);
+        pb = NULL;
+    }
+    goto exit;
+}
+
+/* remove a private directory and everything below it */
+static
+int RedisServerBuilder_removeEntry(char const *path, struct stat const *sb,
+        int flag, struct FTW *ftw) {
+    (void) sb;
+    (void) flag;
+    (void) ftw;
+    if (remove(path) != 0)
+        LOGE("remove %s failed: %s", path, strerror(errno));
+    return 0;
+}
+
+static
+void RedisServerBuilder_removeDir(char const *path) {
+    if (path)
+        nftw(path, &RedisServerBuilder_removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+ * Base of private directories and temp files: /dev/shm in memory dir mode
+ * if it can be used, else the temp dir, $TMPDIR or /tmp.
+ */
+static
+char const* RedisServerBuilder_getTempDir(RedisServerBuilder const *me) {
+    char const *base = me->data._M_tmpdir;
+
+    if (me->data._M_memory_dir) {
+        if (access(REDIS_SERVER_MEMORY_DIR, W_OK | X_OK) == 0)
+            return REDIS_SERVER_MEMORY_DIR;
+        LOGI("%s not usable, private dirs stay on disk", REDIS_SERVER_MEMORY_DIR);
+    }
+    if (!base)
+        base = getenv("TMPDIR");
+    if (!base || !*base)
+        base = "/tmp";
+    return base;
+}
+
+/* create a fresh private directory below the temp dir */
+static
+char* RedisServerBuilder_makeWorkDir(RedisServerBuilder const *me) {
+    char *r = NULL;
+    char *path = NULL;
+    char const *base = RedisServerBuilder_getTempDir(me);
+    size_t size = 0;
+
+    size = strlen(base) + sizeof("/redis-XXXXXX");
+    path = (char*) malloc(size);
+    if (!path)
+        goto failure;
+    snprintf(path, size, "%s/redis-XXXXXX", base);
+    if (!mkdtemp(path)) {
+        LOGE("mkdtemp %s failed: %s", path, strerror(errno));
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = path;
+    path = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (path) {
+        free(path);
+        path = NULL;
+    }
+    goto exit;
+}
+
+/*
+ * Make dst a copy of src as cheaply as the filesystem allows: a hardlink
+ * first, then a reflink, then an in-kernel copy. Sharing the inode with a
+ * hardlink is safe because redis never rewrites an RDB in place, it saves
+ * to a temporary file and renames that over dbfilename.
+ */
+static
+int RedisServerBuilder_placeFile(char const *src, char const *dst) {
+    int rc = 0;
+    int in = -1;
+    int out = -1;
+    ssize_t n = 0;
+    off_t remaining = 0;
+    struct stat st;
+    char buf[65536];
+
+    if (link(src, dst) == 0)
+        goto success;
+    in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in == -1 || fstat(in, &st) == -1) {
+        LOGE("open seed %s failed: %s", src, strerror(errno));
+        goto failure;
+    }
+    out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out == -1)
+        goto failure;
+#if defined(FICLONE)
+    if (ioctl(out, FICLONE, in) == 0)
+        goto success;
+#endif
+    remaining = st.st_size;
+#if defined(__linux__)
+    /* server side copy, shares extents on filesystems that can */
+    while (remaining > 0) {
+        n = copy_file_range(in, NULL, out, NULL, (size_t) remaining, 0);
+        if (n <= 0)
+            break;
+        remaining -= n;
+    }
+    if (remaining == 0)
+        goto success;
+    if (n < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL)
+        goto failure;
+#endif
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, (size_t) n) != n)
+            goto failure;
+    }
+    if (n < 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    LOGE("place seed %s at %s failed: %s", src, dst, strerror(errno));
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (out != -1) {
+        close(out);
+        out = -1;
+    }
+    if (in != -1) {
+        close(in);
+        in = -1;
+    }
+    goto exit;
+}
+
+/* let the server of builder boot from seed placed in workdir */
+static
+int RedisServerBuilder_seed(RedisServerBuilder *builder, char const *seed,
+        char const *workdir) {
+    int rc = 0;
+    char *path = NULL;
+
+    path = (char*) malloc(strlen(workdir) + sizeof("/dump.rdb"));
+    if (!path)
+        goto failure;
+    sprintf(path, "%s/dump.rdb", workdir);
+    if (!RedisServerBuilder_placeFile(seed, path))
+        goto failure;
+    if (!builder->calls.optionString(builder, "dbfilename", "dump.rdb"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (path) {
+        free(path);
+        path = NULL;
+    }
+    goto exit;
+}
+
+/* lease a port for launch, together with its bus port for cluster nodes */
+static
+int RedisServerBuilder_allocatePort(RedisServerBuilder const *me,
+        PortAllocator *allocator, RedisServerLaunch *launch) {
+    int port = 0;
+    int attempt = 0;
+
+    for (attempt = 0; attempt < REDIS_SERVER_BUS_ATTEMPTS; ++attempt) {
+        port = allocator->calls.acquire(allocator, &launch->lease);
+        if (!port)
+            return 0;
+        if (!me->data._M_cluster_enabled)
+            return port;
+        if (allocator->calls.lease(allocator,
+                    port + REDIS_SERVER_CLUSTER_BUS_OFFSET, &launch->bus_lease))
+            return port;
+        PortAllocator_release(launch->lease);
+        launch->lease = -1;
+    }
+    LOGE("no port with a free cluster bus port found");
+    return 0;
+}
+
+/* the cpus a placement picks from, the ones we may run on by default */
+static
+int RedisServerBuilder_getCPUs(RedisServerBuilder const *me, int **cpus) {
+    int n = 0;
+#if defined(__linux__)
+    int cpu = 0;
+    size_t size = CPU_ALLOC_SIZE(PROCESS_MAX_CPUS);
+    cpu_set_t *set = NULL;
+#endif
+
+    *cpus = NULL;
+    if (me->data._M_cpulist) {
+        n = ProcessBuilder_parseCPUList(me->data._M_cpulist, NULL, 0);
+        if (n < 1)
+            return 0;
+        *cpus = (int*) malloc(n * sizeof(**cpus));
+        if (!*cpus)
+            return 0;
+        return ProcessBuilder_parseCPUList(me->data._M_cpulist, *cpus, n);
+    }
+#if defined(__linux__)
+    set = CPU_ALLOC(PROCESS_MAX_CPUS);
+    if (!set)
+        return 0;
+    if (sched_getaffinity(0, size, set) == 0)
+        n = CPU_COUNT_S(size, set);
+    if (n > 0)
+        *cpus = (int*) malloc(n * sizeof(**cpus));
+    if (!*cpus) {
+        CPU_FREE(set);
+        return 0;
+    }
+    n = 0;
+    for (cpu = 0; cpu < PROCESS_MAX_CPUS; ++cpu) {
+        if (CPU_ISSET_S(cpu, size, set))
+            (*cpus)[n++] = cpu;
+    }
+    CPU_FREE(set);
+#endif
+    return n;
+}
+
+/* cpus[first], ... of count cpus, wrapping around n, as a cpulist */
+static
+char* RedisServerBuilder_formatCPUs(int const *cpus, int n, int first, int count) {
+    int i = 0;
+    size_t len = 0;
+    char *r = NULL;
+
+    r = (char*) malloc(count * 12 + 1);
+    if (!r)
+        return NULL;
+    r[0] = '\0';
+    for (i = 0; i < count; ++i)
+        len += sprintf(r + len, i ? ",%d" : "%d", cpus[(first + i) % n]);
+    return r;
+}
+
+/*
+ * Pick the cpus of a prepared launch by the placement of its builder and,
+ * if asked to, hand them to the threads of redis as well: the main thread
+ * gets the first one, bio, AOF rewrite and bgsave share the rest.
+ */
+static
+int RedisServerBuilder_place(RedisServerLaunch *launch) {
+    RedisServerBuilder const *me = launch->origin;
+    RedisServerBuilder *builder = launch->owned;
+    int rc = 0;
+    int n = 0;
+    int count = 0;
+    int first = 0;
+    int *cpus = NULL;
+    char *main = NULL;
+    char *rest = NULL;
+
+    if (me->data._M_placement == REDIS_SERVER_PLACEMENT_NONE)
+        return 1;
+    n = RedisServerBuilder_getCPUs(me, &cpus);
+    if (n < 1) {
+        LOGE("no cpus to place redis-server on");
+        goto failure;
+    }
+    count = n;
+    if (me->data._M_placement == REDIS_SERVER_PLACEMENT_ROUND_ROBIN) {
+        count = me->data._M_cpus_per_instance < (size_t) n
+            ? (int) me->data._M_cpus_per_instance
+            : n;
+        first = (int) ((__sync_fetch_and_add(&RedisServerBuilder_nextSlot, 1)
+                    * (unsigned long) count) % (unsigned long) n);
+    }
+    launch->cpus = RedisServerBuilder_formatCPUs(cpus, n, first, count);
+    if (!launch->cpus)
+        goto failure;
+    LOGD("placing redis-server on cpus %s", launch->cpus);
+
+    if (!me->data._M_thread_cpus)
+        goto success;
+    main = RedisServerBuilder_formatCPUs(cpus, n, first, 1);
+    rest = count > 1
+        ? RedisServerBuilder_formatCPUs(cpus, n, first + 1, count - 1)
+        : RedisServerBuilder_formatCPUs(cpus, n, first, 1);
+    if (!main || !rest
+            || !builder->calls.optionString(builder, "server_cpulist", main)
+            || !builder->calls.optionString(builder, "bio_cpulist", rest)
+            || !builder->calls.optionString(builder, "aof_rewrite_cpulist", rest)
+            || !builder->calls.optionString(builder, "bgsave_cpulist", rest))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    free(rest);
+    free(main);
+    free(cpus);
+    goto exit;
+}
+
+/* create the cgroup of a prepared launch below the builder's and limit it */
+static
+int RedisServerBuilder_confine(RedisServerLaunch *launch) {
+    RedisServerBuilder const *me = launch->origin;
+    ControlGroup *group = NULL;
+
+    if (!me->data._M_cgroup)
+        return 1;
+    group = me->data._M_cgroup->calls.createChild(me->data._M_cgroup, NULL);
+    if (!group)
+        return 0;
+    /* kept by the launch right away, release removes it on failure */
+    launch->cgroup = group;
+    if (me->data._M_memory_max != -1
+            && !group->calls.setMemoryMax(group, me->data._M_memory_max))
+        return 0;
+    if (me->data._M_cpu_max != -1
+            && !group->calls.setCPUMax(group, me->data._M_cpu_max,
+                REDIS_SERVER_CPU_PERIOD))
+        return 0;
+    return 1;
+}
+
+/* options of a REDIS_SERVER_PERSISTENCE_* preset, later options win */
+static
+int RedisServerBuilder_persist(RedisServerBuilder *builder, int persistence) {
+    /* the snapshot points of the stock redis.conf, one per line for redis < 7 */
+    static char const *const points[] = { "3600 1", "300 100", "60 10000", NULL };
+    char const *const none[] = { "\"\"", NULL };
+    char const *const *save = &none[0];
+    char const *appendonly = "no";
+    char const *appendfsync = "everysec";
+
+    switch (persistence) {
+        case REDIS_SERVER_PERSISTENCE_DEFAULT:
+            return 1;
+        case REDIS_SERVER_PERSISTENCE_NONE:
+            break;
+        case REDIS_SERVER_PERSISTENCE_RDB:
+            save = &points[0];
+            break;
+        case REDIS_SERVER_PERSISTENCE_AOF_ALWAYS:
+            appendfsync = "always";
+            /* fall through */
+        case REDIS_SERVER_PERSISTENCE_AOF_EVERYSEC:
+            appendonly = "yes";
+            break;
+        default:
+            return 0;
+    }
+    /* save "" first drops the points of earlier save options */
+    if (save != &none[0] && !builder->calls.optionString(builder, "save", none[0]))
+        return 0;
+    for (; *save; ++save) {
+        if (!builder->calls.optionString(builder, "save", *save))
+            return 0;
+    }
+    return builder->calls.optionString(builder, "appendonly", appendonly)
+        && builder->calls.optionString(builder, "appendfsync", appendfsync);
+}
+
+/*
+ * Derive the builder actually used for one launch. A private copy is only
+ * made when the launch needs options of its own: an allocated port
+ * (assign_port or a port allocator on the builder), a generated unix
+ * socket, a private or seeded data directory, a persistence preset or the
+ * cpulists of its threads.
+ */
+static
+int RedisServerBuilder_prepare(RedisServerBuilder const *me,
+        RedisServerLaunch *launch, int assign_port) {
+    int rc = REDIS_SERVER_STATUS_FAILED;
+    int port = 0;
+    char *socket = NULL;
+    RedisServerBuilder *builder = NULL;
+    PortAllocator *allocator = me->data._M_port_allocator;
+
+    memset(launch, 0, sizeof(*launch));
+    launch->fd = -1;
+    launch->lease = -1;
+    launch->bus_lease = -1;
+    launch->config_fd = -1;
+    launch->state = REDIS_SERVER_LAUNCH_DONE;
+    launch->origin = me;
+    launch->builder = me;
+    if (!allocator && assign_port)
+        allocator = PortAllocator_getDefault();
+    if (!allocator && !me->data._M_unixsocket_mode && !me->data._M_seed_rdb
+            && !me->data._M_private_dir
+            && me->data._M_persistence == REDIS_SERVER_PERSISTENCE_DEFAULT
+            && !(me->data._M_placement && me->data._M_thread_cpus))
+        goto success;
+
+    builder = me->calls.clone(me);
+    if (!builder)
+        goto failure;
+    launch->owned = builder;
+    launch->builder = builder;
+
+    if (me->data._M_unixsocket_mode || me->data._M_seed_rdb
+            || me->data._M_private_dir) {
+        launch->workdir = RedisServerBuilder_makeWorkDir(me);
+        if (!launch->workdir)
+            goto failure;
+        /* snapshots of the server stay private to it as well */
+        if (!builder->calls.optionString(builder, "dir", launch->workdir))
+            goto failure;
+    }
+    if (me->data._M_seed_rdb
+            && !RedisServerBuilder_seed(builder, me->data._M_seed_rdb,
+                launch->workdir))
+        goto failure;
+    if (!RedisServerBuilder_persist(builder, me->data._M_persistence))
+        goto failure;
+
+    if (me->data._M_unixsocket_mode) {
+        socket = (char*) malloc(strlen(launch->workdir) + sizeof("/redis.sock"));
+        if (!socket)
+            goto failure;
+        sprintf(socket, "%s/redis.sock", launch->workdir);
+        /* TCP is switched off entirely */
+        if (!builder->calls.optionString(builder, "unixsocket", socket)
+                || !builder->calls.optionString(builder, "unixsocketperm", "700")
+                || !builder->calls.optionNumber(builder, "port", 0))
+            goto failure;
+    } else if (allocator) {
+        port = RedisServerBuilder_allocatePort(me, allocator, launch);
+        if (!port || !builder->calls.optionNumber(builder, "port", port))
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = REDIS_SERVER_STATUS_OK;
+    goto cleanup;
+failure:
+    rc = REDIS_SERVER_STATUS_FAILED;
+    goto cleanup;
+cleanup:
+    if (socket) {
+        free(socket);
+        socket = NULL;
+    }
+    goto exit;
+}
+
+/* kill whatever a failed launch left behind */
+static
+void RedisServerBuilder_release(RedisServerLaunch *launch) {
+    if (launch->process) {
+        Process_destroy(launch->process);
+        launch->process = NULL;
+    }
+    if (launch->owned) {
+        RedisServerBuilder_destroy(launch->owned);
+        launch->owned = NULL;
+    }
+    launch->builder = NULL;
+    if (launch->lease != -1) {
+        PortAllocator_release(launch->lease);
+        launch->lease = -1;
+    }
+    if (launch->bus_lease != -1) {
+        PortAllocator_release(launch->bus_lease);
+        launch->bus_lease = -1;
+    }
+    RedisServerBuilder_dropConfig(launch);
+    if (launch->cpus) {
+        free(launch->cpus);
+        launch->cpus = NULL;
+    }
+    if (launch->cgroup) {
+        launch->cgroup->calls.kill(launch->cgroup);
+        ControlGroup_destroy(launch->cgroup);
+        launch->cgroup = NULL;
+    }
+    if (launch->workdir) {
+        RedisServerBuilder_removeDir(launch->workdir);
+        free(launch->workdir);
+        launch->workdir = NULL;
+    }
+}
+
+static
+int RedisServerBuilder_writeAll(int fd, char const *p, size_t n) {
+    ssize_t written = 0;
+
+    while (n > 0) {
+        written = write(fd, p, n);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        p += written;
+        n -= (size_t) written;
+    }
+    return 1;
+}
+
+/*
+ * Generate the redis.conf of a launch in config file mode. An option
+ * "--name value" becomes the line "name value", exactly what redis-server
+ * makes of it on the command line, so both modes configure the same.
+ */
+static
+int RedisServerBuilder_writeConfig(RedisServerLaunch *launch) {
+    int rc = 0;
+    int fd = -1;
+    size_t i = 0;
+    size_t len = 0;
+    size_t size = 0;
+    char *text = NULL;
+    char *p = NULL;
+    char *path = NULL;
+    char const *base = NULL;
+    StringArena const *cfg = launch->builder->data._M_cfg;
+    char const **options = cfg->calls.getArray(cfg);
+
+    /* every option loses its "--" and gains a newline for its terminator */
+    size = cfg->calls.getSize(cfg);
+    text = (char*) malloc(size + 1);
+    if (!text)
+        goto failure;
+    for (i = 0, p = text; options[i]; ++i) {
+        len = strlen(options[i]) - 2;
+        memcpy(p, options[i] + 2, len);
+        p += len;
+        *p++ = '\n';
+    }
+    size = (size_t) (p - text);
+
+    if (launch->workdir) {
+        path = (char*) malloc(strlen(launch->workdir) + sizeof("/redis.conf"));
+        if (!path)
+            goto failure;
+        sprintf(path, "%s/redis.conf", launch->workdir);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            LOGE("open %s failed: %s", path, strerror(errno));
+            goto failure;
+        }
+        if (!RedisServerBuilder_writeAll(fd, text, size))
+            goto failure;
+        close(fd);
+        fd = -1;
+        goto success;
+    }
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    /* never hits the disk, the child opens it through our fd table */
+    fd = memfd_create("redis.conf", MFD_CLOEXEC);
+    if (fd != -1) {
+        if (!RedisServerBuilder_writeAll(fd, text, size))
+            goto failure;
+        path = (char*) malloc(sizeof("/proc//fd/") + 2 * 3 * sizeof(int));
+        if (!path)
+            goto failure;
+        sprintf(path, "/proc/%d/fd/%d", (int) getpid(), fd);
+        launch->config_fd = fd;
+        fd = -1;
+        goto success;
+    }
+    LOGD("memfd_create failed: %s", strerror(errno));
+#endif
+
+    base = RedisServerBuilder_getTempDir(launch->builder);
+    path = (char*) malloc(strlen(base) + sizeof("/redis-XXXXXX.conf"));
+    if (!path)
+        goto failure;
+    sprintf(path, "%s/redis-XXXXXX.conf", base);
+    fd = mkostemps(path, sizeof(".conf") - 1, O_CLOEXEC);
+    if (fd == -1) {
+        LOGE("mkostemps %s failed: %s", path, strerror(errno));
+        goto failure;
+    }
+    launch->config_temp = 1;
+    launch->config = path;
+    path = NULL;
+    if (!RedisServerBuilder_writeAll(fd, text, size))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    if (path) {
+        launch->config = path;
+        path = NULL;
+    }
+    goto cleanup;
+failure:
+    rc = 0;
+    LOGE("writing the config failed");
+    RedisServerBuilder_dropConfig(launch);
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (path) {
+        free(path);
+        path = NULL;
+    }
+    if (text) {
+        free(text);
+        text = NULL;
+    }
+    goto exit;
+}
+
+/* wrap a ready launch into an instance, the process is taken over */
+static
+RedisInstance* RedisServerBuilder_createInstance(RedisServerLaunch *launch) {
+    RedisInstance *r = NULL;
+    RedisInstance *instance = NULL;
+    RedisServerBuilder const *me = launch->builder;
+
+    instance = RedisInstance_create();
+    if (!instance)
+        goto failure;
+    if (me->data._M_bind) {
+        instance->data._M_host = strdup(me->data._M_bind);
+        if (!instance->data._M_host)
+            goto failure;
+    }
+    if (me->data._M_unixsocket) {
+        instance->data._M_unixsocket = strdup(me->data._M_unixsocket);
+        if (!instance->data._M_unixsocket)
+            goto failure;
+    }
+    instance->data._M_port = me->data._M_port;
+    instance->data._M_process = launch->process;
+    launch->process = NULL;
+    instance->data._M_workdir = launch->workdir;
+    launch->workdir = NULL;
+    instance->data._M_port_lease = launch->lease;
+    launch->lease = -1;
+    instance->data._M_bus_lease = launch->bus_lease;
+    launch->bus_lease = -1;
+    instance->data._M_stats = me->data._M_stats;
+    instance->data._M_cgroup = launch->cgroup;
+    launch->cgroup = NULL;
+    if (me->data._M_sampler) {
+        instance->data._M_usage = ResourceSeries_create(
+                me->data._M_sampler->calls.getCapacity(me->data._M_sampler));
+        if (!instance->data._M_usage)
+            goto failure;
+        if (!me->data._M_sampler->calls.watch(me->data._M_sampler,
+                    instance->data._M_process->calls.getPID(instance->data._M_process),
+                    instance->data._M_usage))
+            goto failure;
+        instance->data._M_sampler = me->data._M_sampler;
+    }
+    /* without the per-launch port, socket and dir, for RedisInstance_clone */
+    instance->data._M_builder = launch->origin->calls.clone(launch->origin);
+    if (!instance->data._M_builder)
+        goto failure;
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
+
+/* prepare and fork one launch, launch->status tells why it failed */
+static
+void RedisServerBuilder_launch(RedisServerBuilder const *me, char const *path,
+        RedisServerLaunch *launch, int assign_port) {
+    int status = RedisServerBuilder_prepare(me, launch, assign_port);
+
+    launch->status = status;
+    if (status != REDIS_SERVER_STATUS_OK)
+        return;
+    if (!RedisServerBuilder_place(launch) || !RedisServerBuilder_confine(launch)) {
+        launch->status = REDIS_SERVER_STATUS_FAILED;
+        return;
+    }
+    if (launch->builder->data._M_config_file_mode
+            && !RedisServerBuilder_writeConfig(launch)) {
+        launch->status = REDIS_SERVER_STATUS_FAILED;
+        return;
+    }
+    launch->process = RedisServerBuilder_spawn(launch, path);
+    launch->spawned = LifecycleStats_now();
+    if (launch->process)
+        launch->state = REDIS_SERVER_LAUNCH_WAITING;
+}
+
+/*
+ * A server on an allocated port that exits early while the port is bound
+ * by someone else lost a race against a process outside the allocator,
+ * most likely with EADDRINUSE. It is worth another try on a new port.
+ */
+static
+int RedisServerBuilder_lostPort(RedisServerLaunch const *launch) {
+    return launch->status == REDIS_SERVER_STATUS_EXITED
+        && launch->lease != -1
+        && !PortAllocator_isFree(launch->builder->data._M_port);
+}
+
+/* launch all, wait for all and relaunch those that lost their port */
+static
+void RedisServerBuilder_start(RedisServerBuilder const *me, char const *path,
+        RedisServerLaunch *launches, size_t n, int assign_port) {
+    size_t i = 0;
+    size_t retries = 0;
+    int attempt = 0;
+
+    for (i = 0; i < n; ++i)
+        RedisServerBuilder_launch(me, path, &launches[i], assign_port);
+    RedisServerBuilder_waitReady(launches, n);
+
+    for (attempt = 1; attempt < REDIS_SERVER_PORT_ATTEMPTS; ++attempt) {
+        retries = 0;
+        for (i = 0; i < n; ++i) {
+            if (!RedisServerBuilder_lostPort(&launches[i]))
+                continue;
+            LOGI("port %d taken by another process, retrying",
+                    launches[i].builder->data._M_port);
+            RedisServerBuilder_release(&launches[i]);
+            RedisServerBuilder_launch(me, path, &launches[i], assign_port);
+            ++retries;
+        }
+        if (retries == 0)
+            break;
+        RedisServerBuilder_waitReady(launches, n);
+    }
+}
 
-#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
-#   include <sys/types.h>
-#   include <unistd.h>
-#endif
+/*
+ * the pinned executable or the cached PATH lookup, timed as
+ * LIFECYCLE_SPAN_LOOKUP. a pinned file that went away since setExecutable
+ * is not found here rather than after a fork
+ */
+static
+char* RedisServerBuilder_lookup(RedisServerBuilder const *me) {
+    char *r = NULL;
+    long started = 0;
+    struct stat sb;
 
-#include "redisserverbuilder.h"
+    if (me->data._M_executable) {
+        if (!RedisServerBuilder_isExecutable(me->data._M_executable, &sb)) {
+            LOGE("%s is not an executable file", me->data._M_executable);
+            return NULL;
+        }
+        return strdup(me->data._M_executable);
+    }
+    if (!me->data._M_stats)
+        return RedisServerBuilder_findExecutable();
+    started = LifecycleStats_now();
+    r = RedisServerBuilder_findExecutable();
+    me->data._M_stats->calls.record(me->data._M_stats, LIFECYCLE_SPAN_LOOKUP,
+            LifecycleStats_now() - started);
+    return r;
+}
 
-#ifndef LOGI
-#   define LOGI(fmt, ...)                                                      \
-    do {                                                                       \
-        fprintf(stderr, "[RedisServerBuilder][I] " fmt "\n", ##__VA_ARGS__);   \
-    } while (0)
-#endif
+RedisInstance* RedisServerBuilder_build1(RedisServerBuilder const *me,
+        char const *executable_path, int *status) {
+    RedisInstance *r = NULL;
+    int rc = REDIS_SERVER_STATUS_FAILED;
+    char *found = NULL;
+    struct stat sb;
+    RedisServerLaunch launch;
 
-int RedisServerBuilder_isFileExists(char const *filename) {
-    int rc = 0;
-    FILE *fp = NULL;
-    LOGI("check exists of file %s", filename);
-    fp = fopen(filename, "r");
-    if (!fp)
+    memset(&launch, 0, sizeof(launch));
+    launch.fd = -1;
+    launch.lease = -1;
+    launch.bus_lease = -1;
+    launch.config_fd = -1;
+
+    if (!executable_path) {
+        found = RedisServerBuilder_lookup(me);
+        if (!found) {
+            rc = REDIS_SERVER_STATUS_NOT_FOUND;
+            goto failure;
+        }
+        executable_path = found;
+    } else if (!RedisServerBuilder_isExecutable(executable_path, &sb)) {
+        LOGE("%s is not an executable file", executable_path);
+        rc = REDIS_SERVER_STATUS_NOT_FOUND;
+        goto failure;
+    }
+
+    RedisServerBuilder_start(me, executable_path, &launch, 1, 0);
+    rc = launch.status;
+    if (rc != REDIS_SERVER_STATUS_OK)
+        goto failure;
+    r = RedisServerBuilder_createInstance(&launch);
+    if (!r)
         goto failure;
 
     goto success;
 exit:
-    return rc;
+    if (status)
+        *status = rc;
+    return r;
 success:
-    rc = 1;
+    rc = REDIS_SERVER_STATUS_OK;
     goto cleanup;
 failure:
-    rc = 0;
+    if (rc == REDIS_SERVER_STATUS_OK)
+        rc = REDIS_SERVER_STATUS_FAILED;
     goto cleanup;
 cleanup:
-    if (fp) {
-        fclose(fp);
-        fp = NULL;
+    if (found) {
+        free(found);
+        found = NULL;
     }
+    RedisServerBuilder_release(&launch);
     goto exit;
 }
 
-char* RedisServerBuilder_findInPATH(RedisServerBuilder const* me) {
-    char *r = NULL;
-    char const *filename_with_slash = "/redis-server";
-    char const *filename_without_slash = "redis-server";
-    char const *filename = NULL;
+RedisInstance* RedisServerBuilder_build0(RedisServerBuilder const *me,
+        char const *executable_path) {
+    if (!executable_path)
+        return NULL;
+    return RedisServerBuilder_build1(me, executable_path, NULL);
+}
+
+RedisInstance* RedisServerBuilder_build(RedisServerBuilder const *me) {
+    return RedisServerBuilder_build1(me, NULL, NULL);
+}
+
+size_t RedisServerBuilder_buildMany(RedisServerBuilder const *me, size_t n,
+        RedisInstance **instances, int *statuses) {
+    size_t r = 0;
+    size_t i = 0;
     char *path = NULL;
-    char const *pos = NULL;
-    char const *found = NULL;
-    int path_size = FILENAME_MAX + 1;
-    int len = 0;
-    char const *end = NULL;
+    RedisServerLaunch *launches = NULL;
 
-    pos = getenv("PATH");
-    if (!pos)
+    for (i = 0; i < n; ++i) {
+        instances[i] = NULL;
+        if (statuses)
+            statuses[i] = REDIS_SERVER_STATUS_FAILED;
+    }
+    if (n < 1)
+        goto success;
+    /* a fixed unix socket can not be shared by several servers */
+    if (n > 1 && me->data._M_unixsocket && !me->data._M_unixsocket_mode)
         goto failure;
-    len = strlen(pos);
-    end = pos + len;
 
-    path = (char*) calloc(1, path_size);
-    if (!path)
+    path = RedisServerBuilder_lookup(me);
+    if (!path) {
+        if (statuses)
+            for (i = 0; i < n; ++i)
+                statuses[i] = REDIS_SERVER_STATUS_NOT_FOUND;
+        goto failure;
+    }
+    launches = (RedisServerLaunch*) calloc(n, sizeof(*launches));
+    if (!launches)
         goto failure;
+    for (i = 0; i < n; ++i) {
+        launches[i].lease = -1;
+        launches[i].bus_lease = -1;
+        launches[i].config_fd = -1;
+    }
 
-    /* Try all the paths */
-    for (; pos < end && strlen(&path[0]) < 1; pos = found + 1) {
-        found = strstr(pos, ":");
-        if (!found) {
-            /* It's the last part */
-            found = end;
-        } else if (found - pos < 1) {
-            /* skip empty string */
-            continue;
-        }
+    /* fork every child first, then wait for all of them at once */
+    RedisServerBuilder_start(me, path, launches, n, 1);
 
-        filename = *(found - 1) == '/'
-            ? filename_without_slash
-            : filename_with_slash;
-        if (found - pos + strlen(filename) + 1 > path_size) {
-            /* skip truncated */
-            continue;
+    for (i = 0; i < n; ++i) {
+        if (launches[i].status == REDIS_SERVER_STATUS_OK) {
+            instances[i] = RedisServerBuilder_createInstance(&launches[i]);
+            if (!instances[i])
+                launches[i].status = REDIS_SERVER_STATUS_FAILED;
+            else
+                ++r;
         }
-        memset(&path[0], 0, path_size);
-        strncpy(&path[0], pos, found - pos);
-        strncat(&path[0], filename, strlen(filename));
-        if (!RedisServerBuilder_isFileExists(&path[0]))
-            path[0] = '\0';
+        if (statuses)
+            statuses[i] = launches[i].status;
     }
-
-    if (strlen(&path[0]) == 0)
-        goto failure;
+    LOGI("%lu of %lu redis instances ready", (unsigned long) r, (unsigned long) n);
 
     goto success;
 exit:
     return r;
 success:
-    r = path;
-    path = NULL;
     goto cleanup;
 failure:
+    r = 0;
     goto cleanup;
 cleanup:
+    if (launches) {
+        /* failed members of the batch are killed and reaped */
+        for (i = 0; i < n; ++i)
+            RedisServerBuilder_release(&launches[i]);
+        free(launches);
+        launches = NULL;
+    }
     if (path) {
         free(path);
         path = NULL;
@@ -109,164 +2226,222 @@ cleanup:
     goto exit;
 }
 
-void
-RedisInstance_destroy(RedisInstance *me) {
-    int exitcode = 0;
-    if (me) {
-        if (me->data._M_process) {
-            me->data._M_process->calls.kill0(me->data._M_process, SIGTERM);
-            me->data._M_process->calls.wait(me->data._M_process, &exitcode);
-            LOGI("redis instance exit with code %d", exitcode);
-            Process_destroy(me->data._M_process);
-            me->data._M_process = NULL;
-        }
-        free(me);
-        me = NULL;
+/* CONFIG GET name, returns a copy of the value */
+static
+char* RedisInstance_getConfig(RedisClient *client, char const *name) {
+    char *value = NULL;
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.commandv(client, "CONFIG", "GET", name, NULL);
+    if (reply && reply->type == REDIS_CLIENT_REPLY_ARRAY
+            && reply->elements == 2 && reply->element[1]->str)
+        value = strdup(reply->element[1]->str);
+    RedisClientReply_destroy(reply);
+    return value;
+}
+
+/* wait for the running BGSAVE, returns 1 if it succeeded in time */
+static
+int RedisInstance_waitSave(RedisClient *client, long timeout_ms) {
+    int rc = -1;
+    long deadline = RedisServerBuilder_now() + timeout_ms;
+    long delay = REDIS_SERVER_PROBE_MIN_DELAY;
+    struct timespec ts;
+    RedisClientReply *reply = NULL;
+
+    while (rc < 0) {
+        reply = client->calls.commandv(client, "INFO", "persistence", NULL);
+        if (!reply || !reply->str)
+            rc = 0;
+        else if (strstr(reply->str, "rdb_bgsave_in_progress:0"))
+            rc = strstr(reply->str, "rdb_last_bgsave_status:ok") != NULL;
+        else if (RedisServerBuilder_now() >= deadline)
+            rc = 0;
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+        if (rc >= 0)
+            break;
+        ts.tv_sec = 0;
+        ts.tv_nsec = delay * 1000000L;
+        nanosleep(&ts, NULL);
+        delay = delay * 2 < REDIS_SERVER_PROBE_MAX_DELAY
+            ? delay * 2
+            : REDIS_SERVER_PROBE_MAX_DELAY;
     }
+    return rc;
 }
 
+/* BGSAVE, once more after a save that was running already */
 static
-RedisInstance* RedisInstance_create() {
-    RedisInstance *instance = NULL;
-    instance = (RedisInstance*) calloc(1, sizeof(*instance));
-    return instance;
+int RedisInstance_snapshot(RedisClient *client, long timeout_ms) {
+    int attempt = 0;
+    int busy = 0;
+    RedisClientReply *reply = NULL;
+
+    for (attempt = 0; attempt < 2; ++attempt) {
+        reply = client->calls.commandv(client, "BGSAVE", NULL);
+        busy = reply && reply->type == REDIS_CLIENT_REPLY_ERROR && reply->str
+            && strstr(reply->str, "in progress");
+        if (!reply || (reply->type == REDIS_CLIENT_REPLY_ERROR && !busy)) {
+            LOGE("BGSAVE failed: %s", reply && reply->str ? reply->str : "no reply");
+            RedisClientReply_destroy(reply);
+            return 0;
+        }
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+        /* the running one may have started before the latest writes */
+        if (RedisInstance_waitSave(client, timeout_ms) != 1)
+            return 0;
+        if (!busy)
+            return 1;
+    }
+    return 0;
 }
 
-RedisInstance* RedisServerBuilder_build0(RedisServerBuilder const *me,
-        char const *executable_path) {
-    RedisInstance *instance = NULL;
-    RedisInstance *r = NULL;
-    int exitcode = 0;
-    ProcessBuilder *pb = NULL;
-    Process *p = NULL;
+size_t RedisInstance_clone(RedisInstance const *tmpl, size_t n,
+        RedisInstance **clones) {
+    size_t r = 0;
+    size_t i = 0;
+    long timeout = 0;
+    char *dir = NULL;
+    char *dbfilename = NULL;
+    char *snapshot = NULL;
+    RedisServerBuilder *builder = NULL;
+    RedisClient *client = NULL;
 
-    pb = ProcessBuilder_create();
-    if (!pb)
+    for (i = 0; i < n; ++i)
+        clones[i] = NULL;
+    if (n < 1 || !tmpl->data._M_builder)
         goto failure;
-    pb->calls.setFile(pb, executable_path);
-    pb->calls.setArguments(pb, (char const**) me->data._M_cfg);
-    p = pb->calls.build(pb);
-    if (!p)
+    builder = tmpl->data._M_builder->calls.clone(tmpl->data._M_builder);
+    if (!builder)
         goto failure;
-    /* wait a while and check whether process is terminated */
-    sleep(1);
-    if (p->calls.wait0(p, WNOHANG, &exitcode)) {
-        /* process is already terminated */
-        LOGI("redis process failed with exit code %d", exitcode);
+    timeout = builder->data._M_ready_timeout;
+
+    client = tmpl->calls.connect(tmpl, timeout);
+    if (!client)
+        goto failure;
+    /*
+     * dir and dbfilename are protected configs since redis 7, the
+     * snapshot goes where the template saves anyway
+     */
+    dir = RedisInstance_getConfig(client, "dir");
+    dbfilename = RedisInstance_getConfig(client, "dbfilename");
+    if (!dir || !dbfilename)
+        goto failure;
+    snapshot = (char*) malloc(strlen(dir) + strlen(dbfilename) + 2);
+    if (!snapshot)
+        goto failure;
+    sprintf(snapshot, "%s/%s", dir, dbfilename);
+    if (!RedisInstance_snapshot(client, timeout)) {
+        LOGE("snapshot of template instance failed");
         goto failure;
     }
-    instance = RedisInstance_create();
-    if (!instance)
+
+    /*
+     * each clone links the snapshot into its own dir and loads it, a
+     * later save of the template renames a new file over it
+     */
+    if (!builder->calls.setSeedRDB(builder, snapshot))
         goto failure;
-    instance->data._M_process = p;
-    p = NULL;
+    r = builder->calls.buildMany(builder, n, clones, NULL);
 
     goto success;
 exit:
     return r;
 success:
-    r = instance;
-    instance = NULL;
     goto cleanup;
 failure:
+    r = 0;
     goto cleanup;
 cleanup:
-    if (instance) {
-        RedisInstance_destroy(instance);
-        instance = NULL;
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
     }
-    if (p) {
-        Process_destroy(p);
-        p = NULL;
+    if (snapshot) {
+        free(snapshot);
+        snapshot = NULL;
     }
-    if (pb) {
-        ProcessBuilder_destroy(pb);
-        pb = NULL;
+    if (dbfilename) {
+        free(dbfilename);
+        dbfilename = NULL;
+    }
+    if (dir) {
+        free(dir);
+        dir = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
     }
     goto exit;
 }
 
-RedisInstance* RedisServerBuilder_build(RedisServerBuilder const *me) {
-    RedisInstance *r = NULL;
-    char const *path = NULL;
+static
+int RedisServerBuilder_replaceString(char **dest, char const *value, size_t len) {
+    char *p = NULL;
 
-    path = RedisServerBuilder_findInPATH(me);
-    if (!path)
-        goto failure;
-    r = RedisServerBuilder_build0(me, path);
+    p = (char*) malloc(len + 1);
+    if (!p)
+        return 0;
+    memcpy(p, value, len);
+    p[len] = '\0';
+    if (*dest)
+        free(*dest);
+    *dest = p;
+    return 1;
+}
 
-    goto success;
-exit:
-    return r;
-success:
-    goto cleanup;
-failure:
-    goto cleanup;
-cleanup:
-    if (path) {
-        free((void*) path);
-        path = NULL;
+static
+int RedisServerBuilder_trackOption(RedisServerBuilder *me,
+        char const *name, char const *value) {
+    if (strcmp(name, "port") == 0) {
+        me->data._M_port = atoi(value);
+    } else if (strcmp(name, "bind") == 0) {
+        /* probe the first address of the list */
+        value += strspn(value, " ");
+        if (!RedisServerBuilder_replaceString(&me->data._M_bind, value,
+                    strcspn(value, " ")))
+            return 0;
+    } else if (strcmp(name, "unixsocket") == 0) {
+        if (!RedisServerBuilder_replaceString(&me->data._M_unixsocket, value,
+                    strlen(value)))
+            return 0;
+    } else if (strcmp(name, "cluster-enabled") == 0) {
+        me->data._M_cluster_enabled = strcasecmp(value, "yes") == 0;
+    } else if (strcmp(name, "requirepass") == 0) {
+        free(me->data._M_requirepass);
+        me->data._M_requirepass = NULL;
+        /* "" switches it off again */
+        if (*value && strcmp(value, "\"\"") != 0
+                && !RedisServerBuilder_replaceString(&me->data._M_requirepass,
+                    value, strlen(value)))
+            return 0;
     }
-    goto exit;
+    return 1;
 }
 
 RedisServerBuilder* RedisServerBuilder_optionString(RedisServerBuilder *me,
         char const *name, char const *value) {
-    char buffer[1024];
-    int c = 0;
-    char **p = NULL;
-    size_t size = 0;
-    size_t required_size = 0;
-    RedisServerBuilder *r = NULL;
-
-    /* append option string */
+    StringArena *cfg = me->data._M_cfg;
 
     /*
      * FIXME DO NOT add space before "--name value", which  will let
      * redis-server take it as config file name.
      */
-    c = snprintf(&buffer[0], sizeof(buffer), "--%s %s", name, value);
-    if (c < 0) {
-        /* impossbile */
-        LOGI("snprintf failed!");
-        goto failure;
-    } else if (c >= sizeof(buffer)) {
-        /* truncated */
-        LOGI("snprintf truncated %s => %s", value, &buffer[0]);
-        goto failure;
-    }
-    if (me->data._M_cfg)
-        for (p = me->data._M_cfg; *p; ++p)
-            ++size;
-    required_size = size ? (size + 1 + 1) : 2;
-    p = (char**) realloc(me->data._M_cfg,
-            required_size * sizeof(*me->data._M_cfg));
-    if (!p)
-        goto failure;
-    if (required_size == 2)
-        memset(p, 0, sizeof(*p) * 2);
-    me->data._M_cfg = p;
-    p = &me->data._M_cfg[required_size - 1];
-    /* terminated it with NULL in case of future allocation failure */
-    *p = NULL;
-    --p;
-    *p = (char*) realloc(NULL, strlen(buffer) + 1);
-    if (!*p)
-        goto failure;
-    strncpy(*p, &buffer[0], strlen(buffer) + 1);
-
-    goto success;
-exit:
-    return r;
-success:
-    r = me;
-    goto cleanup;
-failure:
-    LOGI("%s failed", __func__);
-    r = NULL;
-    goto cleanup;
-cleanup:
-    goto exit;
+    if (!name || !value || !cfg->calls.concat(cfg, "--", name, " ", value, NULL)) {
+        LOGE("%s failed", __func__);
+        return NULL;
+    }
+    /* remember where the server will listen so build can probe it */
+    if (!RedisServerBuilder_trackOption(me, name, value)) {
+        /* all or nothing, the option goes again */
+        cfg->calls.remove(cfg, cfg->calls.getCount(cfg) - 1);
+        LOGE("%s failed", __func__);
+        return NULL;
+    }
+    return me;
 }
 
 RedisServerBuilder* RedisServerBuilder_optionNumber(RedisServerBuilder *me,
@@ -279,7 +2454,7 @@ RedisServerBuilder* RedisServerBuilder_optionNumber(RedisServerBuilder *me,
     c = snprintf(&buffer[0], sizeof(buffer), "%ld", value);
     if (c >= sizeof(buffer)) {
         /* truncated is nearly impossible due to buffer size */
-        LOGI("truncated option value for long %ld => %s", value, &buffer[0]);
+        LOGE("truncated option value for long %ld => %s", value, &buffer[0]);
         goto failure;
     } else if (c < 0) {
         goto failure;
@@ -300,28 +2475,453 @@ cleanup:
 }
 
 char const** RedisServerBuilder_getParameters(RedisServerBuilder const *me) {
-    return (char const**) me->data._M_cfg;
+    return me->data._M_cfg->calls.getArray(me->data._M_cfg);
+}
+
+RedisServerBuilder* RedisServerBuilder_setReadyTimeout(RedisServerBuilder *me,
+        long milliseconds) {
+    if (milliseconds <= 0)
+        return NULL;
+    me->data._M_ready_timeout = milliseconds;
+    return me;
+}
+
+long RedisServerBuilder_getReadyTimeout(RedisServerBuilder const *me) {
+    return me->data._M_ready_timeout;
+}
+
+RedisServerBuilder* RedisServerBuilder_setUnixSocketMode(RedisServerBuilder *me,
+        int enabled) {
+    me->data._M_unixsocket_mode = enabled ? 1 : 0;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setPrivateDir(RedisServerBuilder *me,
+        int enabled) {
+    me->data._M_private_dir = enabled ? 1 : 0;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setTempDir(RedisServerBuilder *me,
+        char const *path) {
+    if (path) {
+        if (!RedisServerBuilder_replaceString(&me->data._M_tmpdir, path,
+                    strlen(path)))
+            return NULL;
+    } else if (me->data._M_tmpdir) {
+        free(me->data._M_tmpdir);
+        me->data._M_tmpdir = NULL;
+    }
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setSeedRDB(RedisServerBuilder *me,
+        char const *path) {
+    if (path) {
+        if (!RedisServerBuilder_replaceString(&me->data._M_seed_rdb, path,
+                    strlen(path)))
+            return NULL;
+    } else if (me->data._M_seed_rdb) {
+        free(me->data._M_seed_rdb);
+        me->data._M_seed_rdb = NULL;
+    }
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setPortAllocator(RedisServerBuilder *me,
+        PortAllocator *allocator) {
+    me->data._M_port_allocator = allocator;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setSpawnMode(RedisServerBuilder *me,
+        int mode) {
+    if (mode < PROCESS_SPAWN_FORK || mode > PROCESS_SPAWN_CLONE)
+        return NULL;
+    me->data._M_spawn_mode = mode;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setExecutable(RedisServerBuilder *me,
+        char const *path) {
+    struct stat sb;
+
+    if (path && !RedisServerBuilder_isExecutable(path, &sb)) {
+        LOGE("%s is not an executable file", path);
+        return NULL;
+    }
+    if (!path) {
+        free(me->data._M_executable);
+        me->data._M_executable = NULL;
+    } else if (!RedisServerBuilder_replaceString(&me->data._M_executable, path,
+                strlen(path))) {
+        return NULL;
+    }
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setMemoryDir(RedisServerBuilder *me,
+        int enabled) {
+    me->data._M_memory_dir = enabled ? 1 : 0;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setPersistence(RedisServerBuilder *me,
+        int persistence) {
+    switch (persistence) {
+        case REDIS_SERVER_PERSISTENCE_DEFAULT:
+        case REDIS_SERVER_PERSISTENCE_NONE:
+        case REDIS_SERVER_PERSISTENCE_RDB:
+        case REDIS_SERVER_PERSISTENCE_AOF_EVERYSEC:
+        case REDIS_SERVER_PERSISTENCE_AOF_ALWAYS:
+            me->data._M_persistence = persistence;
+            return me;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+RedisServerBuilder* RedisServerBuilder_setPlacement(RedisServerBuilder *me,
+        int placement, char const *cpulist, size_t cpus_per_instance) {
+    switch (placement) {
+        case REDIS_SERVER_PLACEMENT_NONE:
+        case REDIS_SERVER_PLACEMENT_SHARED:
+        case REDIS_SERVER_PLACEMENT_ROUND_ROBIN:
+            break;
+        default:
+            return NULL;
+    }
+    if (cpulist && ProcessBuilder_parseCPUList(cpulist, NULL, 0) < 1) {
+        LOGE("invalid cpu list %s", cpulist);
+        return NULL;
+    }
+    if (!cpulist) {
+        free(me->data._M_cpulist);
+        me->data._M_cpulist = NULL;
+    } else if (!RedisServerBuilder_replaceString(&me->data._M_cpulist, cpulist,
+                strlen(cpulist))) {
+        return NULL;
+    }
+    me->data._M_placement = placement;
+    me->data._M_cpus_per_instance = cpus_per_instance > 0 ? cpus_per_instance : 1;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setThreadCPUs(RedisServerBuilder *me,
+        int enabled) {
+    me->data._M_thread_cpus = enabled ? 1 : 0;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setMemoryNode(RedisServerBuilder *me,
+        int node) {
+    if (node < -1 || node >= PROCESS_MAX_NODES)
+        return NULL;
+    me->data._M_memory_node = node;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setProcessGroup(RedisServerBuilder *me,
+        int pgid) {
+    if (pgid < -1)
+        return NULL;
+    me->data._M_pgid = pgid;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setParentDeathSignal(RedisServerBuilder *me,
+        int sig) {
+    if (sig < 0 || sig >= NSIG)
+        return NULL;
+    me->data._M_death_signal = sig;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setControlGroup(RedisServerBuilder *me,
+        ControlGroup *group) {
+    me->data._M_cgroup = group;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setOutput(RedisServerBuilder *me,
+        int mode, char const *path) {
+    char *p = NULL;
+
+    switch (mode) {
+        case PROCESS_OUTPUT_INHERIT:
+        case PROCESS_OUTPUT_NULL:
+        case PROCESS_OUTPUT_CAPTURE:
+            break;
+        case PROCESS_OUTPUT_FILE:
+            if (!path || !*path)
+                return NULL;
+            p = strdup(path);
+            if (!p)
+                return NULL;
+            break;
+        default:
+            return NULL;
+    }
+    free(me->data._M_output_path);
+    me->data._M_output_path = p;
+    me->data._M_output = mode;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setOutputHook(RedisServerBuilder *me,
+        OutputLogHook hook, void *context) {
+    me->data._M_output_hook = hook;
+    me->data._M_output_context = context;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setSampler(RedisServerBuilder *me,
+        ResourceSampler *sampler) {
+    me->data._M_sampler = sampler;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setLimits(RedisServerBuilder *me,
+        long memory_max, long cpu_max_us) {
+    if (memory_max < -1 || cpu_max_us < -1 || cpu_max_us == 0)
+        return NULL;
+    me->data._M_memory_max = memory_max;
+    me->data._M_cpu_max = cpu_max_us;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setConfigFileMode(RedisServerBuilder *me,
+        int enabled) {
+    me->data._M_config_file_mode = enabled ? 1 : 0;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_setStats(RedisServerBuilder *me,
+        LifecycleStats *stats) {
+    me->data._M_stats = stats;
+    return me;
+}
+
+RedisServerBuilder* RedisServerBuilder_clone(RedisServerBuilder const *me) {
+    RedisServerBuilder *r = NULL;
+    RedisServerBuilder *instance = NULL;
+    StringArena *cfg = NULL;
+
+    instance = RedisServerBuilder_create();
+    if (!instance)
+        goto failure;
+    cfg = me->data._M_cfg->calls.clone(me->data._M_cfg);
+    if (!cfg)
+        goto failure;
+    StringArena_destroy(instance->data._M_cfg);
+    instance->data._M_cfg = cfg;
+    if (me->data._M_bind) {
+        instance->data._M_bind = strdup(me->data._M_bind);
+        if (!instance->data._M_bind)
+            goto failure;
+    }
+    if (me->data._M_unixsocket) {
+        instance->data._M_unixsocket = strdup(me->data._M_unixsocket);
+        if (!instance->data._M_unixsocket)
+            goto failure;
+    }
+    if (me->data._M_requirepass) {
+        instance->data._M_requirepass = strdup(me->data._M_requirepass);
+        if (!instance->data._M_requirepass)
+            goto failure;
+    }
+    instance->data._M_port = me->data._M_port;
+    instance->data._M_ready_timeout = me->data._M_ready_timeout;
+    instance->data._M_spawn_mode = me->data._M_spawn_mode;
+    instance->data._M_unixsocket_mode = me->data._M_unixsocket_mode;
+    instance->data._M_private_dir = me->data._M_private_dir;
+    instance->data._M_memory_dir = me->data._M_memory_dir;
+    instance->data._M_persistence = me->data._M_persistence;
+    instance->data._M_config_file_mode = me->data._M_config_file_mode;
+    instance->data._M_placement = me->data._M_placement;
+    instance->data._M_cpus_per_instance = me->data._M_cpus_per_instance;
+    instance->data._M_thread_cpus = me->data._M_thread_cpus;
+    instance->data._M_memory_node = me->data._M_memory_node;
+    instance->data._M_pgid = me->data._M_pgid;
+    instance->data._M_death_signal = me->data._M_death_signal;
+    instance->data._M_cgroup = me->data._M_cgroup;
+    instance->data._M_memory_max = me->data._M_memory_max;
+    instance->data._M_cpu_max = me->data._M_cpu_max;
+    instance->data._M_output = me->data._M_output;
+    instance->data._M_output_hook = me->data._M_output_hook;
+    instance->data._M_output_context = me->data._M_output_context;
+    instance->data._M_sampler = me->data._M_sampler;
+    if (me->data._M_output_path) {
+        instance->data._M_output_path = strdup(me->data._M_output_path);
+        if (!instance->data._M_output_path)
+            goto failure;
+    }
+    if (me->data._M_cpulist) {
+        instance->data._M_cpulist = strdup(me->data._M_cpulist);
+        if (!instance->data._M_cpulist)
+            goto failure;
+    }
+    instance->data._M_cluster_enabled = me->data._M_cluster_enabled;
+    instance->data._M_port_allocator = me->data._M_port_allocator;
+    instance->data._M_stats = me->data._M_stats;
+    if (me->data._M_executable) {
+        instance->data._M_executable = strdup(me->data._M_executable);
+        if (!instance->data._M_executable)
+            goto failure;
+    }
+    if (me->data._M_tmpdir) {
+        instance->data._M_tmpdir = strdup(me->data._M_tmpdir);
+        if (!instance->data._M_tmpdir)
+            goto failure;
+    }
+    if (me->data._M_seed_rdb) {
+        instance->data._M_seed_rdb = strdup(me->data._M_seed_rdb);
+        if (!instance->data._M_seed_rdb)
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        RedisServerBuilder_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
+
+int RedisServerBuilder_findFreePort() {
+    int port = 0;
+    int fd = -1;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        goto failure;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+        goto failure;
+    if (getsockname(fd, (struct sockaddr*) &addr, &len) == -1)
+        goto failure;
+    port = ntohs(addr.sin_port);
+
+    goto success;
+exit:
+    return port;
+success:
+    goto cleanup;
+failure:
+    port = 0;
+    goto cleanup;
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    goto exit;
 }
 
 RedisServerBuilder* RedisServerBuilder_create() {
     RedisServerBuilder *instance = (RedisServerBuilder*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->data._M_cfg = StringArena_create();
+    if (!instance->data._M_cfg) {
+        free(instance);
+        return NULL;
+    }
+    instance->data._M_port = REDIS_SERVER_DEFAULT_PORT;
+    instance->data._M_ready_timeout = REDIS_SERVER_DEFAULT_READY_TIMEOUT;
+    instance->data._M_private_dir = 1;
+    instance->data._M_cpus_per_instance = 1;
+    instance->data._M_memory_node = -1;
+    instance->data._M_pgid = -1;
+    instance->data._M_memory_max = -1;
+    instance->data._M_cpu_max = -1;
     instance->calls.build0 = &RedisServerBuilder_build0;
+    instance->calls.build1 = &RedisServerBuilder_build1;
     instance->calls.build = &RedisServerBuilder_build;
+    instance->calls.buildMany = &RedisServerBuilder_buildMany;
     instance->calls.optionString = &RedisServerBuilder_optionString;
     instance->calls.optionNumber = &RedisServerBuilder_optionNumber;
     instance->calls.getParameters = &RedisServerBuilder_getParameters;
+    instance->calls.setReadyTimeout = &RedisServerBuilder_setReadyTimeout;
+    instance->calls.getReadyTimeout = &RedisServerBuilder_getReadyTimeout;
+    instance->calls.setSpawnMode = &RedisServerBuilder_setSpawnMode;
+    instance->calls.setUnixSocketMode = &RedisServerBuilder_setUnixSocketMode;
+    instance->calls.setTempDir = &RedisServerBuilder_setTempDir;
+    instance->calls.setPrivateDir = &RedisServerBuilder_setPrivateDir;
+    instance->calls.setPortAllocator = &RedisServerBuilder_setPortAllocator;
+    instance->calls.setSeedRDB = &RedisServerBuilder_setSeedRDB;
+    instance->calls.setStats = &RedisServerBuilder_setStats;
+    instance->calls.setExecutable = &RedisServerBuilder_setExecutable;
+    instance->calls.setConfigFileMode = &RedisServerBuilder_setConfigFileMode;
+    instance->calls.setMemoryDir = &RedisServerBuilder_setMemoryDir;
+    instance->calls.setPersistence = &RedisServerBuilder_setPersistence;
+    instance->calls.setPlacement = &RedisServerBuilder_setPlacement;
+    instance->calls.setThreadCPUs = &RedisServerBuilder_setThreadCPUs;
+    instance->calls.setMemoryNode = &RedisServerBuilder_setMemoryNode;
+    instance->calls.setProcessGroup = &RedisServerBuilder_setProcessGroup;
+    instance->calls.setParentDeathSignal = &RedisServerBuilder_setParentDeathSignal;
+    instance->calls.setControlGroup = &RedisServerBuilder_setControlGroup;
+    instance->calls.setLimits = &RedisServerBuilder_setLimits;
+    instance->calls.setOutput = &RedisServerBuilder_setOutput;
+    instance->calls.setOutputHook = &RedisServerBuilder_setOutputHook;
+    instance->calls.setSampler = &RedisServerBuilder_setSampler;
+    instance->calls.clone = &RedisServerBuilder_clone;
     return instance;
 }
 
 void RedisServerBuilder_destroy(RedisServerBuilder *me) {
-    char **p = NULL;
     if (me) {
         if (me->data._M_cfg) {
-            for (p = me->data._M_cfg; *p; ++p)
-                free((void*) *p);
-            free(me->data._M_cfg);
+            StringArena_destroy(me->data._M_cfg);
             me->data._M_cfg = NULL;
         }
+        if (me->data._M_bind) {
+            free(me->data._M_bind);
+            me->data._M_bind = NULL;
+        }
+        if (me->data._M_unixsocket) {
+            free(me->data._M_unixsocket);
+            me->data._M_unixsocket = NULL;
+        }
+        if (me->data._M_tmpdir) {
+            free(me->data._M_tmpdir);
+            me->data._M_tmpdir = NULL;
+        }
+        if (me->data._M_requirepass) {
+            free(me->data._M_requirepass);
+            me->data._M_requirepass = NULL;
+        }
+        if (me->data._M_seed_rdb) {
+            free(me->data._M_seed_rdb);
+            me->data._M_seed_rdb = NULL;
+        }
+        if (me->data._M_output_path) {
+            free(me->data._M_output_path);
+            me->data._M_output_path = NULL;
+        }
+        if (me->data._M_executable) {
+            free(me->data._M_executable);
+            me->data._M_executable = NULL;
+        }
+        if (me->data._M_cpulist) {
+            free(me->data._M_cpulist);
+            me->data._M_cpulist = NULL;
+        }
         free(me);
         /* Nonsense assignment */
         me = NULL;
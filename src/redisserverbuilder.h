@@ -3,7 +3,11 @@
 
 #include <stddef.h>
 
+#include "controlgroup.h"
 #include "processbuilder.h"
+#include "portallocator.h"
+#include "resourcesampler.h"
+#include "stringarena.h"
 
 #ifdef __cplusplus
 extern {
@@ -11,13 +15,128 @@ extern {
 
     struct tagRedisInstance;
     struct tagRedisServerBuilder;
+    struct tagRedisClient;
 
     typedef struct tagRedisInstance RedisInstance;
     typedef struct tagRedisServerBuilder RedisServerBuilder;
 
+    /* status reported by build1 */
+    enum {
+        REDIS_SERVER_STATUS_OK = 0,
+        /* invalid arguments or resource allocation failure */
+        REDIS_SERVER_STATUS_FAILED,
+        /* redis-server executable could not be found */
+        REDIS_SERVER_STATUS_NOT_FOUND,
+        /* redis-server exited before it was ready */
+        REDIS_SERVER_STATUS_EXITED,
+        /* redis-server did not become ready before the deadline */
+        REDIS_SERVER_STATUS_TIMEDOUT,
+        /* the child could not be started (fork, chdir or execve failed) */
+        REDIS_SERVER_STATUS_SPAWN_FAILED
+    };
+
+    /* what a server persists, see setPersistence */
+    enum {
+        /* whatever the options given say, redis defaults otherwise */
+        REDIS_SERVER_PERSISTENCE_DEFAULT = 0,
+        /* no snapshots, no AOF */
+        REDIS_SERVER_PERSISTENCE_NONE,
+        /* the snapshot points of the stock redis.conf, no AOF */
+        REDIS_SERVER_PERSISTENCE_RDB,
+        /* AOF fsync'ed once a second, no snapshots */
+        REDIS_SERVER_PERSISTENCE_AOF_EVERYSEC,
+        /* AOF fsync'ed on every write, no snapshots */
+        REDIS_SERVER_PERSISTENCE_AOF_ALWAYS
+    };
+
+    /* how builds spread their servers over the cpus, see setPlacement */
+    enum {
+        /* the scheduler decides, servers float across all cpus */
+        REDIS_SERVER_PLACEMENT_NONE = 0,
+        /* every server is pinned to the whole cpu set */
+        REDIS_SERVER_PLACEMENT_SHARED,
+        /* each server gets the next cpus_per_instance cpus of the set */
+        REDIS_SERVER_PLACEMENT_ROUND_ROBIN
+    };
+
+    /* what RedisInstance reset restores, combine with | */
+    enum {
+        /* FLUSHALL ASYNC, the memory is freed in the background */
+        REDIS_INSTANCE_RESET_DATA       = 1 << 0,
+        /* SCRIPT FLUSH */
+        REDIS_INSTANCE_RESET_SCRIPTS    = 1 << 1,
+        /* CONFIG RESETSTAT */
+        REDIS_INSTANCE_RESET_STATS      = 1 << 2,
+        /* CLIENT KILL TYPE normal, except the control connection */
+        REDIS_INSTANCE_RESET_CLIENTS    = 1 << 3,
+        /* CONFIG SET of every runtime option given to the builder */
+        REDIS_INSTANCE_RESET_CONFIG     = 1 << 4,
+        REDIS_INSTANCE_RESET_ALL        = (1 << 5) - 1
+    };
+
     struct tagRedisInstance {
+        struct {
+            Process*    (*getProcess)   (RedisInstance const*);
+            char const* (*getHost)      (RedisInstance const*);
+            int         (*getPort)      (RedisInstance const*);
+            /* path of the unix socket, NULL when listening on TCP only */
+            char const* (*getUnixSocket)(RedisInstance const*);
+            /* new client connection, over the unix socket if there is one */
+            struct tagRedisClient*
+                        (*connect)      (RedisInstance const*, long timeout_ms);
+            /*
+             * Return the server to its state right after build, the steps
+             * are picked by REDIS_INSTANCE_RESET_* flags and sent as one
+             * pipeline over a cached control connection. Options changed
+             * at runtime that the builder never set are not restored,
+             * builder options the server refuses to set at runtime
+             * (immutable ones such as io-threads) are skipped.
+             * elapsed_us (optional) receives the wall time spent. Returns
+             * 1 on success.
+             */
+            int         (*reset)        (RedisInstance*, int flags, long *elapsed_us);
+            /*
+             * Stop the server within timeout_ms: SHUTDOWN NOSAVE first,
+             * SIGTERM after half of it (right away if SHUTDOWN could not
+             * be sent or was answered with an error), SIGKILL once it is
+             * over. The process is reaped and gone afterwards. Returns 1
+             * if it exited before SIGKILL.
+             */
+            int         (*shutdown)     (RedisInstance*, long timeout_ms);
+            /* cgroup of the server (setControlGroup), NULL if it has none */
+            ControlGroup*
+                        (*getControlGroup)(RedisInstance const*);
+            /*
+             * What the server cost over time (setSampler), NULL if it is
+             * not sampled. Once the server is reaped, its rusage from
+             * wait4 becomes the last sample: rss 0, peak from ru_maxrss.
+             */
+            ResourceSeries*
+                        (*getUsage)     (RedisInstance const*);
+        } calls;
+
         struct {
             Process *_M_process;
+            char    *_M_host;
+            int      _M_port;
+            char    *_M_unixsocket;
+            /* private directory removed on destroy, NULL if none */
+            char    *_M_workdir;
+            /* allocated port held until destroy, -1 if none */
+            int      _M_port_lease;
+            /* cluster bus port held along with it, -1 if none */
+            int      _M_bus_lease;
+            /* copy of the builder this instance was built from */
+            RedisServerBuilder *_M_builder;
+            /* control connection of reset, opened on first use */
+            struct tagRedisClient *_M_client;
+            /* shutdown spans go here, NULL if not measured */
+            LifecycleStats *_M_stats;
+            /* group of its own below the builder's, removed on destroy */
+            ControlGroup *_M_cgroup;
+            /* sampler feeding _M_usage (not owned), NULL if not sampled */
+            ResourceSampler *_M_sampler;
+            ResourceSeries *_M_usage;
         } data;
     };
 
@@ -25,20 +144,240 @@ extern {
         struct {
             RedisInstance*      (*build)        (RedisServerBuilder const*);
             RedisInstance*      (*build0)       (RedisServerBuilder const*, char const*);
+            RedisInstance*      (*build1)       (RedisServerBuilder const*, char const*, int *status);
+            /*
+             * Start n instances concurrently, each one on its own allocated
+             * port.
+             * instances[i] is NULL and statuses[i] (optional) tells why when
+             * instance i failed, failed children are already reaped. Returns
+             * the number of ready instances.
+             */
+            size_t              (*buildMany)    (RedisServerBuilder const*, size_t n,
+                                                 RedisInstance **instances, int *statuses);
             RedisServerBuilder* (*optionString) (RedisServerBuilder*, char const *name, char const *value);
             RedisServerBuilder* (*optionNumber) (RedisServerBuilder*, char const *name, long value);
             char const**        (*getParameters)(RedisServerBuilder const*);
+
+            /* how long build waits for the server to answer PING (ms) */
+            RedisServerBuilder* (*setReadyTimeout)(RedisServerBuilder*, long);
+            long                (*getReadyTimeout)(RedisServerBuilder const*);
+
+            /*
+             * Listen on a unix socket only. Each build creates a private
+             * directory below the temp dir holding the socket, it is the
+             * server's dir as well and removed by RedisInstance_destroy.
+             */
+            RedisServerBuilder* (*setUnixSocketMode)(RedisServerBuilder*, int enabled);
+            /* base of private directories, defaults to $TMPDIR or /tmp */
+            RedisServerBuilder* (*setTempDir)   (RedisServerBuilder*, char const*);
+            /*
+             * Run every server in a private directory below the temp dir
+             * (its dir and working directory, so RDB, AOF and nodes.conf
+             * files never clash), removed again by RedisInstance_destroy.
+             * On by default, disabled servers run in the caller's cwd.
+             */
+            RedisServerBuilder* (*setPrivateDir)(RedisServerBuilder*, int enabled);
+            /*
+             * Put private directories on tmpfs (/dev/shm) instead of the
+             * temp dir, so snapshots and fsyncs never wait for a disk. The
+             * temp dir is used where /dev/shm is missing.
+             */
+            RedisServerBuilder* (*setMemoryDir) (RedisServerBuilder*, int enabled);
+            /*
+             * Persistence preset of every build, one of
+             * REDIS_SERVER_PERSISTENCE_*. It goes after the options given,
+             * so it wins over save, appendonly and appendfsync set there.
+             */
+            RedisServerBuilder* (*setPersistence)(RedisServerBuilder*, int persistence);
+            /*
+             * Take the port of every build from allocator (not owned, must
+             * outlive the builder and its clones). A server that exits
+             * because its port got taken meanwhile is restarted on a new
+             * one. buildMany uses PortAllocator_getDefault() when unset.
+             */
+            RedisServerBuilder* (*setPortAllocator)(RedisServerBuilder*, PortAllocator*);
+            /*
+             * Boot every server from a copy of the RDB at path (NULL to
+             * unset). The copy lands in a private dir as a hardlink, a
+             * reflink or an in-kernel copy, whichever the filesystem allows
+             * first. build returns once the dataset is loaded, so large
+             * seeds may need a longer ready timeout.
+             */
+            RedisServerBuilder* (*setSeedRDB)   (RedisServerBuilder*, char const *path);
+
+            /* spawn backend, one of PROCESS_SPAWN_* */
+            RedisServerBuilder* (*setSpawnMode) (RedisServerBuilder*, int mode);
+            /*
+             * Time every LIFECYCLE_SPAN_* of the builds and of destroying
+             * their instances into stats (not owned, must outlive the
+             * builder, its clones and instances). NULL to stop.
+             */
+            RedisServerBuilder* (*setStats)     (RedisServerBuilder*, LifecycleStats*);
+            /*
+             * Launch path instead of the redis-server found in PATH, so a
+             * test can pin the binary version it runs against. Fails if
+             * path is not an executable file, NULL goes back to PATH.
+             */
+            RedisServerBuilder* (*setExecutable)(RedisServerBuilder*, char const *path);
+            /*
+             * Hand the options to the server as one generated redis.conf
+             * instead of one argument each, for configs too large for the
+             * command line. The file lands in the private dir if there is
+             * one (so CONFIG REWRITE keeps working), in a memfd otherwise,
+             * or in a temp file where memfds are not available. Those two
+             * are gone once the server is ready.
+             */
+            RedisServerBuilder* (*setConfigFileMode)(RedisServerBuilder*, int enabled);
+
+            /*
+             * Pin servers to the cpus of cpulist ("0-7,16-23"), NULL for
+             * the cpus this process may run on. Round robin keeps going
+             * across builds and builders of the process, so a batch or a
+             * fleet spreads out evenly and wraps around. Linux only.
+             */
+            RedisServerBuilder* (*setPlacement) (RedisServerBuilder*, int placement,
+                                                 char const *cpulist, size_t cpus_per_instance);
+            /*
+             * Pass the placement on to the threads of redis as well
+             * (server_cpulist, bio_cpulist, aof_rewrite_cpulist and
+             * bgsave_cpulist). Needs redis 6.2 or later, older servers
+             * refuse to start with them.
+             */
+            RedisServerBuilder* (*setThreadCPUs)(RedisServerBuilder*, int enabled);
+            /*
+             * Allocate server memory on NUMA node only, -1 (default) for no
+             * policy. Fails from PROCESS_MAX_NODES on.
+             */
+            RedisServerBuilder* (*setMemoryNode)(RedisServerBuilder*, int node);
+
+            /*
+             * Process group of the servers, see ProcessBuilder
+             * setProcessGroup: 0 for a new one per server, or the pid of a
+             * server started that way for all of them to join it, so
+             * killpg(pgid) stops them in one call. -1 (default) for ours.
+             */
+            RedisServerBuilder* (*setProcessGroup)(RedisServerBuilder*, int pgid);
+            /*
+             * Signal servers get once the thread that built them exits, so
+             * a crashed test run takes its servers along (SIGKILL is a good
+             * choice). Build from a thread that lives as long as they do,
+             * 0 (default) for none. Linux only.
+             */
+            RedisServerBuilder* (*setParentDeathSignal)(RedisServerBuilder*, int sig);
+            /*
+             * Start every server in a cgroup of its own below group (not
+             * owned, must outlive the builder, its clones and instances),
+             * NULL to stop. Killing group stops the whole fleet at once and
+             * its memory and cpu figures add up all servers.
+             */
+            RedisServerBuilder* (*setControlGroup)(RedisServerBuilder*, ControlGroup *group);
+            /*
+             * memory.max (bytes) and cpu.max (us of cpu time per 100 ms,
+             * 100000 is one cpu) of the cgroup of each server, -1 for no
+             * limit. Needs setControlGroup and the controllers in group.
+             */
+            RedisServerBuilder* (*setLimits)    (RedisServerBuilder*, long memory_max, long cpu_max_us);
+
+            /*
+             * Where stdout and stderr of the servers go, one of
+             * PROCESS_OUTPUT_*. A relative file is opened in the private
+             * dir of each server. Captured output is kept by the OutputLog
+             * of the instance's Process, the last lines of a failed launch
+             * are logged.
+             */
+            RedisServerBuilder* (*setOutput)    (RedisServerBuilder*, int mode, char const *path);
+            /*
+             * Line hook of captured output, e.g. to follow "Loading" or
+             * to see readiness as soon as the server reports it. It runs
+             * on the reader thread, for every server of every build.
+             */
+            RedisServerBuilder* (*setOutputHook)(RedisServerBuilder*, OutputLogHook, void *context);
+            /*
+             * Sample rss, cpu time, context switches and page faults of
+             * every server with sampler (not owned, must outlive the
+             * builder, its clones and instances), see RedisInstance
+             * getUsage. NULL to stop.
+             */
+            RedisServerBuilder* (*setSampler)   (RedisServerBuilder*, ResourceSampler*);
+
+            /* deep copy, used to derive per instance builders */
+            RedisServerBuilder* (*clone)        (RedisServerBuilder const*);
         } calls;
 
         struct {
-            char    **_M_cfg;
+            /* one "--name value" string per option, in order */
+            StringArena *_M_cfg;
+            char     *_M_bind;
+            int       _M_port;
+            char     *_M_unixsocket;
+            /* requirepass, NULL if none, readiness probes and connect AUTH with it */
+            char     *_M_requirepass;
+            long      _M_ready_timeout;
+            int       _M_spawn_mode;
+            int       _M_unixsocket_mode;
+            int       _M_private_dir;
+            int       _M_memory_dir;
+            /* REDIS_SERVER_PERSISTENCE_* */
+            int       _M_persistence;
+            int       _M_config_file_mode;
+            /* REDIS_SERVER_PLACEMENT_*, cpulist NULL for all allowed cpus */
+            int       _M_placement;
+            char     *_M_cpulist;
+            size_t    _M_cpus_per_instance;
+            int       _M_thread_cpus;
+            int       _M_memory_node;
+            int       _M_pgid;
+            int       _M_death_signal;
+            ControlGroup *_M_cgroup;
+            /* limits of the group of each server, -1 for none */
+            long      _M_memory_max;
+            long      _M_cpu_max;
+            /* PROCESS_OUTPUT_*, file for PROCESS_OUTPUT_FILE */
+            int       _M_output;
+            char     *_M_output_path;
+            OutputLogHook _M_output_hook;
+            void     *_M_output_context;
+            ResourceSampler *_M_sampler;
+            /* cluster-enabled yes, allocated ports need a free bus port */
+            int       _M_cluster_enabled;
+            char     *_M_tmpdir;
+            char     *_M_seed_rdb;
+            PortAllocator *_M_port_allocator;
+            LifecycleStats *_M_stats;
+            /* pinned executable, NULL to search PATH */
+            char     *_M_executable;
         } data;
     };
 
     extern RedisServerBuilder*  RedisServerBuilder_create();
     extern void                 RedisServerBuilder_destroy(RedisServerBuilder*);
 
+    extern char const*          RedisServerBuilder_getStatusString(int status);
+    /* ask the kernel for a currently unused loopback TCP port, 0 on failure */
+    extern int                  RedisServerBuilder_findFreePort();
+
+    /* shutdown with a 30 s deadline, no SHUTDOWN NOSAVE without a private dir */
     extern void                 RedisInstance_destroy(RedisInstance*);
+    /*
+     * shutdown of n instances (NULL entries skipped) sharing one deadline,
+     * all of them step through NOSAVE, SIGTERM and SIGKILL together, so a
+     * fleet stops as fast as its slowest server. One that refuses
+     * SHUTDOWN gets SIGTERM on its own right away. Returns the number of
+     * servers that exited before SIGKILL.
+     */
+    extern size_t               RedisInstance_shutdownMany(RedisInstance **instances, size_t n,
+                                                           long timeout_ms);
+    /*
+     * Start n copies of a running template instance. The template writes
+     * its dataset once with BGSAVE to its own dir and dbfilename (a fork,
+     * the template keeps serving) and every copy boots from that snapshot
+     * as with setSeedRDB, all of them concurrently. A template with a private dir (setSeedRDB or
+     * setUnixSocketMode) below a tmpfs temp dir keeps the snapshot off
+     * disk and lets the copies hardlink it.
+     * Returns the number of ready copies like buildMany.
+     */
+    extern size_t               RedisInstance_clone(RedisInstance const *tmpl, size_t n,
+                                                    RedisInstance **clones);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#   include <unistd.h>
+#endif
+
+#include "resourcesampler.h"
+#include "lifecyclestats.h"
+#include "librarythread.h"
+
+#define LOG_TAG "ResourceSampler"
+#include "logging.h"
+
+#define RESOURCE_SAMPLER_MIN_INTERVAL   1L
+
+static
+void ResourceSeries_add(ResourceSeries *me, ResourceSample const *sample) {
+    pthread_mutex_lock(&me->data._M_mutex);
+    me->data._M_samples[me->data._M_count % me->data._M_capacity] = *sample;
+    ++me->data._M_count;
+    pthread_mutex_unlock(&me->data._M_mutex);
+}
+
+static
+size_t ResourceSeries_getCount(ResourceSeries const *me) {
+    size_t r = 0;
+    ResourceSeries *self = (ResourceSeries*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    r = me->data._M_count < me->data._M_capacity
+        ? me->data._M_count
+        : me->data._M_capacity;
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+static
+int ResourceSeries_get(ResourceSeries const *me, size_t i, ResourceSample *out) {
+    int r = 0;
+    size_t first = 0;
+    ResourceSeries *self = (ResourceSeries*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    first = me->data._M_count > me->data._M_capacity
+        ? me->data._M_count - me->data._M_capacity
+        : 0;
+    if (first + i < me->data._M_count) {
+        *out = me->data._M_samples[(first + i) % me->data._M_capacity];
+        r = 1;
+    }
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+static
+int ResourceSeries_getLast(ResourceSeries const *me, ResourceSample *out) {
+    int r = 0;
+    ResourceSeries *self = (ResourceSeries*) me;
+
+    pthread_mutex_lock(&self->data._M_mutex);
+    if (me->data._M_count > 0) {
+        *out = me->data._M_samples[(me->data._M_count - 1) % me->data._M_capacity];
+        r = 1;
+    }
+    pthread_mutex_unlock(&self->data._M_mutex);
+    return r;
+}
+
+void ResourceSeries_destroy(ResourceSeries *me) {
+    if (me) {
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me->data._M_samples);
+        me->data._M_samples = NULL;
+        free(me);
+    }
+}
+
+ResourceSeries* ResourceSeries_create(size_t capacity) {
+    ResourceSeries *instance = NULL;
+
+    if (capacity < 1)
+        return NULL;
+    instance = (ResourceSeries*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->data._M_samples = (ResourceSample*) calloc(capacity,
+            sizeof(*instance->data._M_samples));
+    if (!instance->data._M_samples) {
+        free(instance);
+        return NULL;
+    }
+    instance->data._M_capacity = capacity;
+    pthread_mutex_init(&instance->data._M_mutex, NULL);
+    instance->calls.getCount = &ResourceSeries_getCount;
+    instance->calls.get = &ResourceSeries_get;
+    instance->calls.getLast = &ResourceSeries_getLast;
+    instance->calls.add = &ResourceSeries_add;
+    return instance;
+}
+
+int ResourceSampler_read(int pid, ResourceSample *out) {
+#if defined(__linux__)
+    int rc = 0;
+    long ticks = sysconf(_SC_CLK_TCK);
+    long value = 0;
+    unsigned long minflt = 0;
+    unsigned long majflt = 0;
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    long threads = 0;
+    char path[64];
+    char line[256];
+    char name[64];
+    char *p = NULL;
+    FILE *fp = NULL;
+
+    memset(out, 0, sizeof(*out));
+    out->time_us = LifecycleStats_now();
+    if (ticks <= 0)
+        ticks = 100;
+
+    snprintf(&path[0], sizeof(path), "/proc/%d/stat", pid);
+    fp = fopen(&path[0], "re");
+    if (!fp)
+        goto failure;
+    if (!fgets(&line[0], sizeof(line), fp))
+        goto failure;
+    /* the command name may hold anything, fields go on after its ')' */
+    p = strrchr(&line[0], ')');
+    if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu"
+                " %*d %*d %*d %*d %ld", &minflt, &majflt, &utime, &stime,
+                &threads) != 5)
+        goto failure;
+    fclose(fp);
+    fp = NULL;
+    out->minor_faults = (long) minflt;
+    out->major_faults = (long) majflt;
+    out->user_us = (long) (utime * (1000000UL / (unsigned long) ticks));
+    out->system_us = (long) (stime * (1000000UL / (unsigned long) ticks));
+    out->threads = threads;
+
+    snprintf(&path[0], sizeof(path), "/proc/%d/status", pid);
+    fp = fopen(&path[0], "re");
+    if (!fp)
+        goto failure;
+    while (fgets(&line[0], sizeof(line), fp)) {
+        if (sscanf(&line[0], "%63[^:]: %ld", &name[0], &value) != 2)
+            continue;
+        if (strcmp(&name[0], "VmRSS") == 0)
+            out->rss_bytes = value * 1024L;
+        else if (strcmp(&name[0], "VmHWM") == 0)
+            out->peak_rss_bytes = value * 1024L;
+        else if (strcmp(&name[0], "voluntary_ctxt_switches") == 0)
+            out->voluntary_switches = value;
+        else if (strcmp(&name[0], "nonvoluntary_ctxt_switches") == 0)
+            out->involuntary_switches = value;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (fp) {
+        fclose(fp);
+        fp = NULL;
+    }
+    goto exit;
+#else
+    (void) pid;
+    (void) out;
+    return 0;
+#endif
+}
+
+/*
+ * Sample everything watched, then sleep for the interval. Sampling runs
+ * under the mutex, so unwatch returns only once a series is left alone.
+ */
+static
+void* ResourceSampler_run(void *arg) {
+    ResourceSampler *me = (ResourceSampler*) arg;
+    size_t i = 0;
+    ResourceSample sample;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    while (me->data._M_running) {
+        for (i = 0; i < me->data._M_count; ++i) {
+            /* gone and not reaped yet, the reaper adds the last one */
+            if (ResourceSampler_read(me->data._M_pids[i], &sample))
+                me->data._M_series[i]->calls.add(me->data._M_series[i], &sample);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += me->data._M_interval_ms / 1000L;
+        deadline.tv_nsec += (me->data._M_interval_ms % 1000L) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (me->data._M_running
+                && pthread_cond_timedwait(&me->data._M_cond, &me->data._M_mutex,
+                    &deadline) != ETIMEDOUT)
+            ;
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return NULL;
+}
+
+static
+int ResourceSampler_watch(ResourceSampler *me, int pid, ResourceSeries *series) {
+    int rc = 0;
+    size_t slots = 0;
+    int *pids = NULL;
+    ResourceSeries **all = NULL;
+
+#if !defined(__linux__)
+    return 0;
+#endif
+    if (pid <= 0 || !series)
+        return 0;
+    pthread_mutex_lock(&me->data._M_mutex);
+    if (me->data._M_count == me->data._M_slots) {
+        slots = me->data._M_slots * 2 + 8;
+        all = (ResourceSeries**) realloc(me->data._M_series, slots * sizeof(*all));
+        if (!all)
+            goto exit;
+        me->data._M_series = all;
+        pids = (int*) realloc(me->data._M_pids, slots * sizeof(*pids));
+        if (!pids)
+            goto exit;
+        me->data._M_pids = pids;
+        me->data._M_slots = slots;
+    }
+    me->data._M_series[me->data._M_count] = series;
+    me->data._M_pids[me->data._M_count] = pid;
+    ++me->data._M_count;
+    rc = 1;
+exit:
+    pthread_mutex_unlock(&me->data._M_mutex);
+    return rc;
+}
+
+static
+void ResourceSampler_unwatch(ResourceSampler *me, ResourceSeries *series) {
+    size_t i = 0;
+
+    pthread_mutex_lock(&me->data._M_mutex);
+    for (i = 0; i < me->data._M_count; ++i) {
+        if (me->data._M_series[i] != series)
+            continue;
+        --me->data._M_count;
+        me->data._M_series[i] = me->data._M_series[me->data._M_count];
+        me->data._M_pids[i] = me->data._M_pids[me->data._M_count];
+        break;
+    }
+    pthread_mutex_unlock(&me->data._M_mutex);
+}
+
+static
+long ResourceSampler_getInterval(ResourceSampler const *me) {
+    return me->data._M_interval_ms;
+}
+
+static
+size_t ResourceSampler_getCapacity(ResourceSampler const *me) {
+    return me->data._M_capacity;
+}
+
+void ResourceSampler_destroy(ResourceSampler *me) {
+    if (me) {
+        if (me->data._M_running) {
+            pthread_mutex_lock(&me->data._M_mutex);
+            me->data._M_running = 0;
+            pthread_cond_signal(&me->data._M_cond);
+            pthread_mutex_unlock(&me->data._M_mutex);
+            pthread_join(me->data._M_thread, NULL);
+        }
+        pthread_cond_destroy(&me->data._M_cond);
+        pthread_mutex_destroy(&me->data._M_mutex);
+        free(me->data._M_series);
+        me->data._M_series = NULL;
+        free(me->data._M_pids);
+        me->data._M_pids = NULL;
+        free(me);
+    }
+}
+
+ResourceSampler* ResourceSampler_create(long interval_ms, size_t capacity) {
+    ResourceSampler *r = NULL;
+    ResourceSampler *instance = NULL;
+    pthread_condattr_t attr;
+    int error = 0;
+
+    if (capacity < 1)
+        goto failure;
+    instance = (ResourceSampler*) calloc(1, sizeof(*instance));
+    if (!instance)
+        goto failure;
+    instance->data._M_interval_ms = interval_ms > RESOURCE_SAMPLER_MIN_INTERVAL
+        ? interval_ms
+        : RESOURCE_SAMPLER_MIN_INTERVAL;
+    instance->data._M_capacity = capacity;
+    pthread_mutex_init(&instance->data._M_mutex, NULL);
+    /* the interval must not stretch when the wall clock is set */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&instance->data._M_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    instance->calls.watch = &ResourceSampler_watch;
+    instance->calls.unwatch = &ResourceSampler_unwatch;
+    instance->calls.getInterval = &ResourceSampler_getInterval;
+    instance->calls.getCapacity = &ResourceSampler_getCapacity;
+
+    instance->data._M_running = 1;
+    error = LibraryThread_create(&instance->data._M_thread, NULL,
+            &ResourceSampler_run, instance);
+    if (error != 0) {
+        LOGE("starting the sampler thread failed: %s", strerror(error));
+        instance->data._M_running = 0;
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        ResourceSampler_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,108 @@
+#ifndef RESOURCESAMPLER_H_INCLUDED
+#define RESOURCESAMPLER_H_INCLUDED
+
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * What processes cost while they run.
+     *
+     * A ResourceSampler reads /proc/<pid>/stat and /proc/<pid>/status of
+     * every watched process at a fixed interval on a thread of its own and
+     * appends the figures to the ResourceSeries of each, a ring of the
+     * last samples. Linux only, elsewhere watching fails.
+     */
+
+    struct tagResourceSeries;
+    struct tagResourceSampler;
+
+    typedef struct tagResourceSeries ResourceSeries;
+    typedef struct tagResourceSampler ResourceSampler;
+
+    /* one reading, counters are totals since the process started */
+    typedef struct tagResourceSample {
+        /* when it was taken, LifecycleStats_now() clock (us) */
+        long    time_us;
+        /* resident set size and its peak so far */
+        long    rss_bytes;
+        long    peak_rss_bytes;
+        /* cpu time in user and kernel mode */
+        long    user_us;
+        long    system_us;
+        long    voluntary_switches;
+        long    involuntary_switches;
+        long    minor_faults;
+        long    major_faults;
+        long    threads;
+    } ResourceSample;
+
+    struct tagResourceSeries {
+        struct {
+            /* samples kept, at most the capacity */
+            size_t  (*getCount) (ResourceSeries const*);
+            /* sample i, 0 is the oldest kept. Returns 0 if out of range */
+            int     (*get)      (ResourceSeries const*, size_t i, ResourceSample *out);
+            /* the newest sample, returns 0 if there is none */
+            int     (*getLast)  (ResourceSeries const*, ResourceSample *out);
+            void    (*add)      (ResourceSeries*, ResourceSample const*);
+        } calls;
+
+        struct {
+            ResourceSample *_M_samples;
+            size_t          _M_capacity;
+            /* samples added so far, the dropped ones included */
+            size_t          _M_count;
+            pthread_mutex_t _M_mutex;
+        } data;
+    };
+
+    struct tagResourceSampler {
+        struct {
+            /*
+             * Sample pid into series (not owned, must stay alive until
+             * unwatch) from now on. Returns 1 on success.
+             */
+            int     (*watch)    (ResourceSampler*, int pid, ResourceSeries *series);
+            /* stop sampling into series, no sample is added once this returns */
+            void    (*unwatch)  (ResourceSampler*, ResourceSeries *series);
+            long    (*getInterval)(ResourceSampler const*);
+            /* capacity of the series created for it, see ResourceSeries_create */
+            size_t  (*getCapacity)(ResourceSampler const*);
+        } calls;
+
+        struct {
+            long            _M_interval_ms;
+            size_t          _M_capacity;
+            /* watched series and their pids, _M_count of them */
+            ResourceSeries **_M_series;
+            int            *_M_pids;
+            size_t          _M_count;
+            size_t          _M_slots;
+            int             _M_running;
+            pthread_t       _M_thread;
+            pthread_mutex_t _M_mutex;
+            pthread_cond_t  _M_cond;
+        } data;
+    };
+
+    extern ResourceSeries*  ResourceSeries_create(size_t capacity);
+    extern void             ResourceSeries_destroy(ResourceSeries*);
+
+    /*
+     * Sample every interval_ms, series created for it keep the last
+     * capacity samples. NULL if the thread could not be started.
+     */
+    extern ResourceSampler* ResourceSampler_create(long interval_ms, size_t capacity);
+    extern void             ResourceSampler_destroy(ResourceSampler*);
+    /* read the figures of pid right now, returns 0 if it is gone */
+    extern int              ResourceSampler_read(int pid, ResourceSample *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESOURCESAMPLER_H_INCLUDED */
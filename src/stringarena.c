@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "stringarena.h"
+
+#define STRING_ARENA_MIN_CAPACITY   256
+#define STRING_ARENA_MIN_ITEMS      8
+
+/* point items from on at the strings packed into the buffer */
+static
+void StringArena_index(StringArena *me, size_t from) {
+    size_t i = 0;
+    char *p = NULL;
+
+    if (me->data._M_count == 0)
+        return;
+    if (from == 0) {
+        me->data._M_items[0] = me->data._M_buffer;
+        from = 1;
+    }
+    p = me->data._M_items[from - 1];
+    for (i = from; i < me->data._M_count; ++i) {
+        p += strlen(p) + 1;
+        me->data._M_items[i] = p;
+    }
+}
+
+/* room for bytes more string data and items more strings */
+static
+int StringArena_reserve(StringArena *me, size_t bytes, size_t items) {
+    size_t capacity = 0;
+    char *buffer = NULL;
+    char **array = NULL;
+
+    if (me->data._M_size + bytes > me->data._M_capacity) {
+        capacity = me->data._M_capacity * 2;
+        if (capacity < me->data._M_size + bytes)
+            capacity = me->data._M_size + bytes;
+        if (capacity < STRING_ARENA_MIN_CAPACITY)
+            capacity = STRING_ARENA_MIN_CAPACITY;
+        buffer = (char*) realloc(me->data._M_buffer, capacity);
+        if (!buffer)
+            return 0;
+        me->data._M_buffer = buffer;
+        me->data._M_capacity = capacity;
+        StringArena_index(me, 0);
+    }
+    if (me->data._M_count + items + 1 > me->data._M_items_capacity) {
+        capacity = me->data._M_items_capacity * 2;
+        if (capacity < me->data._M_count + items + 1)
+            capacity = me->data._M_count + items + 1;
+        array = (char**) realloc(me->data._M_items, capacity * sizeof(*array));
+        if (!array)
+            return 0;
+        me->data._M_items = array;
+        me->data._M_items_capacity = capacity;
+    }
+    return 1;
+}
+
+static
+int StringArena_append(StringArena *me, char const *s, size_t len) {
+    char *p = NULL;
+
+    if (!s || !StringArena_reserve(me, len + 1, 1))
+        return 0;
+    p = me->data._M_buffer + me->data._M_size;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    me->data._M_size += len + 1;
+    me->data._M_items[me->data._M_count++] = p;
+    me->data._M_items[me->data._M_count] = NULL;
+    return 1;
+}
+
+static
+int StringArena_concat(StringArena *me, ...) {
+    va_list ap;
+    size_t len = 0;
+    size_t n = 0;
+    char const *s = NULL;
+    char *p = NULL;
+
+    va_start(ap, me);
+    while ((s = va_arg(ap, char const*)) != NULL)
+        len += strlen(s);
+    va_end(ap);
+    if (!StringArena_reserve(me, len + 1, 1))
+        return 0;
+
+    p = me->data._M_buffer + me->data._M_size;
+    me->data._M_items[me->data._M_count++] = p;
+    me->data._M_items[me->data._M_count] = NULL;
+    va_start(ap, me);
+    while ((s = va_arg(ap, char const*)) != NULL) {
+        n = strlen(s);
+        memcpy(p, s, n);
+        p += n;
+    }
+    va_end(ap);
+    *p = '\0';
+    me->data._M_size += len + 1;
+    return 1;
+}
+
+static
+int StringArena_replace(StringArena *me, size_t i, char const *s, size_t len) {
+    size_t offset = 0;
+    size_t old = 0;
+    size_t tail = 0;
+
+    if (i >= me->data._M_count || !s)
+        return 0;
+    old = strlen(me->data._M_items[i]);
+    if (len > old && !StringArena_reserve(me, len - old, 0))
+        return 0;
+    offset = me->data._M_items[i] - me->data._M_buffer;
+    tail = offset + old + 1;
+    /* shift the strings behind i, then rewrite it in place */
+    memmove(me->data._M_buffer + offset + len + 1, me->data._M_buffer + tail,
+            me->data._M_size - tail);
+    memcpy(me->data._M_buffer + offset, s, len);
+    me->data._M_buffer[offset + len] = '\0';
+    me->data._M_size = me->data._M_size - old + len;
+    StringArena_index(me, i + 1);
+    return 1;
+}
+
+static
+int StringArena_remove(StringArena *me, size_t i) {
+    size_t offset = 0;
+    size_t len = 0;
+
+    if (i >= me->data._M_count)
+        return 0;
+    offset = me->data._M_items[i] - me->data._M_buffer;
+    len = strlen(me->data._M_items[i]) + 1;
+    memmove(me->data._M_buffer + offset, me->data._M_buffer + offset + len,
+            me->data._M_size - offset - len);
+    me->data._M_size -= len;
+    memmove(&me->data._M_items[i], &me->data._M_items[i + 1],
+            (me->data._M_count - i) * sizeof(*me->data._M_items));
+    --me->data._M_count;
+    StringArena_index(me, i);
+    return 1;
+}
+
+static
+void StringArena_clear(StringArena *me) {
+    me->data._M_size = 0;
+    me->data._M_count = 0;
+    me->data._M_items[0] = NULL;
+}
+
+static
+size_t StringArena_getCount(StringArena const *me) {
+    return me->data._M_count;
+}
+
+static
+char const* StringArena_get(StringArena const *me, size_t i) {
+    return i < me->data._M_count ? me->data._M_items[i] : NULL;
+}
+
+static
+char const** StringArena_getArray(StringArena const *me) {
+    return (char const**) me->data._M_items;
+}
+
+static
+size_t StringArena_getSize(StringArena const *me) {
+    return me->data._M_size;
+}
+
+static
+StringArena* StringArena_clone(StringArena const *me) {
+    StringArena *r = NULL;
+    StringArena *instance = NULL;
+
+    instance = StringArena_create();
+    if (!instance)
+        goto failure;
+    if (!StringArena_reserve(instance, me->data._M_size, me->data._M_count))
+        goto failure;
+    if (me->data._M_size > 0)
+        memcpy(instance->data._M_buffer, me->data._M_buffer, me->data._M_size);
+    instance->data._M_size = me->data._M_size;
+    instance->data._M_count = me->data._M_count;
+    instance->data._M_items[instance->data._M_count] = NULL;
+    StringArena_index(instance, 0);
+
+    goto success;
+exit:
+    return r;
+success:
+    r = instance;
+    instance = NULL;
+    goto cleanup;
+failure:
+    goto cleanup;
+cleanup:
+    if (instance) {
+        StringArena_destroy(instance);
+        instance = NULL;
+    }
+    goto exit;
+}
+
+void StringArena_destroy(StringArena *me) {
+    if (me) {
+        free(me->data._M_buffer);
+        me->data._M_buffer = NULL;
+        free(me->data._M_items);
+        me->data._M_items = NULL;
+        free(me);
+    }
+}
+
+StringArena* StringArena_create() {
+    StringArena *instance = NULL;
+
+    instance = (StringArena*) calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    instance->data._M_items = (char**) calloc(STRING_ARENA_MIN_ITEMS,
+            sizeof(*instance->data._M_items));
+    if (!instance->data._M_items) {
+        free(instance);
+        return NULL;
+    }
+    instance->data._M_items_capacity = STRING_ARENA_MIN_ITEMS;
+    instance->calls.append = &StringArena_append;
+    instance->calls.concat = &StringArena_concat;
+    instance->calls.replace = &StringArena_replace;
+    instance->calls.remove = &StringArena_remove;
+    instance->calls.clear = &StringArena_clear;
+    instance->calls.getCount = &StringArena_getCount;
+    instance->calls.get = &StringArena_get;
+    instance->calls.getArray = &StringArena_getArray;
+    instance->calls.getSize = &StringArena_getSize;
+    instance->calls.clone = &StringArena_clone;
+    return instance;
+}
@@ -0,0 +1,62 @@
+#ifndef STRINGARENA_H_INCLUDED
+#define STRINGARENA_H_INCLUDED
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * NULL terminated string array in a single growable buffer.
+     *
+     * Strings are packed back to back into one allocation and indexed by a
+     * second one, both grow geometrically, so appending n strings costs
+     * O(n) copies overall and a deep copy is two memcpy. Pointers handed
+     * out (getArray, get) stay valid until the next call that modifies
+     * the arena.
+     */
+
+    struct tagStringArena;
+
+    typedef struct tagStringArena StringArena;
+
+    struct tagStringArena {
+        struct {
+            /* copy len bytes of s as a new string, returns 0 on failure */
+            int             (*append)   (StringArena*, char const *s, size_t len);
+            /* concatenation of the NULL terminated arguments as a new string */
+            int             (*concat)   (StringArena*, ...);
+            /* replace string i, returns 0 if out of range or on failure */
+            int             (*replace)  (StringArena*, size_t i, char const *s, size_t len);
+            /* drop string i, the ones after it move up */
+            int             (*remove)   (StringArena*, size_t i);
+            void            (*clear)    (StringArena*);
+            size_t          (*getCount) (StringArena const*);
+            char const*     (*get)      (StringArena const*, size_t i);
+            /* every string in order and a terminating NULL, never NULL */
+            char const**    (*getArray) (StringArena const*);
+            /* bytes of string data, terminators included */
+            size_t          (*getSize)  (StringArena const*);
+            StringArena*    (*clone)    (StringArena const*);
+        } calls;
+
+        struct {
+            char           *_M_buffer;
+            size_t          _M_size;
+            size_t          _M_capacity;
+            /* _M_count pointers into _M_buffer, then NULL */
+            char          **_M_items;
+            size_t          _M_count;
+            size_t          _M_items_capacity;
+        } data;
+    };
+
+    extern StringArena*     StringArena_create();
+    extern void             StringArena_destroy(StringArena*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STRINGARENA_H_INCLUDED */
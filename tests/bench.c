@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/processbuilder.h"
+#include "../src/redisserverbuilder.h"
+#include "../src/latencyhistogram.h"
+#include "../src/lifecyclestats.h"
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <unistd.h>
+#endif
+
+/*
+ * Lifecycle costs of the library, printed as one JSON object on stdout:
+ *
+ *  spawn       ProcessBuilder.build of /bin/true
+ *  ready       RedisServerBuilder.build1 until the server answers PING
+ *  shutdown    RedisInstance_destroy, SIGTERM until the child is reaped
+ *  batch       buildMany of n instances, then destroying all of them
+ *  spans       LifecycleStats of every server started above
+ *
+ * The servers inherit stdout, so it is pointed at stderr while they run
+ * and only the JSON reaches the original stdout.
+ *
+ * usage: bench [spawn iterations] [server iterations] [batch sizes ...]
+ */
+
+#define DEFAULT_SPAWN_ITERATIONS    200
+#define DEFAULT_SERVER_ITERATIONS   20
+
+static long const default_batch_sizes[] = { 1, 16, 128 };
+
+static
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+static
+char const* find_true() {
+    if (access("/bin/true", X_OK) == 0)
+        return "/bin/true";
+    return "/usr/bin/true";
+}
+
+static
+void print_histogram(FILE *out, char const *name, LatencyHistogram const *h) {
+    fprintf(out, "  \"%s\": {\"count\": %ld, \"min_us\": %ld, \"mean_us\": %.1f, "
+            "\"p50_us\": %ld, \"p90_us\": %ld, \"p99_us\": %ld, \"max_us\": %ld},\n",
+            name, h->calls.getCount(h), h->calls.getMin(h), h->calls.getMean(h),
+            h->calls.getPercentile(h, 50), h->calls.getPercentile(h, 90),
+            h->calls.getPercentile(h, 99), h->calls.getMax(h));
+}
+
+static
+int bench_spawn(int iterations, LatencyHistogram *h) {
+    int i = 0;
+    long started = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return 0;
+    pb->calls.setFile(pb, find_true());
+    for (i = 0; i < iterations; ++i) {
+        started = now_us();
+        process = pb->calls.build(pb);
+        h->calls.record(h, now_us() - started);
+        if (!process)
+            break;
+        process->calls.wait(process, NULL);
+        Process_destroy(process);
+        process = NULL;
+    }
+    ProcessBuilder_destroy(pb);
+    return i == iterations;
+}
+
+/* one build1 and one destroy per iteration */
+static
+int bench_server(RedisServerBuilder *builder, int iterations,
+        LatencyHistogram *ready, LatencyHistogram *shutdown) {
+    int i = 0;
+    int status = 0;
+    long started = 0;
+    RedisInstance *instance = NULL;
+
+    for (i = 0; i < iterations; ++i) {
+        started = now_us();
+        instance = builder->calls.build1(builder, NULL, &status);
+        if (!instance) {
+            fprintf(stderr, "build redis instance failed: %s\n",
+                    RedisServerBuilder_getStatusString(status));
+            return 0;
+        }
+        ready->calls.record(ready, now_us() - started);
+        started = now_us();
+        RedisInstance_destroy(instance);
+        shutdown->calls.record(shutdown, now_us() - started);
+        instance = NULL;
+    }
+    return 1;
+}
+
+/* buildMany of n, returns the number of ready instances */
+static
+size_t bench_batch(RedisServerBuilder *builder, size_t n,
+        long *startup_us, long *shutdown_us) {
+    size_t i = 0;
+    size_t ready = 0;
+    long started = 0;
+    RedisInstance **instances = NULL;
+
+    instances = (RedisInstance**) calloc(n, sizeof(*instances));
+    if (!instances)
+        return 0;
+    started = now_us();
+    ready = builder->calls.buildMany(builder, n, instances, NULL);
+    *startup_us = now_us() - started;
+    started = now_us();
+    for (i = 0; i < n; ++i)
+        RedisInstance_destroy(instances[i]);
+    *shutdown_us = now_us() - started;
+    free(instances);
+    return ready;
+}
+
+int main(int argc, char* *argv) {
+    int rc = EXIT_SUCCESS;
+    int spawn_iterations = DEFAULT_SPAWN_ITERATIONS;
+    int server_iterations = DEFAULT_SERVER_ITERATIONS;
+    long const *sizes = &default_batch_sizes[0];
+    long *parsed = NULL;
+    size_t nsizes = sizeof(default_batch_sizes) / sizeof(default_batch_sizes[0]);
+    size_t i = 0;
+    size_t ready = 0;
+    long startup = 0;
+    long shutdown = 0;
+    LatencyHistogram *spawn_h = NULL;
+    LatencyHistogram *ready_h = NULL;
+    LatencyHistogram *shutdown_h = NULL;
+    LatencyHistogram *span_h = NULL;
+    LifecycleStats *stats = NULL;
+    RedisServerBuilder *builder = NULL;
+    int span = 0;
+    FILE *out = NULL;
+    int fd = -1;
+
+    if (argc > 1)
+        spawn_iterations = atoi(argv[1]);
+    if (spawn_iterations < 1)
+        spawn_iterations = DEFAULT_SPAWN_ITERATIONS;
+    if (argc > 2)
+        server_iterations = atoi(argv[2]);
+    if (server_iterations < 1)
+        server_iterations = DEFAULT_SERVER_ITERATIONS;
+    if (argc > 3) {
+        nsizes = argc - 3;
+        parsed = (long*) calloc(nsizes, sizeof(*parsed));
+        if (!parsed)
+            return EXIT_FAILURE;
+        for (i = 0; i < nsizes; ++i)
+            parsed[i] = atol(argv[i + 3]);
+        sizes = parsed;
+    }
+
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    if (fd == -1 || !(out = fdopen(fd, "w")) || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+        rc = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    spawn_h = LatencyHistogram_create();
+    ready_h = LatencyHistogram_create();
+    shutdown_h = LatencyHistogram_create();
+    span_h = LatencyHistogram_create();
+    stats = LifecycleStats_create();
+    builder = RedisServerBuilder_create();
+    if (!spawn_h || !ready_h || !shutdown_h || !span_h || !stats || !builder) {
+        rc = EXIT_FAILURE;
+        goto cleanup;
+    }
+    builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
+    builder->calls.setStats(builder, stats);
+
+    if (!bench_spawn(spawn_iterations, spawn_h))
+        rc = EXIT_FAILURE;
+    if (!bench_server(builder, server_iterations, ready_h, shutdown_h))
+        rc = EXIT_FAILURE;
+
+    fprintf(out, "{\n");
+    print_histogram(out, "spawn", spawn_h);
+    print_histogram(out, "ready", ready_h);
+    print_histogram(out, "shutdown", shutdown_h);
+    fprintf(out, "  \"batch\": [");
+    for (i = 0; i < nsizes; ++i) {
+        if (sizes[i] < 1)
+            continue;
+        ready = bench_batch(builder, (size_t) sizes[i], &startup, &shutdown);
+        if (ready != (size_t) sizes[i])
+            rc = EXIT_FAILURE;
+        fprintf(out, "%s\n    {\"instances\": %ld, \"ready\": %lu, \"startup_us\": %ld, "
+                "\"shutdown_us\": %ld}", i > 0 ? "," : "", sizes[i],
+                (unsigned long) ready, startup, shutdown);
+    }
+    fprintf(out, "\n  ],\n  \"spans\": {\n");
+    for (span = 0; span < LIFECYCLE_SPANS; ++span) {
+        stats->calls.snapshot(stats, span, span_h);
+        fprintf(out, "    \"%s\": {\"count\": %ld, \"mean_us\": %.1f, \"p50_us\": %ld, "
+                "\"p99_us\": %ld, \"max_us\": %ld}%s\n",
+                LifecycleStats_getSpanName(span), span_h->calls.getCount(span_h),
+                span_h->calls.getMean(span_h), span_h->calls.getPercentile(span_h, 50),
+                span_h->calls.getPercentile(span_h, 99), span_h->calls.getMax(span_h),
+                span + 1 < LIFECYCLE_SPANS ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+
+cleanup:
+    if (out)
+        fclose(out);
+    else if (fd != -1)
+        close(fd);
+    RedisServerBuilder_destroy(builder);
+    LifecycleStats_destroy(stats);
+    LatencyHistogram_destroy(span_h);
+    LatencyHistogram_destroy(shutdown_h);
+    LatencyHistogram_destroy(ready_h);
+    LatencyHistogram_destroy(spawn_h);
+    if (parsed) {
+        free(parsed);
+        parsed = NULL;
+    }
+    return rc;
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/redisserverbuilder.h"
+#include "../src/redisloadgenerator.h"
+
+/*
+ * Launch a redis-server and drive it with RedisLoadGenerator.
+ *
+ * usage: bench_load [duration ms] [threads] [connections] [pipeline]
+ */
+
+#define DEFAULT_DURATION    1000L
+#define DEFAULT_THREADS     2
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_PIPELINE    16
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+    int status = 0;
+    long duration = DEFAULT_DURATION;
+    int threads = DEFAULT_THREADS;
+    int connections = DEFAULT_CONNECTIONS;
+    int pipeline = DEFAULT_PIPELINE;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisLoadGenerator *gen = NULL;
+    RedisLoadReport report;
+
+    if (argc > 1)
+        duration = atol(argv[1]);
+    if (argc > 2)
+        threads = atoi(argv[2]);
+    if (argc > 3)
+        connections = atoi(argv[3]);
+    if (argc > 4)
+        pipeline = atoi(argv[4]);
+
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance) {
+        fprintf(stderr, "build redis instance failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+
+    gen = RedisLoadGenerator_create(instance);
+    if (!gen
+            || !gen->calls.setDuration(gen, duration)
+            || !gen->calls.setThreads(gen, threads)
+            || !gen->calls.setConnections(gen, connections)
+            || !gen->calls.setPipeline(gen, pipeline)
+            || !gen->calls.setKeySpace(gen, 100000L, REDIS_LOAD_KEYS_ZIPFIAN)
+            || !gen->calls.setValueSize(gen, 16, 256)
+            || !gen->calls.setMix(gen, REDIS_LOAD_GET, 8)
+            || !gen->calls.setMix(gen, REDIS_LOAD_SET, 2))
+        goto failure;
+    if (!gen->calls.run(gen, &report))
+        goto failure;
+
+    printf("%-10s %12s %8s %8s %8s %8s %8s %8s\n", "ops", "ops/sec",
+            "min", "p50", "p90", "p99", "p99.9", "max");
+    printf("%-10ld %12.0f %8ld %8ld %8ld %8ld %8ld %8ld\n", report.ops,
+            report.ops_per_sec, report.min_us, report.p50_us, report.p90_us,
+            report.p99_us, report.p999_us, report.max_us);
+    if (report.ops == 0 || report.errors > 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    if (gen) {
+        RedisLoadGenerator_destroy(gen);
+        gen = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/processbuilder.h"
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__ANDROID__)
+#   include <sys/types.h>
+#   include <unistd.h>
+#endif
+
+/*
+ * Compare the spawn backends of ProcessBuilder while the parent holds a
+ * resident heap of a given size.
+ *
+ * usage: bench_spawn [iterations] [heap size in MB ...]
+ */
+
+#define DEFAULT_ITERATIONS 200
+
+static long const default_heap_sizes[] = { 0, 64, 256 };
+
+static struct {
+    int         mode;
+    char const *name;
+} const modes[] = {
+    { PROCESS_SPAWN_FORK,           "fork" },
+    { PROCESS_SPAWN_VFORK,          "vfork" },
+    { PROCESS_SPAWN_POSIX_SPAWN,    "posix_spawn" },
+    { PROCESS_SPAWN_CLONE,          "clone" },
+};
+
+static
+double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static
+char const* find_true() {
+    if (access("/bin/true", X_OK) == 0)
+        return "/bin/true";
+    return "/usr/bin/true";
+}
+
+/* average microseconds spent inside ProcessBuilder.build */
+static
+double bench(int mode, int iterations) {
+    double total = 0;
+    double started = 0;
+    int i = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return -1;
+    pb->calls.setFile(pb, find_true());
+    pb->calls.setSpawnMode(pb, mode);
+    for (i = 0; i < iterations; ++i) {
+        started = now_us();
+        process = pb->calls.build(pb);
+        total += now_us() - started;
+        if (!process) {
+            total = -1;
+            break;
+        }
+        process->calls.wait(process, NULL);
+        Process_destroy(process);
+        process = NULL;
+    }
+    ProcessBuilder_destroy(pb);
+    return total < 0 ? -1 : total / iterations;
+}
+
+int main(int argc, char* *argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    long const *sizes = &default_heap_sizes[0];
+    long *parsed = NULL;
+    size_t nsizes = sizeof(default_heap_sizes) / sizeof(default_heap_sizes[0]);
+    size_t i = 0;
+    size_t j = 0;
+    char *heap = NULL;
+    double us = 0;
+    int rc = EXIT_SUCCESS;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 1)
+        iterations = DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        nsizes = argc - 2;
+        parsed = (long*) calloc(nsizes, sizeof(*parsed));
+        if (!parsed)
+            return EXIT_FAILURE;
+        for (i = 0; i < nsizes; ++i)
+            parsed[i] = atol(argv[i + 2]);
+        sizes = parsed;
+    }
+
+    printf("%-12s %10s %14s\n", "backend", "heap (MB)", "spawn (us)");
+    for (i = 0; i < nsizes; ++i) {
+        if (sizes[i] > 0) {
+            /* touch every page so that it is really resident */
+            heap = (char*) malloc(sizes[i] << 20);
+            if (!heap) {
+                rc = EXIT_FAILURE;
+                break;
+            }
+            memset(heap, 0xa5, sizes[i] << 20);
+        }
+        for (j = 0; j < sizeof(modes) / sizeof(modes[0]); ++j) {
+            us = bench(modes[j].mode, iterations);
+            if (us < 0)
+                rc = EXIT_FAILURE;
+            printf("%-12s %10ld %14.1f\n", modes[j].name, sizes[i], us);
+        }
+        if (heap) {
+            free(heap);
+            heap = NULL;
+        }
+    }
+
+    if (parsed) {
+        free(parsed);
+        parsed = NULL;
+    }
+    return rc;
+}
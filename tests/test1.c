@@ -149,6 +149,7 @@ cleanup:
 int main(int argc, char* *argv) {
     int rc = 0;
     int port = 0;
+    int status = 0;
     RedisServerBuilder *builder = NULL;
     RedisInstance *instance = NULL;
 
@@ -156,13 +157,15 @@ int main(int argc, char* *argv) {
     if (!builder)
         goto failure;
 
-    srand(time(NULL));
-    port = ((double) rand()) / RAND_MAX * 65534 + 1;
-    builder->calls.optionNumber(builder, "port", port);
+    builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
     //fprintf(stderr, "%s\n", builder->data._M_cfg[0]);
-    instance = builder->calls.build(builder);
-    if (!instance)
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance) {
+        fprintf(stderr, "build redis instance failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
         goto failure;
+    }
+    port = instance->calls.getPort(instance);
     if (!check_redis_available("localhost", port))
         goto failure;
 
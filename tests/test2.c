@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hiredis/hiredis.h>
+
+#include "../src/redisserverbuilder.h"
+#include "../src/redisinstancepool.h"
+
+#define POOL_SIZE           2
+#define ACQUIRE_TIMEOUT     10000L
+
+static
+redisReply* command(RedisInstance *instance, char const *fmt, char const *arg) {
+    redisContext *ctx = NULL;
+    redisReply *reply = NULL;
+    struct timeval tv;
+
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
+    ctx = redisConnectWithTimeout("127.0.0.1",
+            instance->calls.getPort(instance), tv);
+    if (!ctx || ctx->err != REDIS_OK)
+        goto cleanup;
+    *(void**) &reply = redisCommand(ctx, fmt, arg);
+cleanup:
+    if (ctx) {
+        redisFree(ctx);
+        ctx = NULL;
+    }
+    return reply;
+}
+
+/* 1 if CONFIG GET name of instance answers value */
+static
+int has_config(RedisInstance *instance, char const *name, char const *value) {
+    int rc = 0;
+    redisReply *reply = NULL;
+
+    reply = command(instance, "CONFIG GET %s", name);
+    rc = reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == 2
+        && strcmp(reply->element[1]->str, value) == 0;
+    if (!rc)
+        fprintf(stderr, "%s is not \"%s\"\n", name, value);
+    if (reply)
+        freeReplyObject(reply);
+    return rc;
+}
+
+/*
+ * reset must drop the data and restore the builder's options, the
+ * immutable io-threads is skipped and the save points go in one list.
+ */
+static
+int check_reset() {
+    int rc = 0;
+    int status = 0;
+    long elapsed = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    redisReply *reply = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
+    if (!builder->calls.optionString(builder, "maxmemory-policy", "allkeys-lru")
+            || !builder->calls.optionString(builder, "io-threads", "1")
+            || !builder->calls.optionString(builder, "save", "3600 1")
+            || !builder->calls.optionString(builder, "save", "300 100"))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance) {
+        fprintf(stderr, "build redis instance failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+
+    reply = command(instance, "SET reset %s", "yes");
+    if (!reply)
+        goto failure;
+    freeReplyObject(reply); reply = NULL;
+    reply = command(instance, "CONFIG SET maxmemory-policy %s", "noeviction");
+    if (!reply || reply->type == REDIS_REPLY_ERROR)
+        goto failure;
+    freeReplyObject(reply); reply = NULL;
+    reply = command(instance, "CONFIG SET save %s", "60 5");
+    if (!reply || reply->type == REDIS_REPLY_ERROR)
+        goto failure;
+    freeReplyObject(reply); reply = NULL;
+
+    if (!instance->calls.reset(instance, REDIS_INSTANCE_RESET_ALL, &elapsed)
+            || elapsed <= 0) {
+        fprintf(stderr, "reset failed after %ld us\n", elapsed);
+        goto failure;
+    }
+    reply = command(instance, "GET %s", "reset");
+    if (!reply || reply->type != REDIS_REPLY_NIL)
+        goto failure;
+    if (!has_config(instance, "maxmemory-policy", "allkeys-lru")
+            || !has_config(instance, "save", "3600 1 300 100"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        freeReplyObject(reply);
+        reply = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstancePool *pool = NULL;
+    RedisInstance *instance = NULL;
+    redisReply *reply = NULL;
+    int i = 0;
+
+    if (!check_reset())
+        goto failure;
+
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    pool = RedisInstancePool_create(builder, POOL_SIZE);
+    if (!pool)
+        goto failure;
+
+    /* a released instance must come back empty */
+    for (i = 0; i < POOL_SIZE * 2; ++i) {
+        instance = pool->calls.acquire(pool, ACQUIRE_TIMEOUT);
+        if (!instance)
+            goto failure;
+        reply = command(instance, "GET %s", "pooled");
+        if (!reply || reply->type != REDIS_REPLY_NIL) {
+            fprintf(stderr, "instance on port %d is not clean\n",
+                    instance->calls.getPort(instance));
+            goto failure;
+        }
+        freeReplyObject(reply); reply = NULL;
+        reply = command(instance, "SET pooled %s", "yes");
+        if (!reply)
+            goto failure;
+        freeReplyObject(reply); reply = NULL;
+        pool->calls.release(pool, instance);
+        instance = NULL;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        freeReplyObject(reply);
+        reply = NULL;
+    }
+    if (instance) {
+        pool->calls.release(pool, instance);
+        instance = NULL;
+    }
+    if (pool) {
+        RedisInstancePool_destroy(pool);
+        pool = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
@@ -0,0 +1,706 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../src/controlgroup.h"
+#include "../src/processbuilder.h"
+#include "../src/processsupervisor.h"
+#include "../src/resourcesampler.h"
+
+#define NCHILDREN 8
+
+typedef struct {
+    int exited;
+    int exitcode;
+    int signal;
+} Outcome;
+
+static
+void on_exit_cb(Process *process, int exitcode, int signal, void *userdata) {
+    Outcome *outcome = (Outcome*) userdata;
+    outcome->exited = 1;
+    outcome->exitcode = exitcode;
+    outcome->signal = signal;
+}
+
+static
+Process* spawn(char const *script) {
+    Process *process = NULL;
+    ProcessBuilder *pb = NULL;
+    char const *arguments[] = { "-c", script, NULL };
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return NULL;
+    pb->calls.setFile(pb, "/bin/sh");
+    pb->calls.setArguments(pb, arguments);
+    process = pb->calls.build(pb);
+    ProcessBuilder_destroy(pb);
+    return process;
+}
+
+/* spawn failures must be reported synchronously with step and errno */
+static
+int check_spawn_failure(char const *file, char const *path,
+        int expected_step, int expected_error) {
+    int rc = 0;
+    int step = PROCESS_STEP_NONE;
+    int error = 0;
+    int mode = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+
+    for (mode = PROCESS_SPAWN_FORK; mode <= PROCESS_SPAWN_CLONE; ++mode) {
+        pb = ProcessBuilder_create();
+        if (!pb)
+            return 0;
+        pb->calls.setFile(pb, file);
+        if (path)
+            pb->calls.setPath(pb, path);
+        pb->calls.setSpawnMode(pb, mode);
+        process = pb->calls.build0(pb, &step, &error);
+        rc = !process && error == expected_error
+            /* posix_spawn can not tell chdir from execve */
+            && (step == expected_step || mode == PROCESS_SPAWN_POSIX_SPAWN);
+        if (!rc)
+            fprintf(stderr, "mode %d: step %s, %s\n", mode,
+                    ProcessBuilder_getStepString(step), strerror(error));
+        if (process)
+            Process_destroy(process);
+        ProcessBuilder_destroy(pb);
+        if (!rc)
+            return 0;
+    }
+    return 1;
+}
+
+/* a child in a process group of its own is reached by killpg */
+static
+int check_process_group() {
+    int rc = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+    char const *arguments[] = { "5", NULL };
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        goto failure;
+    pb->calls.setFile(pb, "/bin/sleep");
+    pb->calls.setArguments(pb, arguments);
+    if (!pb->calls.setProcessGroup(pb, 0))
+        goto failure;
+    process = pb->calls.build(pb);
+    if (!process)
+        goto failure;
+    if (getpgid((pid_t) process->calls.getPID(process)) != process->calls.getPID(process))
+        goto failure;
+    if (killpg((pid_t) process->calls.getPID(process), SIGKILL) != 0)
+        goto failure;
+    if (!process->calls.waitFor(process, 5000, NULL)
+            || process->calls.getTermSignal(process) != SIGKILL)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "process group check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (process) {
+        process->calls.kill(process);
+        Process_destroy(process);
+        process = NULL;
+    }
+    if (pb) {
+        ProcessBuilder_destroy(pb);
+        pb = NULL;
+    }
+    goto exit;
+}
+
+/* builds a sleeper that gets SIGKILL once this thread is gone */
+static
+void* build_orphan(void *arg) {
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+    char const *arguments[] = { "5", NULL };
+
+    (void) arg;
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return NULL;
+    pb->calls.setFile(pb, "/bin/sleep");
+    pb->calls.setArguments(pb, arguments);
+    if (pb->calls.setParentDeathSignal(pb, SIGKILL))
+        process = pb->calls.build(pb);
+    ProcessBuilder_destroy(pb);
+    return process;
+}
+
+/* the death signal follows the thread that built the child, not the process */
+static
+int check_parent_death_signal() {
+    int rc = 0;
+    pthread_t thread;
+    void *result = NULL;
+    Process *process = NULL;
+
+    if (pthread_create(&thread, NULL, &build_orphan, NULL) != 0)
+        return 0;
+    pthread_join(thread, &result);
+    process = (Process*) result;
+    rc = process && process->calls.waitFor(process, 5000, NULL)
+        && process->calls.getTermSignal(process) == SIGKILL;
+    if (!rc)
+        fprintf(stderr, "parent death signal check failed\n");
+    if (process) {
+        process->calls.kill(process);
+        Process_destroy(process);
+    }
+    return rc;
+}
+
+/* 1 if the controller is available in the group at dir */
+static
+int has_controller(char const *dir, char const *controller) {
+    char path[4096];
+    char name[64];
+    int found = 0;
+    FILE *fp = NULL;
+
+    snprintf(&path[0], sizeof(path), "%s/cgroup.controllers", dir);
+    fp = fopen(&path[0], "r");
+    if (!fp)
+        return 0;
+    while (!found && fscanf(fp, "%63s", &name[0]) == 1)
+        found = strcmp(&name[0], controller) == 0;
+    fclose(fp);
+    return found;
+}
+
+/*
+ * A child started in a group below a fleet group must get there, limits
+ * included where the memory controller is handed down, and the whole
+ * fleet must go with one kill. Skipped where cgroup2 is not writable.
+ */
+static
+int check_control_group() {
+    int rc = 0;
+    ControlGroup *fleet = NULL;
+    ControlGroup *group = NULL;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+    char const *arguments[] = { "5", NULL };
+
+    fleet = ControlGroup_create(NULL, NULL);
+    if (!fleet) {
+        fprintf(stderr, "no writable cgroup2, control group check skipped\n");
+        return 1;
+    }
+    group = fleet->calls.createChild(fleet, NULL);
+    if (!group)
+        goto failure;
+    if (has_controller(group->calls.getPath(group), "memory")
+            && !group->calls.setMemoryMax(group, 256L * 1024 * 1024))
+        goto failure;
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        goto failure;
+    pb->calls.setFile(pb, "/bin/sleep");
+    pb->calls.setArguments(pb, arguments);
+    if (!pb->calls.setControlGroup(pb, group->calls.getPath(group)))
+        goto failure;
+    process = pb->calls.build(pb);
+    if (!process)
+        goto failure;
+    if (group->calls.getProcessCount(group) != 1
+            || fleet->calls.getProcessCount(fleet) != 0)
+        goto failure;
+    if (!fleet->calls.kill(fleet))
+        goto failure;
+    if (!process->calls.waitFor(process, 5000, NULL)
+            || process->calls.getTermSignal(process) != SIGKILL)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "control group check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (process) {
+        process->calls.kill(process);
+        Process_destroy(process);
+        process = NULL;
+    }
+    if (pb) {
+        ProcessBuilder_destroy(pb);
+        pb = NULL;
+    }
+    if (group) {
+        ControlGroup_destroy(group);
+        group = NULL;
+    }
+    if (fleet) {
+        ControlGroup_destroy(fleet);
+        fleet = NULL;
+    }
+    goto exit;
+}
+
+static
+void count_line(void *context, OutputLog const *log, char const *line, size_t len) {
+    (void) log;
+    (void) line;
+    (void) len;
+    ++*(int*) context;
+}
+
+/* run script with output to mode, returns its exit code or -1 */
+static
+int run_output(char const *script, int mode, char const *path,
+        char const *dir, int *lines, char **tail) {
+    int exitcode = -1;
+    int i = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+    OutputLog *log = NULL;
+    char const *arguments[] = { "-c", script, NULL };
+    struct timespec delay;
+
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return -1;
+    pb->calls.setFile(pb, "/bin/sh");
+    pb->calls.setArguments(pb, arguments);
+    if (dir)
+        pb->calls.setPath(pb, dir);
+    if (!pb->calls.setOutput(pb, mode, path))
+        goto cleanup;
+    if (lines)
+        pb->calls.setOutputHook(pb, &count_line, lines);
+    process = pb->calls.build(pb);
+    if (!process || !process->calls.waitFor(process, 5000, &exitcode))
+        goto cleanup;
+    log = process->calls.getOutput(process);
+    if (mode != PROCESS_OUTPUT_CAPTURE) {
+        if (log)
+            exitcode = -1;
+        goto cleanup;
+    }
+    /* the reader thread may still be draining the pipe */
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10 * 1000000L;
+    for (i = 0; log && !log->calls.isClosed(log) && i < 500; ++i)
+        nanosleep(&delay, NULL);
+    if (!log || !log->calls.isClosed(log)) {
+        exitcode = -1;
+        goto cleanup;
+    }
+    if (tail)
+        *tail = log->calls.tail(log, 2);
+cleanup:
+    if (process) {
+        process->calls.kill(process);
+        Process_destroy(process);
+    }
+    ProcessBuilder_destroy(pb);
+    return exitcode;
+}
+
+/* captured, appended to a file below the child's path and dropped output */
+static
+int check_output() {
+    int rc = 0;
+    int lines = 0;
+    char *tail = NULL;
+    char dir[] = "/tmp/test3-XXXXXX";
+    char path[64] = "";
+    char content[64];
+    size_t n = 0;
+    FILE *fp = NULL;
+
+    if (run_output("echo one; echo two >&2; printf three",
+                PROCESS_OUTPUT_CAPTURE, NULL, NULL, &lines, &tail) != 0
+            || !tail || strcmp(tail, "two\nthree") != 0 || lines != 3) {
+        fprintf(stderr, "captured \"%s\" in %d lines\n", tail ? tail : "", lines);
+        goto failure;
+    }
+
+    if (!mkdtemp(&dir[0]))
+        goto failure;
+    snprintf(&path[0], sizeof(path), "%s/output.log", &dir[0]);
+    if (run_output("echo one; echo two >&2", PROCESS_OUTPUT_FILE, "output.log",
+                &dir[0], NULL, NULL) != 0)
+        goto failure;
+    fp = fopen(&path[0], "r");
+    if (!fp)
+        goto failure;
+    n = fread(&content[0], 1, sizeof(content) - 1, fp);
+    content[n] = '\0';
+    if (strcmp(&content[0], "one\ntwo\n") != 0) {
+        fprintf(stderr, "output file has \"%s\"\n", &content[0]);
+        goto failure;
+    }
+
+    if (run_output("test /proc/$$/fd/1 -ef /dev/null && test /proc/$$/fd/2 -ef /dev/null",
+                PROCESS_OUTPUT_NULL, NULL, NULL, NULL, NULL) != 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "output check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    free(tail);
+    if (fp)
+        fclose(fp);
+    if (path[0]) {
+        unlink(&path[0]);
+        rmdir(&dir[0]);
+    }
+    goto exit;
+}
+
+/* the lines /usr/bin/env printed that matter to check_environment */
+typedef struct {
+    int lines;
+    int kept;
+    int old;
+    int overwritten;
+    int added;
+    int removed;
+    int argument;
+} Printed;
+
+static
+void match_line(void *context, OutputLog const *log, char const *line, size_t len) {
+    Printed *printed = (Printed*) context;
+    char const *names[] = { "TEST3_KEEP=kept", "TEST3_OVER=old", "TEST3_OVER=new",
+        "TEST3_ADDED=added", "TEST3_GONE=", "TEST3_ARG=given" };
+    int *counts[] = { &printed->kept, &printed->old, &printed->overwritten,
+        &printed->added, &printed->removed, &printed->argument };
+    size_t i = 0;
+    size_t n = 0;
+
+    (void) log;
+    ++printed->lines;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        n = strlen(names[i]);
+        if (len >= n && strncmp(line, names[i], n) == 0)
+            ++*counts[i];
+    }
+}
+
+/* print the environment /usr/bin/env gets, 0 if it did not run */
+static
+int print_environment(char const **environments, Printed *printed) {
+    int rc = 0;
+    int exitcode = -1;
+    int i = 0;
+    ProcessBuilder *pb = NULL;
+    Process *process = NULL;
+    OutputLog *log = NULL;
+    char const *arguments[] = { NULL };
+    struct timespec delay;
+
+    memset(printed, 0, sizeof(*printed));
+    pb = ProcessBuilder_create();
+    if (!pb)
+        return 0;
+    pb->calls.setFile(pb, "/usr/bin/env");
+    pb->calls.setArguments(pb, arguments);
+    /* env takes NAME=VALUE arguments as more variables to print */
+    if (!pb->calls.addArgument(pb, "TEST3_ARG=given"))
+        goto cleanup;
+    if (environments)
+        pb->calls.setEnvironments(pb, environments);
+    if (!pb->calls.putEnvironment(pb, "TEST3_OVER", "new")
+            || !pb->calls.putEnvironment(pb, "TEST3_ADDED", "added")
+            || !pb->calls.putEnvironment(pb, "TEST3_GONE", NULL))
+        goto cleanup;
+    if (!pb->calls.setOutput(pb, PROCESS_OUTPUT_CAPTURE, NULL))
+        goto cleanup;
+    pb->calls.setOutputHook(pb, &match_line, printed);
+    process = pb->calls.build(pb);
+    if (!process || !process->calls.waitFor(process, 5000, &exitcode) || exitcode != 0)
+        goto cleanup;
+    log = process->calls.getOutput(process);
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10 * 1000000L;
+    for (i = 0; log && !log->calls.isClosed(log) && i < 500; ++i)
+        nanosleep(&delay, NULL);
+    rc = log && log->calls.isClosed(log);
+cleanup:
+    if (process) {
+        process->calls.kill(process);
+        Process_destroy(process);
+    }
+    ProcessBuilder_destroy(pb);
+    return rc;
+}
+
+/*
+ * putEnvironment adds, overwrites and removes variables of the environment
+ * given to setEnvironments or of the parent's one, addArgument reaches the
+ * command line.
+ */
+static
+int check_environment() {
+    int rc = 0;
+    Printed printed;
+    char const *environments[] = { "TEST3_KEEP=kept", "TEST3_OVER=old",
+        "TEST3_GONE=gone", NULL };
+
+    if (!print_environment(environments, &printed)
+            || printed.lines != 4 || printed.kept != 1 || printed.old != 0
+            || printed.overwritten != 1 || printed.added != 1
+            || printed.removed != 0 || printed.argument != 1)
+        goto failure;
+
+    setenv("TEST3_OVER", "old", 1);
+    setenv("TEST3_GONE", "gone", 1);
+    if (!print_environment(NULL, &printed)
+            || printed.old != 0 || printed.overwritten != 1 || printed.added != 1
+            || printed.removed != 0 || printed.argument != 1)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "environment check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    unsetenv("TEST3_OVER");
+    unsetenv("TEST3_GONE");
+    goto exit;
+}
+
+/* the ring keeps the newest capacity samples, oldest first */
+static
+int check_series() {
+    int rc = 1;
+    long i = 0;
+    ResourceSeries *series = NULL;
+    ResourceSample sample;
+
+    series = ResourceSeries_create(4);
+    if (!series)
+        return 0;
+    memset(&sample, 0, sizeof(sample));
+    for (i = 0; i < 10; ++i) {
+        sample.time_us = i;
+        series->calls.add(series, &sample);
+    }
+    if (series->calls.getCount(series) != 4)
+        rc = 0;
+    for (i = 0; rc && i < 4; ++i)
+        rc = series->calls.get(series, (size_t) i, &sample) && sample.time_us == 6 + i;
+    if (rc && (series->calls.get(series, 4, &sample)
+                || !series->calls.getLast(series, &sample) || sample.time_us != 9))
+        rc = 0;
+    ResourceSeries_destroy(series);
+    return rc;
+}
+
+/* readings of ourselves, a sampled child and the rusage of its exit */
+static
+int check_resources() {
+    int rc = 0;
+    int i = 0;
+    ResourceSampler *sampler = NULL;
+    ResourceSeries *series = NULL;
+    Process *process = NULL;
+    ResourceSample sample;
+    struct rusage usage;
+    struct timespec delay;
+
+    if (!check_series())
+        goto failure;
+    memset(&sample, 0, sizeof(sample));
+    if (!ResourceSampler_read((int) getpid(), &sample)
+            || sample.rss_bytes <= 0 || sample.threads <= 0)
+        goto failure;
+
+    sampler = ResourceSampler_create(10, 16);
+    if (!sampler)
+        goto failure;
+    series = ResourceSeries_create(sampler->calls.getCapacity(sampler));
+    if (!series)
+        goto failure;
+    process = spawn("sleep 5");
+    if (!process)
+        goto failure;
+    if (!sampler->calls.watch(sampler, process->calls.getPID(process), series))
+        goto failure;
+    /* a few intervals, generously for a loaded machine */
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10 * 1000000L;
+    for (i = 0; series->calls.getCount(series) < 2 && i < 100; ++i)
+        nanosleep(&delay, NULL);
+    sampler->calls.unwatch(sampler, series);
+    if (series->calls.getCount(series) < 2) {
+        fprintf(stderr, "%d samples taken\n", (int) series->calls.getCount(series));
+        goto failure;
+    }
+
+    if (process->calls.getUsage(process, &usage))
+        goto failure;
+    process->calls.kill(process);
+    process->calls.wait(process, NULL);
+    if (!process->calls.getUsage(process, &usage))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "resource check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (process) {
+        Process_destroy(process);
+        process = NULL;
+    }
+    if (sampler) {
+        ResourceSampler_destroy(sampler);
+        sampler = NULL;
+    }
+    if (series) {
+        ResourceSeries_destroy(series);
+        series = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+    int i = 0;
+    char script[64];
+    ProcessSupervisor *supervisor = NULL;
+    Process *children[NCHILDREN];
+    Process *sleeper = NULL;
+    Outcome outcomes[NCHILDREN];
+    Outcome slept;
+
+    memset(&children[0], 0, sizeof(children));
+    memset(&outcomes[0], 0, sizeof(outcomes));
+    memset(&slept, 0, sizeof(slept));
+
+    if (!check_spawn_failure("/nonexistent/redis-server", NULL,
+                PROCESS_STEP_EXEC, ENOENT))
+        goto failure;
+    if (!check_spawn_failure("/bin/sh", "/nonexistent",
+                PROCESS_STEP_CHDIR, ENOENT))
+        goto failure;
+    if (!check_process_group())
+        goto failure;
+    if (!check_parent_death_signal())
+        goto failure;
+    if (!check_control_group())
+        goto failure;
+    if (!check_output())
+        goto failure;
+    if (!check_environment())
+        goto failure;
+    if (!check_resources())
+        goto failure;
+
+    supervisor = ProcessSupervisor_create();
+    if (!supervisor)
+        goto failure;
+
+    /* every child exits with its own index, the last one is killed */
+    for (i = 0; i < NCHILDREN; ++i) {
+        if (i == NCHILDREN - 1)
+            snprintf(&script[0], sizeof(script), "kill -TERM $$");
+        else
+            snprintf(&script[0], sizeof(script), "exit %d", i);
+        children[i] = spawn(&script[0]);
+        if (!children[i])
+            goto failure;
+        if (!supervisor->calls.add(supervisor, children[i], &on_exit_cb, &outcomes[i]))
+            goto failure;
+    }
+    if (!supervisor->calls.waitAll(supervisor, 5000))
+        goto failure;
+    for (i = 0; i < NCHILDREN - 1; ++i) {
+        if (!outcomes[i].exited || outcomes[i].exitcode != i) {
+            fprintf(stderr, "child %d: exited %d with %d\n",
+                    i, outcomes[i].exited, outcomes[i].exitcode);
+            goto failure;
+        }
+    }
+    if (outcomes[NCHILDREN - 1].signal != SIGTERM)
+        goto failure;
+
+    /* a long running child must make waitAll and waitFor time out */
+    sleeper = spawn("sleep 5");
+    if (!sleeper)
+        goto failure;
+    supervisor->calls.add(supervisor, sleeper, &on_exit_cb, &slept);
+    if (supervisor->calls.waitAll(supervisor, 50) || slept.exited)
+        goto failure;
+    if (sleeper->calls.waitFor(sleeper, 50, NULL))
+        goto failure;
+    sleeper->calls.kill(sleeper);
+    if (!supervisor->calls.waitAll(supervisor, 5000) || slept.signal != SIGKILL)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    for (i = 0; i < NCHILDREN; ++i) {
+        if (children[i]) {
+            Process_destroy(children[i]);
+            children[i] = NULL;
+        }
+    }
+    if (sleeper) {
+        Process_destroy(sleeper);
+        sleeper = NULL;
+    }
+    if (supervisor) {
+        ProcessSupervisor_destroy(supervisor);
+        supervisor = NULL;
+    }
+    goto exit;
+}
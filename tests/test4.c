@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/redisclusterbuilder.h"
+#include "../src/redisclient.h"
+
+#define NMASTERS 3
+#define NREPLICAS 1
+
+/* every node must agree that the cluster is complete and healthy */
+static
+int check_node(RedisInstance *node) {
+    int rc = 0;
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+
+    client = node->calls.connect(node, 1000);
+    if (!client)
+        goto failure;
+    reply = client->calls.commandv(client, "CLUSTER", "INFO", NULL);
+    if (!reply || !reply->str || !strstr(reply->str, "cluster_state:ok"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "node on port %d is not ready\n", node->calls.getPort(node));
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+    int status = 0;
+    int first = 0;
+    int last = 0;
+    int next = 0;
+    size_t i = 0;
+    RedisClusterBuilder *builder = NULL;
+    RedisCluster *cluster = NULL;
+
+    builder = RedisClusterBuilder_create(NULL);
+    if (!builder)
+        goto failure;
+    builder->calls.setMasters(builder, NMASTERS);
+    builder->calls.setReplicas(builder, NREPLICAS);
+    cluster = builder->calls.build(builder, &status);
+    if (!cluster) {
+        fprintf(stderr, "build redis cluster failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+    if (cluster->calls.getNodeCount(cluster) != NMASTERS * (1 + NREPLICAS))
+        goto failure;
+
+    /* masters cover all slots without gaps, replicas follow their master */
+    for (i = 0; i < cluster->calls.getNodeCount(cluster); ++i) {
+        if (!check_node(cluster->calls.getNode(cluster, i)))
+            goto failure;
+        if (i < NMASTERS) {
+            if (cluster->calls.getMaster(cluster, i) != -1
+                    || !cluster->calls.getSlots(cluster, i, &first, &last)
+                    || first != next)
+                goto failure;
+            next = last + 1;
+        } else if (cluster->calls.getMaster(cluster, i) != (long) ((i - NMASTERS) / NREPLICAS)) {
+            goto failure;
+        }
+    }
+    if (next != REDIS_CLUSTER_SLOTS)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    if (cluster) {
+        RedisCluster_destroy(cluster);
+        cluster = NULL;
+    }
+    if (builder) {
+        RedisClusterBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
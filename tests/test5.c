@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/redisreplicationbuilder.h"
+#include "../src/redisclient.h"
+
+#define NREPLICAS 2
+
+/* a key written to the master must be readable on every replica */
+static
+int check_replica(RedisInstance *node) {
+    int rc = 0;
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+
+    client = node->calls.connect(node, 1000);
+    if (!client)
+        goto failure;
+    reply = client->calls.commandv(client, "GET", "replication:lag:0", NULL);
+    if (!RedisClientReply_is(reply, "xxxxxxxx"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "replica on port %d is behind\n", node->calls.getPort(node));
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (reply) {
+        RedisClientReply_destroy(reply);
+        reply = NULL;
+    }
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+    int status = 0;
+    size_t i = 0;
+    RedisReplicationLoad load = { 100, 10, 8, 0 };
+    RedisReplicationLag lags[NREPLICAS];
+    RedisReplicationBuilder *builder = NULL;
+    RedisReplication *replication = NULL;
+
+    builder = RedisReplicationBuilder_create(NULL);
+    if (!builder)
+        goto failure;
+    builder->calls.setReplicas(builder, NREPLICAS);
+    builder->calls.setChained(builder, 1);
+    replication = builder->calls.build(builder, &status);
+    if (!replication) {
+        fprintf(stderr, "build redis replication failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+    if (replication->calls.getReplicaCount(replication) != NREPLICAS
+            || replication->calls.getUpstream(replication, 0) != -1
+            || replication->calls.getUpstream(replication, 1) != 0)
+        goto failure;
+
+    if (!replication->calls.measureLag(replication, &load, &lags[0]))
+        goto failure;
+    for (i = 0; i < NREPLICAS; ++i) {
+        if (lags[i].samples != 10 || lags[i].min_us > lags[i].max_us)
+            goto failure;
+        printf("replica %lu lag min %ldus avg %ldus max %ldus\n",
+                (unsigned long) i, lags[i].min_us, lags[i].avg_us, lags[i].max_us);
+        if (!check_replica(replication->calls.getReplica(replication, i)))
+            goto failure;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    if (replication) {
+        RedisReplication_destroy(replication);
+        replication = NULL;
+    }
+    if (builder) {
+        RedisReplicationBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
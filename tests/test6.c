@@ -0,0 +1,1036 @@
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../src/redisserverbuilder.h"
+#include "../src/redisclient.h"
+
+/* 1 if command on client answers expected */
+static
+int answers(RedisClient *client, char const *expected, char const *command,
+        char const *arg) {
+    int rc = 0;
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.commandv(client, command, arg, NULL);
+    rc = RedisClientReply_is(reply, expected);
+    if (!rc)
+        fprintf(stderr, "%s %s: %s\n", command, arg ? arg : "",
+                reply && reply->str ? reply->str : "no reply");
+    RedisClientReply_destroy(reply);
+    return rc;
+}
+
+#define NINSTANCES 4
+/* first of the two ports the partial buildMany may use */
+#define PARTIAL_FIRST_PORT 40200
+
+/* remove dir and the files in it */
+static
+void remove_dir(char const *dir) {
+    char path[4096];
+    DIR *d = NULL;
+    struct dirent *entry = NULL;
+
+    d = opendir(dir);
+    if (d) {
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            snprintf(&path[0], sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(&path[0]);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/* 1 if instance answers PING on a connection of its own */
+static
+int pings(RedisInstance *instance) {
+    int rc = 0;
+    RedisClient *client = NULL;
+
+    client = instance->calls.connect(instance, 1000);
+    rc = client && answers(client, "PONG", "PING", NULL);
+    if (client)
+        RedisClient_destroy(client);
+    return rc;
+}
+
+/*
+ * buildMany must start every instance on a port of its own, report the
+ * ones that found no port in statuses and fail a batch of bad servers
+ * as a whole.
+ */
+static
+int check_build_many() {
+    int rc = 0;
+    int statuses[NINSTANCES];
+    size_t i = 0;
+    size_t j = 0;
+    size_t failed = 0;
+    char lockdir[] = "/tmp/test6-XXXXXX";
+    int created = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instances[NINSTANCES];
+    PortAllocator *allocator = NULL;
+
+    memset(&instances[0], 0, sizeof(instances));
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    if (builder->calls.buildMany(builder, NINSTANCES, &instances[0],
+                &statuses[0]) != NINSTANCES)
+        goto failure;
+    for (i = 0; i < NINSTANCES; ++i) {
+        if (!instances[i] || statuses[i] != REDIS_SERVER_STATUS_OK
+                || !pings(instances[i]))
+            goto failure;
+        for (j = 0; j < i; ++j)
+            if (instances[j]->calls.getPort(instances[j])
+                    == instances[i]->calls.getPort(instances[i]))
+                goto failure;
+    }
+    for (i = 0; i < NINSTANCES; ++i) {
+        RedisInstance_destroy(instances[i]);
+        instances[i] = NULL;
+    }
+
+    /* two ports for three servers, the one left without fails alone */
+    if (!mkdtemp(&lockdir[0]))
+        goto failure;
+    created = 1;
+    allocator = PortAllocator_create(PARTIAL_FIRST_PORT, PARTIAL_FIRST_PORT + 1,
+            &lockdir[0]);
+    if (!allocator)
+        goto failure;
+    builder->calls.setPortAllocator(builder, allocator);
+    if (builder->calls.buildMany(builder, 3, &instances[0], &statuses[0]) != 2)
+        goto failure;
+    for (i = 0; i < 3; ++i) {
+        if (statuses[i] != REDIS_SERVER_STATUS_OK) {
+            ++failed;
+            if (instances[i] || statuses[i] != REDIS_SERVER_STATUS_FAILED)
+                goto failure;
+        } else if (!instances[i] || !pings(instances[i])) {
+            goto failure;
+        }
+    }
+    if (failed != 1)
+        goto failure;
+    for (i = 0; i < 3; ++i) {
+        RedisInstance_destroy(instances[i]);
+        instances[i] = NULL;
+    }
+
+    /* a server that refuses its options fails every member of the batch */
+    builder->calls.setPortAllocator(builder, NULL);
+    if (!builder->calls.optionString(builder, "nosuchoption", "yes"))
+        goto failure;
+    if (builder->calls.buildMany(builder, 2, &instances[0], &statuses[0]) != 0)
+        goto failure;
+    for (i = 0; i < 2; ++i)
+        if (instances[i] || statuses[i] != REDIS_SERVER_STATUS_EXITED)
+            goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "buildMany check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    for (i = 0; i < NINSTANCES; ++i) {
+        if (instances[i]) {
+            RedisInstance_destroy(instances[i]);
+            instances[i] = NULL;
+        }
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    if (allocator) {
+        PortAllocator_destroy(allocator);
+        allocator = NULL;
+    }
+    if (created)
+        remove_dir(&lockdir[0]);
+    goto exit;
+}
+
+/* CONFIG GET name of client, a copy to free */
+static
+char* get_config(RedisClient *client, char const *name) {
+    char *value = NULL;
+    RedisClientReply *reply = NULL;
+
+    reply = client->calls.commandv(client, "CONFIG", "GET", name, NULL);
+    if (reply && reply->type == REDIS_CLIENT_REPLY_ARRAY && reply->elements == 2
+            && reply->element[1]->str)
+        value = strdup(reply->element[1]->str);
+    RedisClientReply_destroy(reply);
+    return value;
+}
+
+/* copy the file at src to dst */
+static
+int copy_file(char const *src, char const *dst) {
+    int rc = 1;
+    size_t n = 0;
+    char buffer[65536];
+    FILE *in = NULL;
+    FILE *out = NULL;
+
+    in = fopen(src, "rb");
+    out = fopen(dst, "wb");
+    if (!in || !out)
+        rc = 0;
+    while (rc && (n = fread(&buffer[0], 1, sizeof(buffer), in)) > 0)
+        rc = fwrite(&buffer[0], 1, n, out) == n;
+    if (in)
+        fclose(in);
+    if (out && fclose(out) != 0)
+        rc = 0;
+    return rc;
+}
+
+/*
+ * Write an RDB holding seed:key with a server of its own, then boot from
+ * it: the key must be there as soon as build1 returns, readiness has to
+ * wait out -LOADING.
+ */
+static
+int check_seed_rdb() {
+    int rc = 0;
+    int status = 0;
+    char seed[] = "/tmp/test6-seed-XXXXXX";
+    char path[4096];
+    int fd = -1;
+    char *dir = NULL;
+    char *dbfilename = NULL;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+
+    fd = mkstemp(&seed[0]);
+    if (fd == -1)
+        goto failure;
+    close(fd);
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance)
+        goto failure;
+    client = instance->calls.connect(instance, 1000);
+    if (!client)
+        goto failure;
+    reply = client->calls.commandv(client, "SET", "seed:key", "seeded", NULL);
+    if (!RedisClientReply_is(reply, "OK"))
+        goto failure;
+    RedisClientReply_destroy(reply);
+    reply = client->calls.commandv(client, "SAVE", NULL);
+    if (!RedisClientReply_is(reply, "OK"))
+        goto failure;
+    dir = get_config(client, "dir");
+    dbfilename = get_config(client, "dbfilename");
+    if (!dir || !dbfilename)
+        goto failure;
+    snprintf(&path[0], sizeof(path), "%s/%s", dir, dbfilename);
+    if (!copy_file(&path[0], &seed[0]))
+        goto failure;
+    RedisClient_destroy(client);
+    client = NULL;
+    RedisInstance_destroy(instance);
+    instance = NULL;
+
+    if (!builder->calls.setSeedRDB(builder, &seed[0]))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance) {
+        fprintf(stderr, "build from seed failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+    client = instance->calls.connect(instance, 1000);
+    if (!client || !answers(client, "seeded", "GET", "seed:key"))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "seed RDB check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    free(dir);
+    free(dbfilename);
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    if (fd != -1)
+        unlink(&seed[0]);
+    goto exit;
+}
+
+/* every copy of a template holds the key the template had */
+static
+int check_clone() {
+    int rc = 0;
+    int status = 0;
+    size_t i = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *tmpl = NULL;
+    RedisInstance *clones[NINSTANCES];
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+
+    memset(&clones[0], 0, sizeof(clones));
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    tmpl = builder->calls.build1(builder, NULL, &status);
+    if (!tmpl)
+        goto failure;
+    client = tmpl->calls.connect(tmpl, 1000);
+    if (!client)
+        goto failure;
+    reply = client->calls.commandv(client, "SET", "clone:key", "cloned", NULL);
+    if (!RedisClientReply_is(reply, "OK"))
+        goto failure;
+    RedisClient_destroy(client);
+    client = NULL;
+
+    if (RedisInstance_clone(tmpl, NINSTANCES, &clones[0]) != NINSTANCES)
+        goto failure;
+    for (i = 0; i < NINSTANCES; ++i) {
+        client = clones[i]->calls.connect(clones[i], 1000);
+        if (!client || !answers(client, "cloned", "GET", "clone:key"))
+            goto failure;
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "clone check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    for (i = 0; i < NINSTANCES; ++i) {
+        if (clones[i]) {
+            RedisInstance_destroy(clones[i]);
+            clones[i] = NULL;
+        }
+    }
+    if (tmpl) {
+        RedisInstance_destroy(tmpl);
+        tmpl = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* a socket mode server answers on its socket, which goes with destroy */
+static
+int check_unix_socket() {
+    int rc = 0;
+    int status = 0;
+    char path[4096];
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder || !builder->calls.setUnixSocketMode(builder, 1))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance || !instance->calls.getUnixSocket(instance)) {
+        fprintf(stderr, "build in socket mode failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+    snprintf(&path[0], sizeof(path), "%s", instance->calls.getUnixSocket(instance));
+    client = RedisClient_connectUnix(&path[0], 1000);
+    if (!client || !answers(client, "PONG", "PING", NULL))
+        goto failure;
+    RedisClient_destroy(client);
+    client = NULL;
+    RedisInstance_destroy(instance);
+    instance = NULL;
+    if (access(&path[0], F_OK) == 0 || errno != ENOENT) {
+        fprintf(stderr, "%s left behind\n", &path[0]);
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "unix socket check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* a server with requirepass must be ready, not time out on -NOAUTH */
+static
+int check_requirepass() {
+    int rc = 0;
+    int status = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+    RedisClientReply *reply = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    builder->calls.setPortAllocator(builder, PortAllocator_getDefault());
+    if (!builder->calls.optionString(builder, "requirepass", "s3cret"))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance) {
+        fprintf(stderr, "build with requirepass failed: %s\n",
+                RedisServerBuilder_getStatusString(status));
+        goto failure;
+    }
+    /* connect authenticates, a bare connection is refused */
+    client = instance->calls.connect(instance, 1000);
+    if (!client || !answers(client, "PONG", "PING", NULL))
+        goto failure;
+    RedisClient_destroy(client);
+    client = RedisClient_connect(NULL, instance->calls.getPort(instance), 1000);
+    if (!client)
+        goto failure;
+    reply = client->calls.commandv(client, "GET", "key", NULL);
+    if (!reply || reply->type != REDIS_CLIENT_REPLY_ERROR
+            || strncmp(reply->str, "NOAUTH", 6) != 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "requirepass check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    RedisClientReply_destroy(reply);
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* the redis-server found in PATH, a copy to free */
+static
+char* find_server() {
+    char const *path = getenv("PATH");
+    char const *pos = path;
+    char const *end = NULL;
+    char candidate[FILENAME_MAX + 1];
+
+    while (pos) {
+        end = strchr(pos, ':');
+        snprintf(&candidate[0], sizeof(candidate), "%.*s/redis-server",
+                end ? (int) (end - pos) : (int) strlen(pos), pos);
+        if (access(&candidate[0], X_OK) == 0)
+            return strdup(&candidate[0]);
+        pos = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+/*
+ * a pinned executable is the one launched, a bad one is not found without
+ * forking anything
+ */
+static
+int check_executable() {
+    int rc = 0;
+    int status = 0;
+    int created = 0;
+    char *server = NULL;
+    char dir[] = "/tmp/test6.XXXXXX";
+    char wrapper[64] = "";
+    char marker[64] = "";
+    FILE *file = NULL;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    LifecycleStats *stats = NULL;
+    LatencyHistogram *forks = NULL;
+
+    server = find_server();
+    if (!server || !mkdtemp(&dir[0]))
+        goto failure;
+    created = 1;
+    /* a wrapper outside PATH that leaves a mark when it runs */
+    snprintf(&wrapper[0], sizeof(wrapper), "%s/redis-server", &dir[0]);
+    snprintf(&marker[0], sizeof(marker), "%s/used", &dir[0]);
+    file = fopen(&wrapper[0], "w");
+    if (!file)
+        goto failure;
+    fprintf(file, "#!/bin/sh\n: > %s\nexec %s \"$@\"\n", &marker[0], server);
+    fclose(file);
+    file = NULL;
+    if (chmod(&wrapper[0], 0755) != 0)
+        goto failure;
+
+    builder = RedisServerBuilder_create();
+    stats = LifecycleStats_create();
+    forks = LatencyHistogram_create();
+    if (!builder || !stats || !forks)
+        goto failure;
+    if (builder->calls.setExecutable(builder, "/nonexistent/redis-server"))
+        goto failure;
+    if (!builder->calls.setExecutable(builder, &wrapper[0]))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance || !pings(instance) || access(&marker[0], F_OK) != 0)
+        goto failure;
+    RedisInstance_destroy(instance);
+    instance = NULL;
+
+    /* the pinned file stops being executable after setExecutable */
+    if (chmod(&wrapper[0], 0644) != 0)
+        goto failure;
+    builder->calls.setStats(builder, stats);
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (instance || status != REDIS_SERVER_STATUS_NOT_FOUND
+            || strcmp(RedisServerBuilder_getStatusString(status),
+                "executable not found") != 0)
+        goto failure;
+    /* so is a bad path given to build1 */
+    instance = builder->calls.build1(builder, "/nonexistent/redis-server", &status);
+    if (instance || status != REDIS_SERVER_STATUS_NOT_FOUND)
+        goto failure;
+    if (!stats->calls.snapshot(stats, LIFECYCLE_SPAN_FORK, forks)
+            || forks->calls.getCount(forks) != 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "executable check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    if (stats) {
+        LifecycleStats_destroy(stats);
+        stats = NULL;
+    }
+    if (forks) {
+        LatencyHistogram_destroy(forks);
+        forks = NULL;
+    }
+    if (created)
+        remove_dir(&dir[0]);
+    free(server);
+    server = NULL;
+    goto exit;
+}
+
+/* options handed over as a config file still reach the server */
+static
+int check_config_file() {
+    int rc = 0;
+    int status = 0;
+    char *value = NULL;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder || !builder->calls.setConfigFileMode(builder, 1)
+            || !builder->calls.optionString(builder, "maxmemory-policy", "allkeys-lru"))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance)
+        goto failure;
+    client = instance->calls.connect(instance, 1000);
+    if (!client)
+        goto failure;
+    value = get_config(client, "maxmemory-policy");
+    if (!value || strcmp(value, "allkeys-lru") != 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "config file check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    free(value);
+    value = NULL;
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/*
+ * placement setters refuse what they can not apply, a server placed on
+ * one of our cpus runs there, its threads too
+ */
+static
+int check_placement() {
+    int rc = 0;
+    int status = 0;
+    int cpu = 0;
+    char cpulist[16];
+    char *value = NULL;
+    cpu_set_t set;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+    Process *process = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    if (builder->calls.setPlacement(builder, -1, NULL, 1)
+            || builder->calls.setPlacement(builder, REDIS_SERVER_PLACEMENT_ROUND_ROBIN + 1,
+                NULL, 1)
+            || builder->calls.setPlacement(builder, REDIS_SERVER_PLACEMENT_SHARED, "3-1", 1)
+            || builder->calls.setPlacement(builder, REDIS_SERVER_PLACEMENT_SHARED, "cpu0", 1)
+            || builder->calls.setPlacement(builder, REDIS_SERVER_PLACEMENT_SHARED, "", 1))
+        goto failure;
+    if (builder->calls.setMemoryNode(builder, -2)
+            || builder->calls.setMemoryNode(builder, PROCESS_MAX_NODES)
+            || !builder->calls.setMemoryNode(builder, -1))
+        goto failure;
+
+    /* the first cpu this process may run on */
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        goto failure;
+    while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &set))
+        ++cpu;
+    snprintf(&cpulist[0], sizeof(cpulist), "%d", cpu);
+    if (!builder->calls.setPlacement(builder, REDIS_SERVER_PLACEMENT_SHARED, &cpulist[0], 1)
+            || !builder->calls.setThreadCPUs(builder, 1))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance || !pings(instance))
+        goto failure;
+    process = instance->calls.getProcess(instance);
+    CPU_ZERO(&set);
+    if (sched_getaffinity(process->calls.getPID(process), sizeof(set), &set) != 0
+            || CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set))
+        goto failure;
+    client = instance->calls.connect(instance, 1000);
+    if (!client)
+        goto failure;
+    value = get_config(client, "server_cpulist");
+    if (!value || strcmp(value, &cpulist[0]) != 0)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "placement check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    free(value);
+    value = NULL;
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* a private dir is the server's dir while it runs and goes with it */
+static
+int check_private_dir() {
+    int rc = 0;
+    int status = 0;
+    char *dir = NULL;
+    char cwd[4096];
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+
+    builder = RedisServerBuilder_create();
+    if (!builder || !builder->calls.setPrivateDir(builder, 1)
+            || !getcwd(&cwd[0], sizeof(cwd)))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance)
+        goto failure;
+    client = instance->calls.connect(instance, 1000);
+    if (!client)
+        goto failure;
+    dir = get_config(client, "dir");
+    if (!dir || strcmp(dir, &cwd[0]) == 0 || access(dir, R_OK | W_OK | X_OK) != 0)
+        goto failure;
+    RedisClient_destroy(client);
+    client = NULL;
+    RedisInstance_destroy(instance);
+    instance = NULL;
+    if (access(dir, F_OK) == 0 || errno != ENOENT)
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "private dir check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    free(dir);
+    dir = NULL;
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* every persistence preset ends up as its save and appendonly config */
+static
+int check_persistence() {
+    static struct {
+        int persistence;
+        char const *save;
+        char const *appendonly;
+        char const *appendfsync;
+    } const presets[] = {
+        { REDIS_SERVER_PERSISTENCE_NONE, "", "no", "everysec" },
+        { REDIS_SERVER_PERSISTENCE_RDB, "3600 1 300 100 60 10000", "no", "everysec" },
+        { REDIS_SERVER_PERSISTENCE_AOF_EVERYSEC, "", "yes", "everysec" },
+        { REDIS_SERVER_PERSISTENCE_AOF_ALWAYS, "", "yes", "always" }
+    };
+    int rc = 0;
+    int status = 0;
+    size_t i = 0;
+    char *values[3] = { NULL, NULL, NULL };
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisClient *client = NULL;
+
+    builder = RedisServerBuilder_create();
+    /* the preset wins over the options given */
+    if (!builder || !builder->calls.optionString(builder, "save", "900 1")
+            || !builder->calls.optionString(builder, "appendonly", "no"))
+        goto failure;
+    if (builder->calls.setPersistence(builder, REDIS_SERVER_PERSISTENCE_AOF_ALWAYS + 1))
+        goto failure;
+    for (i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i) {
+        if (!builder->calls.setPersistence(builder, presets[i].persistence))
+            goto failure;
+        instance = builder->calls.build1(builder, NULL, &status);
+        if (!instance)
+            goto failure;
+        client = instance->calls.connect(instance, 1000);
+        if (!client)
+            goto failure;
+        values[0] = get_config(client, "save");
+        values[1] = get_config(client, "appendonly");
+        values[2] = get_config(client, "appendfsync");
+        if (!values[0] || !values[1] || !values[2]
+                || strcmp(values[0], presets[i].save) != 0
+                || strcmp(values[1], presets[i].appendonly) != 0
+                || strcmp(values[2], presets[i].appendfsync) != 0) {
+            fprintf(stderr, "persistence %d: save \"%s\" appendonly %s appendfsync %s\n",
+                    presets[i].persistence, values[0] ? values[0] : "",
+                    values[1] ? values[1] : "", values[2] ? values[2] : "");
+            goto failure;
+        }
+        free(values[0]);
+        free(values[1]);
+        free(values[2]);
+        memset(&values[0], 0, sizeof(values));
+        RedisClient_destroy(client);
+        client = NULL;
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "persistence check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    for (i = 0; i < 3; ++i) {
+        free(values[i]);
+        values[i] = NULL;
+    }
+    if (client) {
+        RedisClient_destroy(client);
+        client = NULL;
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+/* monotonic ms */
+static
+long now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+ * shutdown and shutdownMany reap what they stop and count it, a server
+ * refusing SHUTDOWN gets SIGTERM without waiting half the timeout
+ */
+static
+int check_shutdown() {
+    int rc = 0;
+    int status = 0;
+    int pid = 0;
+    long started = 0;
+    size_t i = 0;
+    RedisServerBuilder *builder = NULL;
+    RedisInstance *instance = NULL;
+    RedisInstance *instances[NINSTANCES + 1];
+
+    memset(&instances[0], 0, sizeof(instances));
+    builder = RedisServerBuilder_create();
+    if (!builder)
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance)
+        goto failure;
+    pid = instance->calls.getProcess(instance)->calls.getPID(
+            instance->calls.getProcess(instance));
+    if (instance->calls.shutdown(instance, 10000) != 1
+            || instance->calls.getProcess(instance)
+            || kill(pid, 0) == 0 || errno != ESRCH)
+        goto failure;
+    RedisInstance_destroy(instance);
+    instance = NULL;
+
+    /* the NULL entry at the end is skipped */
+    if (builder->calls.buildMany(builder, NINSTANCES, &instances[0], NULL) != NINSTANCES
+            || RedisInstance_shutdownMany(&instances[0], NINSTANCES + 1, 10000)
+            != NINSTANCES)
+        goto failure;
+    for (i = 0; i < NINSTANCES; ++i) {
+        if (instances[i]->calls.getProcess(instances[i]))
+            goto failure;
+    }
+
+    if (!builder->calls.optionString(builder, "rename-command", "SHUTDOWN \"\""))
+        goto failure;
+    instance = builder->calls.build1(builder, NULL, &status);
+    if (!instance)
+        goto failure;
+    started = now_ms();
+    if (instance->calls.shutdown(instance, 10000) != 1
+            || now_ms() - started >= 5000) {
+        fprintf(stderr, "refused SHUTDOWN took %ld ms\n", now_ms() - started);
+        goto failure;
+    }
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "shutdown check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    for (i = 0; i < NINSTANCES; ++i) {
+        if (instances[i]) {
+            RedisInstance_destroy(instances[i]);
+            instances[i] = NULL;
+        }
+    }
+    if (instance) {
+        RedisInstance_destroy(instance);
+        instance = NULL;
+    }
+    if (builder) {
+        RedisServerBuilder_destroy(builder);
+        builder = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+
+    if (!check_requirepass())
+        goto failure;
+    if (!check_build_many())
+        goto failure;
+    if (!check_unix_socket())
+        goto failure;
+    if (!check_seed_rdb())
+        goto failure;
+    if (!check_clone())
+        goto failure;
+    if (!check_executable())
+        goto failure;
+    if (!check_config_file())
+        goto failure;
+    if (!check_placement())
+        goto failure;
+    if (!check_private_dir())
+        goto failure;
+    if (!check_persistence())
+        goto failure;
+    if (!check_shutdown())
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    goto exit;
+}
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "../src/portallocator.h"
+#include "../src/stringarena.h"
+
+#define FIRST_PORT  41000
+#define NPORTS      8
+/* past the initial 256 bytes and 8 slots of an arena */
+#define NSTRINGS    64
+
+/* remove dir and the files in it */
+static
+void remove_dir(char const *dir) {
+    char path[4096];
+    DIR *d = NULL;
+    struct dirent *entry = NULL;
+
+    d = opendir(dir);
+    if (d) {
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            snprintf(&path[0], sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(&path[0]);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/*
+ * Two allocators sharing a lock dir, as two test processes would, must
+ * never hand out the same port, and a leased port stays taken until it
+ * is released.
+ */
+static
+int check_port_allocator() {
+    int rc = 0;
+    int i = 0;
+    int j = 0;
+    int n = 0;
+    int port = 0;
+    int held = 0;
+    int lease = -1;
+    int ports[NPORTS + 1];
+    int leases[NPORTS + 1];
+    char lockdir[] = "/tmp/test7-XXXXXX";
+    int created = 0;
+    PortAllocator *allocators[2] = { NULL, NULL };
+
+    if (!mkdtemp(&lockdir[0]))
+        goto failure;
+    created = 1;
+    for (i = 0; i < 2; ++i) {
+        allocators[i] = PortAllocator_create(FIRST_PORT, FIRST_PORT + NPORTS - 1,
+                &lockdir[0]);
+        if (!allocators[i])
+            goto failure;
+    }
+    /* take turns until the range is used up */
+    for (i = 0; n <= NPORTS; ++i) {
+        port = allocators[i % 2]->calls.acquire(allocators[i % 2], &leases[n]);
+        if (!port)
+            break;
+        for (j = 0; j < n; ++j) {
+            if (ports[j] == port) {
+                fprintf(stderr, "port %d handed out twice\n", port);
+                goto failure;
+            }
+        }
+        ports[n++] = port;
+    }
+    if (n < 1 || n > NPORTS)
+        goto failure;
+
+    held = ports[0];
+    if (allocators[0]->calls.lease(allocators[0], held, &lease)
+            || allocators[1]->calls.lease(allocators[1], held, &lease))
+        goto failure;
+    PortAllocator_release(leases[0]);
+    leases[0] = -1;
+    if (!allocators[1]->calls.lease(allocators[1], held, &lease))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "port allocator check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    for (i = 0; i < n; ++i)
+        PortAllocator_release(leases[i]);
+    PortAllocator_release(lease);
+    for (i = 0; i < 2; ++i) {
+        if (allocators[i]) {
+            PortAllocator_destroy(allocators[i]);
+            allocators[i] = NULL;
+        }
+    }
+    if (created)
+        remove_dir(&lockdir[0]);
+    goto exit;
+}
+
+/* 1 if arena holds the n strings of expected, in order */
+static
+int holds(StringArena const *arena, char expected[][512], size_t n) {
+    size_t i = 0;
+    size_t size = 0;
+    char const **array = NULL;
+
+    if (arena->calls.getCount(arena) != n)
+        return 0;
+    array = arena->calls.getArray(arena);
+    for (i = 0; i < n; ++i) {
+        if (strcmp(arena->calls.get(arena, i), expected[i]) != 0
+                || array[i] != arena->calls.get(arena, i))
+            return 0;
+        size += strlen(expected[i]) + 1;
+    }
+    return array[n] == NULL && arena->calls.get(arena, n) == NULL
+        && arena->calls.getSize(arena) == size;
+}
+
+/* drop string i of the *n in expected */
+static
+void drop(char expected[][512], size_t *n, size_t i) {
+    memmove(expected[i], expected[i + 1], (*n - i - 1) * sizeof(expected[0]));
+    --*n;
+}
+
+/*
+ * Replacing with longer and shorter strings and removing at either end
+ * or in the middle keeps every string and the index in step, also once
+ * the buffers grew and in a clone taken afterwards.
+ */
+static
+int check_string_arena() {
+    int rc = 0;
+    size_t i = 0;
+    size_t n = 0;
+    char expected[NSTRINGS][512];
+    StringArena *arena = NULL;
+    StringArena *copy = NULL;
+
+    arena = StringArena_create();
+    if (!arena)
+        goto failure;
+    for (n = 0; n < NSTRINGS; ++n) {
+        snprintf(expected[n], sizeof(expected[n]), "string %zu", n);
+        if (!arena->calls.append(arena, expected[n], strlen(expected[n])))
+            goto failure;
+    }
+    if (!holds(arena, expected, n))
+        goto failure;
+
+    /* longer, the tail moves back and the buffer grows */
+    memset(expected[0], 'l', 500);
+    expected[0][500] = '\0';
+    if (!arena->calls.replace(arena, 0, expected[0], strlen(expected[0]))
+            || !holds(arena, expected, n))
+        goto failure;
+    /* shorter, the tail moves up */
+    strcpy(expected[n / 2], "s");
+    if (!arena->calls.replace(arena, n / 2, "s", 1)
+            || !holds(arena, expected, n))
+        goto failure;
+    strcpy(expected[n - 1], "");
+    if (!arena->calls.replace(arena, n - 1, "", 0)
+            || !holds(arena, expected, n))
+        goto failure;
+    if (arena->calls.replace(arena, n, "x", 1))
+        goto failure;
+
+    if (!arena->calls.remove(arena, 0))
+        goto failure;
+    drop(expected, &n, 0);
+    if (!holds(arena, expected, n) || !arena->calls.remove(arena, n / 2))
+        goto failure;
+    drop(expected, &n, n / 2);
+    if (!holds(arena, expected, n) || !arena->calls.remove(arena, n - 1))
+        goto failure;
+    drop(expected, &n, n - 1);
+    if (!holds(arena, expected, n))
+        goto failure;
+    if (arena->calls.remove(arena, n))
+        goto failure;
+
+    /* a clone is a deep copy */
+    copy = arena->calls.clone(arena);
+    if (!copy || !holds(copy, expected, n))
+        goto failure;
+    if (!copy->calls.replace(copy, 0, "changed", 7)
+            || !holds(arena, expected, n))
+        goto failure;
+    strcpy(expected[0], "changed");
+    if (!holds(copy, expected, n))
+        goto failure;
+
+    while (n > 0) {
+        if (!copy->calls.remove(copy, 0))
+            goto failure;
+        drop(expected, &n, 0);
+        if (!holds(copy, expected, n))
+            goto failure;
+    }
+    for (i = 0; i < 3; ++i) {
+        snprintf(expected[i], sizeof(expected[i]), "again %zu", i);
+        if (!copy->calls.append(copy, expected[i], strlen(expected[i])))
+            goto failure;
+    }
+    if (!holds(copy, expected, i))
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = 1;
+    goto cleanup;
+failure:
+    fprintf(stderr, "string arena check failed\n");
+    rc = 0;
+    goto cleanup;
+cleanup:
+    if (copy) {
+        StringArena_destroy(copy);
+        copy = NULL;
+    }
+    if (arena) {
+        StringArena_destroy(arena);
+        arena = NULL;
+    }
+    goto exit;
+}
+
+int main(int argc, char* *argv) {
+    int rc = 0;
+
+    if (!check_port_allocator())
+        goto failure;
+    if (!check_string_arena())
+        goto failure;
+
+    goto success;
+exit:
+    return rc;
+success:
+    rc = EXIT_SUCCESS;
+    goto cleanup;
+failure:
+    rc = EXIT_FAILURE;
+    goto cleanup;
+cleanup:
+    goto exit;
+}